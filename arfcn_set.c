@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "arfcn_set.h"
+
+void arfcn_set_clear(struct arfcn_set *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+void arfcn_set_add(struct arfcn_set *set, uint16_t arfcn)
+{
+	arfcn &= 1023;
+	set->w[arfcn >> 6] |= 1ULL << (arfcn & 63);
+}
+
+void arfcn_set_del(struct arfcn_set *set, uint16_t arfcn)
+{
+	arfcn &= 1023;
+	set->w[arfcn >> 6] &= ~(1ULL << (arfcn & 63));
+}
+
+int arfcn_set_has(const struct arfcn_set *set, uint16_t arfcn)
+{
+	arfcn &= 1023;
+	return !!(set->w[arfcn >> 6] & (1ULL << (arfcn & 63)));
+}
+
+unsigned arfcn_set_count(const struct arfcn_set *set)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < ARFCN_SET_WORDS; i++) {
+		count += __builtin_popcountll(set->w[i]);
+	}
+
+	return count;
+}
+
+/* Return the ARFCN following prev (-1 to start), or -1 at the end */
+int arfcn_set_next(const struct arfcn_set *set, int prev)
+{
+	unsigned start, w;
+	uint64_t bits;
+
+	/* ARFCN 0 is always the last one */
+	if (prev == 0)
+		return -1;
+
+	start = (prev < 0) ? 1 : prev + 1;
+
+	for (w = start >> 6; w < ARFCN_SET_WORDS; w++) {
+		bits = set->w[w];
+		if (w == (start >> 6))
+			bits &= ~0ULL << (start & 63);
+		if (bits)
+			return (w << 6) + __builtin_ctzll(bits);
+	}
+
+	return arfcn_set_has(set, 0) ? 0 : -1;
+}
+
+/* Return the n-th (counting from 0) ARFCN of the set, or -1 */
+int arfcn_set_select(const struct arfcn_set *set, unsigned n)
+{
+	unsigned w, count;
+	uint64_t bits;
+
+	for (w = 0; w < ARFCN_SET_WORDS; w++) {
+		bits = set->w[w];
+		if (w == 0)
+			bits &= ~1ULL;
+
+		count = __builtin_popcountll(bits);
+		if (n < count) {
+			/* drop the n lowest bits */
+			while (n--)
+				bits &= bits - 1;
+			return (w << 6) + __builtin_ctzll(bits);
+		}
+		n -= count;
+	}
+
+	if (n == 0 && arfcn_set_has(set, 0))
+		return 0;
+
+	return -1;
+}
+
+/* Collect all entries of a decoded frequency list matching mask */
+void arfcn_set_from_freq(struct arfcn_set *set, const struct gsm_sysinfo_freq *freq, uint8_t mask)
+{
+	unsigned i;
+
+	arfcn_set_clear(set);
+
+	for (i = 0; i < 1024; i++) {
+		if (freq[i].mask & mask)
+			set->w[i >> 6] |= 1ULL << (i & 63);
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef ARFCN_SET_H
+#define ARFCN_SET_H
+
+#include <stdint.h>
+#include <osmocom/gsm/gsm48_ie.h>
+
+#define ARFCN_SET_WORDS (1024 / 64)
+
+/* Compact set of GSM ARFCNs (0..1023), one bit per ARFCN */
+struct arfcn_set {
+	uint64_t w[ARFCN_SET_WORDS];
+};
+
+void arfcn_set_clear(struct arfcn_set *set);
+void arfcn_set_add(struct arfcn_set *set, uint16_t arfcn);
+void arfcn_set_del(struct arfcn_set *set, uint16_t arfcn);
+int arfcn_set_has(const struct arfcn_set *set, uint16_t arfcn);
+unsigned arfcn_set_count(const struct arfcn_set *set);
+
+/*
+ * Iteration and selection use the cell allocation order of GSM 04.08
+ * 10.5.2.21: ascending ARFCN, but with ARFCN 0 sorted last.
+ */
+int arfcn_set_next(const struct arfcn_set *set, int prev);
+int arfcn_set_select(const struct arfcn_set *set, unsigned n);
+
+void arfcn_set_from_freq(struct arfcn_set *set, const struct gsm_sysinfo_freq *freq, uint8_t mask);
+
+#endif
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <osmocom/gsm/rsl.h>
 #include <osmocom/gsm/tlv.h>
 #include <osmocom/gsm/gsm48.h>
@@ -5,8 +6,101 @@
 #include <osmocom/gsm/protocol/gsm_04_08.h>
 
 #include "assignment.h"
+#include "freq_cache.h"
 
-void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_freq *cell_arfcns, struct gsm_assignment *ga)
+/* Where the frequencies of a hopping assignment come from */
+#define ALLOC_CELL	0	/* cell allocation of the session */
+#define ALLOC_CELL_CH	1	/* Cell Channel Description IE */
+#define ALLOC_MA	2	/* Mobile Allocation IE, refers to the cell allocation */
+#define ALLOC_FREQ_L	3	/* Frequency List IE */
+
+/* Decode a range/bitmap encoded frequency list IE into an ARFCN set */
+static void decode_freq_list(struct arfcn_set *set, const uint8_t *v, uint8_t len)
+{
+	struct gsm_sysinfo_freq freq[1024];
+
+	memset(freq, 0, sizeof(freq));
+	gsm48_decode_freq_list(freq, (uint8_t *) v, len, 0xff, 0x01);
+	arfcn_set_from_freq(set, freq, 0x01);
+}
+
+static void decode_freq_alloc(struct freq_alloc *fa, int source, const uint8_t *v, uint8_t len, const struct arfcn_set *cell_arfcns)
+{
+	int arfcn;
+	unsigned j;
+
+	memset(fa, 0, sizeof(*fa));
+
+	switch (source) {
+	case ALLOC_CELL_CH:
+	case ALLOC_FREQ_L:
+		decode_freq_list(&fa->arfcns, v, len);
+		break;
+	default:
+		fa->arfcns = *cell_arfcns;
+	}
+
+	if (source != ALLOC_MA) {
+		for (arfcn = arfcn_set_next(&fa->arfcns, -1); arfcn >= 0; arfcn = arfcn_set_next(&fa->arfcns, arfcn)) {
+			if (fa->ma_len < 128) {
+				fa->ma[fa->ma_len++] = arfcn;
+			}
+		}
+		fa->ma_known = 1;
+		return;
+	}
+
+	/* Bit j (from the last octet on) selects the j-th allocated ARFCN */
+	for (j = 0; j < len*8u; j++) {
+		if (!(v[len - (j>>3) - 1] & (1 << (j&7))))
+			continue;
+		arfcn = arfcn_set_select(&fa->arfcns, j);
+		if (arfcn < 0)
+			break;
+		if (fa->ma_len < 128) {
+			fa->ma[fa->ma_len++] = arfcn;
+		}
+	}
+	fa->ma_known = fa->ma_len > 0;
+	if (fa->ma_len == 0) {
+		/* cell information not found */
+		/* just compute ma_len */
+		for (j=0; j<len; j++) {
+			fa->ma_len += __builtin_popcount(v[j]);
+		}
+	}
+}
+
+/* Look up or decode the hopping frequencies, keyed by the raw IE */
+static const struct freq_alloc *get_freq_alloc(int source, const uint8_t *v, uint8_t len, const struct arfcn_set *cell_arfcns)
+{
+	static struct freq_alloc fa;
+	const struct freq_alloc *cached;
+	uint8_t key[FREQ_CACHE_KEY_MAX];
+	unsigned key_len = 0;
+
+	key[key_len++] = source;
+	key[key_len++] = len;
+	if (len) {
+		memcpy(&key[key_len], v, len);
+		key_len += len;
+	}
+	if (source == ALLOC_CELL || source == ALLOC_MA) {
+		memcpy(&key[key_len], cell_arfcns, sizeof(*cell_arfcns));
+		key_len += sizeof(*cell_arfcns);
+	}
+
+	cached = freq_cache_get(key, key_len);
+	if (cached)
+		return cached;
+
+	decode_freq_alloc(&fa, source, v, len, cell_arfcns);
+	freq_cache_put(key, key_len, &fa);
+
+	return &fa;
+}
+
+void parse_assignment(struct gsm48_hdr *hdr, unsigned len, const struct arfcn_set *cell_arfcns, struct gsm_assignment *ga)
 {
 	struct gsm48_ass_cmd *ac;
 	struct gsm48_ho_cmd *hoc;
@@ -14,10 +108,10 @@ void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_fr
 	int payload_len = 0; 
 	uint8_t *payload_data = NULL;
 	struct tlv_parsed tp;
-	uint8_t *ma = 0;
-	uint8_t ma_len;
+	const uint8_t *alloc_v = NULL;
+	uint8_t alloc_len = 0;
+	int alloc_source;
 	uint8_t ch_type, ch_subch, ch_ts;
-	unsigned i, mask;
 
 	if (!ga)
 		return;
@@ -57,41 +151,24 @@ void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_fr
 	/* Parse TLV in the message */
 	tlv_parse(&tp, &gsm48_rr_att_tlvdef, payload_data, payload_len, 0, 0);
 
-	ma_len = 0;
-	ma = NULL;
-	mask = 0;
-
 	/* Cell channel description */
 	if (TLVP_PRESENT(&tp, GSM48_IE_CELL_CH_DESC)) {
-		const uint8_t *v = TLVP_VAL(&tp, GSM48_IE_CELL_CH_DESC);
-		uint8_t len = TLVP_LEN(&tp, GSM48_IE_CELL_CH_DESC);
-		gsm48_decode_freq_list(cell_arfcns, (uint8_t *) v, len, 0xff, 0x02);
-		mask = 0x02;
+		alloc_v = TLVP_VAL(&tp, GSM48_IE_CELL_CH_DESC);
+		alloc_len = TLVP_LEN(&tp, GSM48_IE_CELL_CH_DESC);
+		alloc_source = ALLOC_CELL_CH;
 	} else if (TLVP_PRESENT(&tp, GSM48_IE_MA_AFTER)) {
 		/* Mobile allocation */
-		const uint8_t *v = TLVP_VAL(&tp, GSM48_IE_MA_AFTER);
-		uint8_t len = TLVP_LEN(&tp, GSM48_IE_MA_AFTER);
-
-		ma_len = len;
-		ma = (uint8_t *) v;
-		mask = 0x01;
+		alloc_v = TLVP_VAL(&tp, GSM48_IE_MA_AFTER);
+		alloc_len = TLVP_LEN(&tp, GSM48_IE_MA_AFTER);
+		alloc_source = ALLOC_MA;
 	} else if (TLVP_PRESENT(&tp, GSM48_IE_FREQ_L_AFTER)) {
 		/* Frequency list after time */
-		const uint8_t *v = TLVP_VAL(&tp, GSM48_IE_FREQ_L_AFTER);
-		uint8_t len = TLVP_LEN(&tp, GSM48_IE_FREQ_L_AFTER);
-		gsm48_decode_freq_list(cell_arfcns, (uint8_t *) v, len, 0xff, 0x04);
-		ma_len = 0;
-		ma = NULL;
-		mask = 0x04;
+		alloc_v = TLVP_VAL(&tp, GSM48_IE_FREQ_L_AFTER);
+		alloc_len = TLVP_LEN(&tp, GSM48_IE_FREQ_L_AFTER);
+		alloc_source = ALLOC_FREQ_L;
 	} else {
 		/* Use the old one */
-		for (i=0; i<1024; i++) {
-			cell_arfcns[i].mask &= ~0x02;
-			if (cell_arfcns[i].mask & 0x01) {
-				cell_arfcns[i].mask |= 0x02;
-				mask = 0x02;
-			}
-		}
+		alloc_source = ALLOC_CELL;
 	}
 
 	/* Channel mode (HR/FR/EFR/AMR) */
@@ -121,8 +198,7 @@ void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_fr
 		ga->h0.band_arfcn = arfcn;
 	} else {
 		/* Hopping */
-		uint16_t arfcn;
-		int i, j, k;
+		const struct freq_alloc *fa;
 
 		ga->tsc = cd->h1.tsc;
 		ga->h1.maio = cd->h1.maio_low | (cd->h1.maio_high << 2);;
@@ -130,40 +206,13 @@ void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_fr
 		ga->h1.ma_len = 0;
 
 		/* decode mobile allocation */
-		if (ma) {
-			if (ma_len == 0) {
-				return;
-			}
-			for (i=1, j=0; i<=1024; i++) {
-				arfcn = i & 1023;
-				if (cell_arfcns[arfcn].mask & mask) {
-					k = ma_len - (j>>3) - 1;
-					if (ma[k] & (1 << (j&7))) {
-						ga->h1.ma[ga->h1.ma_len++] = arfcn;
-					}
-					j++;
-				}
-			}
-			if (ga->h1.ma_len == 0) {
-				/* cell information not found */
-				/* just compute ma_len */
-				for (i=0; i<(ma_len*8); i++){
-					int k = i/8;
-	
-					if (ma[k] & (1 << (i&7))) {
-						ga->h1.ma_len++;
-					}
-				}
-			}
-		} else {
-			for (i=1; i<=1024; i++) {
-				arfcn = i & 1023;
-				if (cell_arfcns[arfcn].mask & mask) {
-					if (ga->h1.ma_len < 128) {
-						ga->h1.ma[ga->h1.ma_len++] = arfcn;
-					}
-				}
-			}
+		if (alloc_source == ALLOC_MA && alloc_len == 0) {
+			return;
 		}
+
+		fa = get_freq_alloc(alloc_source, alloc_v, alloc_len, cell_arfcns);
+		memcpy(ga->h1.ma, fa->ma, sizeof(ga->h1.ma));
+		ga->h1.ma_len = fa->ma_len;
+		ga->h1.ma_known = fa->ma_known;
 	}
 }
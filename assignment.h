@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <osmocom/gsm/gsm48_ie.h>
 
+#include "arfcn_set.h"
+
 struct gsm_assignment {
 	int chan_nr;
 	int tsc;
@@ -17,6 +19,7 @@ struct gsm_assignment {
 			int hsn;
 			uint16_t ma[128];
 			int ma_len;
+			int ma_known;	/* ma[] holds the ARFCNs, not just ma_len */
 		} h1;
 	};
 	int chan_mode;
@@ -24,6 +27,6 @@ struct gsm_assignment {
 	uint16_t bcch_arfcn;
 };
 
-void parse_assignment(struct gsm48_hdr *hdr, unsigned len, struct gsm_sysinfo_freq *cell_arfcns, struct gsm_assignment *ga);
+void parse_assignment(struct gsm48_hdr *hdr, unsigned len, const struct arfcn_set *cell_arfcns, struct gsm_assignment *ga);
 
 #endif
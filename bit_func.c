@@ -4,7 +4,12 @@
 
 #include "bit_func.h"
 
-inline int not_zero(uint8_t *t, unsigned size)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BIT_FUNC_X86
+#endif
+
+static int not_zero_generic(uint8_t *t, unsigned size)
 {
 	unsigned i;
 
@@ -19,7 +24,7 @@ inline int not_zero(uint8_t *t, unsigned size)
 		return 1;
 }
 
-inline void compress_lsb(const uint8_t *in, uint8_t *out, unsigned size)
+static void compress_lsb_generic(const uint8_t *in, uint8_t *out, unsigned size)
 {
 
 	unsigned i, dbyte;
@@ -36,7 +41,7 @@ inline void compress_lsb(const uint8_t *in, uint8_t *out, unsigned size)
 	}
 }
 
-inline void compress_msb(const uint8_t *in, uint8_t *out, unsigned size)
+static void compress_msb_generic(const uint8_t *in, uint8_t *out, unsigned size)
 {
 	unsigned i, dbyte;
 	uint8_t dbit;
@@ -52,7 +57,7 @@ inline void compress_msb(const uint8_t *in, uint8_t *out, unsigned size)
 	}
 }
 
-inline void expand_lsb(const uint8_t *in, uint8_t *out, unsigned size)
+static void expand_lsb_generic(const uint8_t *in, uint8_t *out, unsigned size)
 {
 	unsigned i, dbyte;
 	uint8_t dbit;
@@ -64,7 +69,7 @@ inline void expand_lsb(const uint8_t *in, uint8_t *out, unsigned size)
 	}
 }
 
-inline void expand_msb(const uint8_t *in, uint8_t *out, unsigned size)
+static void expand_msb_generic(const uint8_t *in, uint8_t *out, unsigned size)
 {
 	unsigned i, dbyte;
 	uint8_t dbit;
@@ -76,7 +81,7 @@ inline void expand_msb(const uint8_t *in, uint8_t *out, unsigned size)
 	}
 }
 
-inline unsigned hex_bin2str(const uint8_t *vec, char *str, unsigned len)
+static unsigned hex_bin2str_generic(const uint8_t *vec, char *str, unsigned len)
 {
 	unsigned i;
 	char hexchar[] = {'0', '1', '2', '3', '4', '5', '6', '7',
@@ -90,6 +95,246 @@ inline unsigned hex_bin2str(const uint8_t *vec, char *str, unsigned len)
 	return i;
 }
 
+static unsigned hamming_distance_generic(uint8_t *v1, uint8_t *v2, unsigned len)
+{
+	unsigned i, diff = 0;
+
+	for (i=0; i<len; i++) {
+		diff += !!(v1[i]^v2[i]);
+	}
+
+	return diff;
+}
+
+#ifdef BIT_FUNC_X86
+/*
+ * Vector kernels, selected at startup depending on the CPU features.
+ * Tails that do not fill a whole vector are left to the scalar code.
+ */
+
+__attribute__((target("sse2")))
+static int not_zero_sse2(uint8_t *t, unsigned size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned i;
+
+	for (i = 0; i + 64 <= size; i += 64) {
+		__m128i acc = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *) &t[i]),
+				     _mm_loadu_si128((const __m128i *) &t[i+16])),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *) &t[i+32]),
+				     _mm_loadu_si128((const __m128i *) &t[i+48])));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xffff)
+			return 1;
+	}
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &t[i]);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+			return 1;
+	}
+
+	return not_zero_generic(&t[i], size - i);
+}
+
+__attribute__((target("sse2")))
+static void compress_lsb_sse2(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned i, mask;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &in[i]);
+		/* one bit per non-zero input byte, first byte in bit 0 */
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		out[i/8] = mask;
+		out[i/8 + 1] = mask >> 8;
+	}
+
+	compress_lsb_generic(&in[i], &out[i/8], size - i);
+}
+
+__attribute__((target("ssse3")))
+static void compress_msb_ssse3(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rev = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+					  15, 14, 13, 12, 11, 10, 9, 8);
+	unsigned i, mask;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &in[i]);
+		/* reverse each group of 8 so the first byte ends up in bit 7 */
+		v = _mm_shuffle_epi8(v, rev);
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		out[i/8] = mask;
+		out[i/8 + 1] = mask >> 8;
+	}
+
+	compress_msb_generic(&in[i], &out[i/8], size - i);
+}
+
+__attribute__((target("bmi2")))
+static void expand_lsb_bmi2(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	unsigned i;
+	uint64_t v;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		/* deposit bit n of the input byte into the low bit of byte n */
+		v = _pdep_u64(in[i/8], 0x0101010101010101ULL);
+		memcpy(&out[i], &v, sizeof(v));
+	}
+
+	expand_lsb_generic(&in[i/8], &out[i], size - i);
+}
+
+__attribute__((target("bmi2")))
+static void expand_msb_bmi2(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	unsigned i;
+	uint64_t v;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		v = __builtin_bswap64(_pdep_u64(in[i/8], 0x0101010101010101ULL));
+		memcpy(&out[i], &v, sizeof(v));
+	}
+
+	expand_msb_generic(&in[i/8], &out[i], size - i);
+}
+
+__attribute__((target("ssse3")))
+static unsigned hex_bin2str_ssse3(const uint8_t *vec, char *str, unsigned len)
+{
+	const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+					  '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	unsigned i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &vec[i]);
+		__m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		__m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, nibble));
+
+		_mm_storeu_si128((__m128i *) &str[2*i], _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) &str[2*i + 16], _mm_unpackhi_epi8(hi, lo));
+	}
+
+	return i + hex_bin2str_generic(&vec[i], &str[2*i], len - i);
+}
+
+__attribute__((target("sse2")))
+static unsigned hamming_distance_sse2(uint8_t *v1, uint8_t *v2, unsigned len)
+{
+	unsigned i, diff = 0;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &v1[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &v2[i]);
+		diff += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+	}
+
+	return diff + hamming_distance_generic(&v1[i], &v2[i], len - i);
+}
+#endif /* BIT_FUNC_X86 */
+
+static int (*not_zero_impl)(uint8_t *, unsigned) = not_zero_generic;
+static void (*compress_lsb_impl)(const uint8_t *, uint8_t *, unsigned) = compress_lsb_generic;
+static void (*compress_msb_impl)(const uint8_t *, uint8_t *, unsigned) = compress_msb_generic;
+static void (*expand_lsb_impl)(const uint8_t *, uint8_t *, unsigned) = expand_lsb_generic;
+static void (*expand_msb_impl)(const uint8_t *, uint8_t *, unsigned) = expand_msb_generic;
+static unsigned (*hex_bin2str_impl)(const uint8_t *, char *, unsigned) = hex_bin2str_generic;
+static unsigned (*hamming_distance_impl)(uint8_t *, uint8_t *, unsigned) = hamming_distance_generic;
+
+void bit_func_select(int use_simd)
+{
+	not_zero_impl = not_zero_generic;
+	compress_lsb_impl = compress_lsb_generic;
+	compress_msb_impl = compress_msb_generic;
+	expand_lsb_impl = expand_lsb_generic;
+	expand_msb_impl = expand_msb_generic;
+	hex_bin2str_impl = hex_bin2str_generic;
+	hamming_distance_impl = hamming_distance_generic;
+
+	if (!use_simd)
+		return;
+
+#ifdef BIT_FUNC_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")) {
+		not_zero_impl = not_zero_sse2;
+		compress_lsb_impl = compress_lsb_sse2;
+		hamming_distance_impl = hamming_distance_sse2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		compress_msb_impl = compress_msb_ssse3;
+		hex_bin2str_impl = hex_bin2str_ssse3;
+	}
+	if (__builtin_cpu_supports("bmi2")) {
+		expand_lsb_impl = expand_lsb_bmi2;
+		expand_msb_impl = expand_msb_bmi2;
+	}
+#endif
+}
+
+__attribute__((constructor))
+static void bit_func_init()
+{
+	bit_func_select(1);
+}
+
+int not_zero_vec(uint8_t *t, unsigned size)
+{
+	return not_zero_impl(t, size);
+}
+
+void compress_lsb(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	if (size < BIT_FUNC_VEC_MIN)
+		compress_lsb_generic(in, out, size);
+	else
+		compress_lsb_impl(in, out, size);
+}
+
+void compress_msb(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	if (size < BIT_FUNC_VEC_MIN)
+		compress_msb_generic(in, out, size);
+	else
+		compress_msb_impl(in, out, size);
+}
+
+void expand_lsb(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	if (size < BIT_FUNC_VEC_MIN)
+		expand_lsb_generic(in, out, size);
+	else
+		expand_lsb_impl(in, out, size);
+}
+
+void expand_msb(const uint8_t *in, uint8_t *out, unsigned size)
+{
+	if (size < BIT_FUNC_VEC_MIN)
+		expand_msb_generic(in, out, size);
+	else
+		expand_msb_impl(in, out, size);
+}
+
+unsigned hex_bin2str(const uint8_t *vec, char *str, unsigned len)
+{
+	if (len < BIT_FUNC_VEC_MIN)
+		return hex_bin2str_generic(vec, str, len);
+	return hex_bin2str_impl(vec, str, len);
+}
+
+unsigned hamming_distance(uint8_t *v1, uint8_t *v2, unsigned len)
+{
+	if (len < BIT_FUNC_VEC_MIN)
+		return hamming_distance_generic(v1, v2, len);
+	return hamming_distance_impl(v1, v2, len);
+}
+
 inline unsigned hex_str2bin(const char *str, uint8_t *vec, unsigned len)
 {
 	unsigned i = 0;
@@ -184,17 +429,6 @@ inline int is_printable(const char *str, unsigned len)
 	return 1;
 }
 
-inline unsigned hamming_distance(uint8_t *v1, uint8_t *v2, unsigned len)
-{
-	unsigned i, diff = 0;
-
-	for (i=0; i<len; i++) {
-		diff += !!(v1[i]^v2[i]);
-	}
-
-	return diff;
-}
-
 unsigned fread_unescape(FILE *f, uint8_t *msg, unsigned len)
 {
 	unsigned i;
@@ -218,61 +452,6 @@ unsigned fread_unescape(FILE *f, uint8_t *msg, unsigned len)
 	return i;
 }
 
-void strfloat_or_null(char *str, int len, int a, int b)
-{
-	if (!str) {
-		return;
-	}
-
-	if (b) {
-		snprintf(str, len, "%.3f", (float)a / (float)b);
-	} else {
-		strncpy(str, "NULL", len);
-	}
-}
-
-int basic_sanitize(char *str)
-{
-	if (!str)
-		return -1;
-
-	/* scan the whole string */
-	while (*str) {
-		/* match and replace with space */
-		switch (*str) {
-		case '\\':
-		case '\'':
-		case '`':
-		case '"':
-		case '%':
-			*str = ' ';
-		}
-		str++;
-	}
-
-	return 0;
-}
-
-char * strescape_or_null(char *str)
-{
-	char *escaped;
-	size_t len;
-
-	if (!str || !str[0]) {
-		return strdup("NULL");
-	}
-
-	basic_sanitize(str);
-
-	len = strlen(str);
-
-	escaped = malloc(len + 3);
-
-	snprintf(escaped, len + 3, "'%s'", str);
-
-	return escaped;
-}
-
 char * sgets(char *s, unsigned len, const char **input)
 {
 	const char *next = *input;
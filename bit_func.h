@@ -4,7 +4,26 @@
 #include <stdio.h>
 #include <stdint.h>
 
-int not_zero(uint8_t *t, unsigned size);
+/* Shorter inputs are left to the scalar loops */
+#define BIT_FUNC_VEC_MIN	16
+
+int not_zero_vec(uint8_t *t, unsigned size);
+
+/* Short buffers, such as keys, are checked inline */
+static inline int not_zero(uint8_t *t, unsigned size)
+{
+	unsigned i;
+
+	if (size >= BIT_FUNC_VEC_MIN)
+		return not_zero_vec(t, size);
+
+	for (i = 0; i < size; i++) {
+		if (t[i])
+			return 1;
+	}
+
+	return 0;
+}
 
 void compress_lsb(const uint8_t *in, uint8_t *out, unsigned size);
 void compress_msb(const uint8_t *in, uint8_t *out, unsigned size);
@@ -19,8 +38,8 @@ int bcd2str(uint8_t *bcd, char *s, unsigned len, unsigned off);
 int is_printable(const char *str, unsigned len);
 
 unsigned hamming_distance(uint8_t *v1, uint8_t *v2, unsigned len);
-void strfloat_or_null(char *str, int len, int a, int b);
-char * strescape_or_null(char *str);
+/* Choose vector (non-zero) or scalar kernels, done automatically at startup */
+void bit_func_select(int use_simd);
 unsigned fread_unescape(FILE *f, uint8_t *msg, unsigned len);
 char * sgets(char *str, unsigned len, const char **input);
 
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "callback.h"
+
+static struct metagsm_callbacks callbacks[CALLBACK_MAX];
+static unsigned n_callbacks = 0;	/* highest used slot + 1 */
+
+static int slot_used(const struct metagsm_callbacks *cb)
+{
+	return cb->on_message || cb->on_session_close || cb->on_cell_update;
+}
+
+/* Returns a handle for callback_unregister() or -1 if all slots are taken */
+int callback_register(const struct metagsm_callbacks *cb)
+{
+	unsigned i;
+
+	for (i = 0; i < CALLBACK_MAX && slot_used(&callbacks[i]); i++)
+		;
+	if (i == CALLBACK_MAX) {
+		fprintf(stderr, "Too many callbacks registered\n");
+		return -1;
+	}
+
+	callbacks[i] = *cb;
+	if (i >= n_callbacks)
+		n_callbacks = i + 1;
+
+	return i;
+}
+
+void callback_unregister(int handle)
+{
+	if (handle < 0 || handle >= CALLBACK_MAX)
+		return;
+
+	memset(&callbacks[handle], 0, sizeof(callbacks[handle]));
+	while (n_callbacks && !slot_used(&callbacks[n_callbacks - 1]))
+		n_callbacks--;
+}
+
+void callback_message(const struct radio_message *m)
+{
+	unsigned i;
+
+	for (i = 0; i < n_callbacks; i++) {
+		if (callbacks[i].on_message)
+			callbacks[i].on_message(m, callbacks[i].arg);
+	}
+}
+
+void callback_session_close(const struct session_info *s)
+{
+	unsigned i;
+
+	for (i = 0; i < n_callbacks; i++) {
+		if (callbacks[i].on_session_close)
+			callbacks[i].on_session_close(s, callbacks[i].arg);
+	}
+}
+
+void callback_cell_update(const struct session_info *s)
+{
+	unsigned i;
+
+	for (i = 0; i < n_callbacks; i++) {
+		if (callbacks[i].on_cell_update)
+			callbacks[i].on_cell_update(s, callbacks[i].arg);
+	}
+}
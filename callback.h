@@ -0,0 +1,35 @@
+#ifndef CALLBACK_H
+#define CALLBACK_H
+
+#include "session.h"
+
+/*
+ * Callbacks for applications embedding libmetagsm. The pointers refer to
+ * the parser's own structures and are only valid during the call; they
+ * must not be modified or kept. Callbacks run on the thread that feeds
+ * the parser, registration is not thread safe and belongs before the
+ * first input.
+ *
+ *	on_message		every decoded message, as it goes to the outputs
+ *	on_session_close	a session that was started and has been closed
+ *	on_cell_update		the serving ARFCN or neighbour list of the
+ *				CS/PS session pair changed
+ */
+
+#define CALLBACK_MAX	8
+
+struct metagsm_callbacks {
+	void (*on_message)(const struct radio_message *m, void *arg);
+	void (*on_session_close)(const struct session_info *s, void *arg);
+	void (*on_cell_update)(const struct session_info *s, void *arg);
+	void *arg;
+};
+
+int callback_register(const struct metagsm_callbacks *cb);
+void callback_unregister(int handle);
+
+void callback_message(const struct radio_message *m);
+void callback_session_close(const struct session_info *s);
+void callback_cell_update(const struct session_info *s);
+
+#endif
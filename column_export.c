@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "column_export.h"
+#include "burst_desc.h"
+
+/*
+ * Columnar export of the decoded messages. Rows are collected per column
+ * in memory and written as one row group every COLUMN_GROUP_ROWS
+ * messages, so the file can be scanned column by column (e.g. with
+ * numpy.frombuffer) without parsing packets. A directory of the row
+ * groups with their time ranges is appended when the file is closed.
+ */
+
+enum {
+	COL_TS,
+	COL_ID,
+	COL_RAT,
+	COL_DOMAIN,
+	COL_CHANNEL,
+	COL_CHAN_NR,
+	COL_UPLINK,
+	COL_ARFCN,
+	COL_FN,
+	COL_MSG_TYPE,
+	COL_L3,
+	COL_MAX
+};
+
+static const struct column_desc columns[COL_MAX] = {
+	[COL_TS]	= { "ts_ns",	COLUMN_I64, 8 },
+	[COL_ID]	= { "id",	COLUMN_U32, 4 },
+	[COL_RAT]	= { "rat",	COLUMN_U8, 1 },
+	[COL_DOMAIN]	= { "domain",	COLUMN_U8, 1 },
+	[COL_CHANNEL]	= { "channel",	COLUMN_U8, 1 },
+	[COL_CHAN_NR]	= { "chan_nr",	COLUMN_U8, 1 },
+	[COL_UPLINK]	= { "uplink",	COLUMN_U8, 1 },
+	[COL_ARFCN]	= { "arfcn",	COLUMN_U16, 2 },
+	[COL_FN]	= { "fn",	COLUMN_U32, 4 },
+	[COL_MSG_TYPE]	= { "msg_type",	COLUMN_U16, 2 },
+	[COL_L3]	= { "l3",	COLUMN_BYTES, 0 },
+};
+
+static FILE *col_file = NULL;
+static unsigned n_columns;
+static uint8_t *col_data[COL_MAX];
+static unsigned rows;
+static int64_t ts_min, ts_max;
+
+/* l3 column: offsets into the payload buffer */
+static uint32_t *l3_offset;
+static uint8_t *l3_data;
+static size_t l3_len, l3_alloc;
+
+static struct column_group_entry *groups;
+static unsigned n_groups, groups_alloc;
+
+/* GSM 04.08 protocol discriminator << 8 | message type, 0xffff if unknown */
+uint16_t column_msg_type(const struct radio_message *m)
+{
+	const uint8_t *l3;
+	unsigned off;
+	uint8_t pd, type;
+
+	switch (m->rat) {
+	case RAT_GSM:
+		switch (m->flags & 0x0f) {
+		case MSG_BCCH:
+			/* L2 pseudo length */
+			off = 1;
+			break;
+		case MSG_SACCH:
+			/* L1 header, then LAPDm */
+			off = 5;
+			break;
+		default:
+			off = 3;
+			break;
+		}
+		if (m->msg_len < off + 2)
+			return 0xffff;
+		if (off > 1) {
+			/* only I and UI frames carry L3 */
+			uint8_t ctrl = m->msg[off - 2];
+
+			if ((ctrl & 0x01) && (ctrl & 0xef) != 0x03)
+				return 0xffff;
+			if ((m->msg[off - 1] >> 2) < 2)
+				return 0xffff;
+		}
+		l3 = &m->msg[off];
+		pd = l3[0] & 0x0f;
+		type = l3[1];
+		/* MM, CC and SS carry a send sequence number in the top bits */
+		if (pd == 0x03 || pd == 0x05 || pd == 0x0b)
+			type &= 0x3f;
+		return pd << 8 | type;
+	case RAT_LTE:
+		/* plain NAS only, protected messages are not looked into */
+		if (!(m->flags & MSG_SDCCH) || m->msg_len < 3)
+			return 0xffff;
+		l3 = m->bb.data;
+		if (l3[0] >> 4)
+			return 0xffff;
+		pd = l3[0] & 0x0f;
+		type = (pd == 0x02) ? l3[2] : l3[1];
+		return pd << 8 | type;
+	default:
+		return 0xffff;
+	}
+}
+
+static void write_chunk(const void *data, uint64_t len)
+{
+	static const uint8_t zero[8];
+
+	fwrite(&len, sizeof(len), 1, col_file);
+	if (len)
+		fwrite(data, len, 1, col_file);
+	if (len % 8)
+		fwrite(zero, 8 - len % 8, 1, col_file);
+}
+
+static void flush_group()
+{
+	struct column_group_hdr gh;
+	unsigned i;
+	long offset;
+
+	if (!rows)
+		return;
+
+	offset = ftell(col_file);
+
+	gh.magic = COLUMN_GROUP_MAGIC;
+	gh.rows = rows;
+	gh.ts_min = ts_min;
+	gh.ts_max = ts_max;
+	fwrite(&gh, sizeof(gh), 1, col_file);
+
+	for (i = 0; i < COL_L3; i++)
+		write_chunk(col_data[i], (uint64_t) rows * columns[i].width);
+	if (n_columns > COL_L3) {
+		write_chunk(l3_offset, (rows + 1) * sizeof(uint32_t));
+		write_chunk(l3_data, l3_len);
+	}
+
+	if (n_groups == groups_alloc) {
+		groups_alloc = groups_alloc ? 2 * groups_alloc : 64;
+		groups = realloc(groups, groups_alloc * sizeof(*groups));
+		assert(groups != NULL);
+	}
+	groups[n_groups].offset = offset;
+	groups[n_groups].rows = rows;
+	groups[n_groups].pad = 0;
+	groups[n_groups].ts_min = ts_min;
+	groups[n_groups].ts_max = ts_max;
+	n_groups++;
+
+	rows = 0;
+	l3_len = 0;
+}
+
+int column_export_open(const char *path, int with_l3)
+{
+	struct column_file_hdr hdr;
+	unsigned i;
+
+	col_file = fopen(path, "w");
+	if (!col_file) {
+		fprintf(stderr, "Cannot open column file %s, %s\n", path, strerror(errno));
+		return -1;
+	}
+	setvbuf(col_file, NULL, _IOFBF, 1 << 20);
+
+	n_columns = with_l3 ? COL_MAX : COL_L3;
+
+	hdr.magic = COLUMN_MAGIC;
+	hdr.version = COLUMN_VERSION;
+	hdr.columns = n_columns;
+	fwrite(&hdr, sizeof(hdr), 1, col_file);
+	fwrite(columns, sizeof(columns[0]), n_columns, col_file);
+
+	for (i = 0; i < COL_L3; i++) {
+		col_data[i] = malloc(COLUMN_GROUP_ROWS * columns[i].width);
+		assert(col_data[i] != NULL);
+	}
+	if (with_l3) {
+		l3_offset = malloc((COLUMN_GROUP_ROWS + 1) * sizeof(uint32_t));
+		assert(l3_offset != NULL);
+		l3_offset[0] = 0;
+	}
+
+	rows = 0;
+	n_groups = 0;
+
+	return 0;
+}
+
+#define COL_SET(col, type, v)	(((type *) col_data[col])[rows] = (v))
+
+void column_export_msg(const struct radio_message *m)
+{
+	int64_t ts;
+	const uint8_t *l3;
+
+	if (!col_file)
+		return;
+
+	ts = (int64_t) m->timestamp.tv_sec * 1000000000 + m->ts_nsec;
+	if (!rows || ts < ts_min)
+		ts_min = ts;
+	if (!rows || ts > ts_max)
+		ts_max = ts;
+
+	COL_SET(COL_TS, int64_t, ts);
+	COL_SET(COL_ID, uint32_t, m->id);
+	COL_SET(COL_RAT, uint8_t, m->rat);
+	COL_SET(COL_DOMAIN, uint8_t, m->domain);
+	COL_SET(COL_CHANNEL, uint8_t, m->flags & 0x0f);
+	COL_SET(COL_CHAN_NR, uint8_t, m->chan_nr);
+	COL_SET(COL_UPLINK, uint8_t, !!(m->bb.arfcn[0] & ARFCN_UPLINK));
+	COL_SET(COL_ARFCN, uint16_t, m->bb.arfcn[0] & ~ARFCN_UPLINK);
+	COL_SET(COL_FN, uint32_t, m->bb.fn[0]);
+	COL_SET(COL_MSG_TYPE, uint16_t, column_msg_type(m));
+
+	if (n_columns > COL_L3) {
+		/* GSM keeps the L2 frame in msg, the other RATs in bb.data */
+		l3 = (m->rat == RAT_GSM) ? m->msg : m->bb.data;
+		if (l3_len + m->msg_len > l3_alloc) {
+			l3_alloc = l3_alloc ? 2 * l3_alloc : (1 << 20);
+			l3_data = realloc(l3_data, l3_alloc);
+			assert(l3_data != NULL);
+		}
+		memcpy(&l3_data[l3_len], l3, m->msg_len);
+		l3_len += m->msg_len;
+		l3_offset[rows + 1] = l3_len;
+	}
+
+	rows++;
+	if (rows == COLUMN_GROUP_ROWS)
+		flush_group();
+}
+
+void column_export_close()
+{
+	struct column_file_trailer tr;
+	unsigned i;
+
+	if (!col_file)
+		return;
+
+	flush_group();
+
+	tr.directory = ftell(col_file);
+	tr.groups = n_groups;
+	tr.magic = COLUMN_MAGIC;
+	fwrite(groups, sizeof(groups[0]), n_groups, col_file);
+	fwrite(&tr, sizeof(tr), 1, col_file);
+
+	if (fclose(col_file) != 0)
+		fprintf(stderr, "Cannot close column file, %s\n", strerror(errno));
+	col_file = NULL;
+
+	for (i = 0; i < COL_L3; i++) {
+		free(col_data[i]);
+		col_data[i] = NULL;
+	}
+	free(l3_offset);
+	l3_offset = NULL;
+	free(l3_data);
+	l3_data = NULL;
+	l3_alloc = 0;
+	free(groups);
+	groups = NULL;
+	groups_alloc = 0;
+}
@@ -0,0 +1,77 @@
+#ifndef COLUMN_EXPORT_H
+#define COLUMN_EXPORT_H
+
+#include <stdint.h>
+
+#include "process.h"
+
+/*
+ * Column file layout, all little endian:
+ *
+ *   struct column_file_hdr
+ *   struct column_desc            one per column
+ *   row groups:
+ *     struct column_group_hdr
+ *     per column: uint64_t chunk length, chunk data padded to 8 bytes
+ *   struct column_group_entry     one per row group
+ *   struct column_file_trailer
+ *
+ * Fixed width columns hold rows values back to back in one chunk. The
+ * optional l3 column takes two chunks: rows + 1 uint32_t offsets, then
+ * the payload bytes they point into.
+ */
+
+#define COLUMN_MAGIC		0x4c4f4344	/* "DCOL" */
+#define COLUMN_VERSION		1
+#define COLUMN_GROUP_MAGIC	0x50524744	/* "DGRP" */
+#define COLUMN_GROUP_ROWS	65536
+
+enum column_type {
+	COLUMN_U8 = 1,
+	COLUMN_U16,
+	COLUMN_U32,
+	COLUMN_I64,
+	COLUMN_BYTES,		/* variable length */
+};
+
+struct column_file_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t columns;
+} __attribute__((packed));
+
+struct column_desc {
+	char name[12];
+	uint8_t type;		/* enum column_type */
+	uint8_t width;		/* bytes per row, 0 for COLUMN_BYTES */
+	uint16_t pad;
+} __attribute__((packed));
+
+struct column_group_hdr {
+	uint32_t magic;
+	uint32_t rows;
+	int64_t ts_min;		/* nanoseconds since the UNIX epoch */
+	int64_t ts_max;
+} __attribute__((packed));
+
+/* Row group directory entry, lets readers skip to a time range */
+struct column_group_entry {
+	uint64_t offset;	/* file offset of the column_group_hdr */
+	uint32_t rows;
+	uint32_t pad;
+	int64_t ts_min;
+	int64_t ts_max;
+} __attribute__((packed));
+
+struct column_file_trailer {
+	uint64_t directory;	/* file offset of the first column_group_entry */
+	uint32_t groups;
+	uint32_t magic;
+} __attribute__((packed));
+
+int column_export_open(const char *path, int with_l3);
+void column_export_msg(const struct radio_message *m);
+void column_export_close();
+uint16_t column_msg_type(const struct radio_message *m);
+
+#endif
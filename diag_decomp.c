@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "diag_decomp.h"
+
+/*
+ * Compressed capture input. A worker thread decompresses into one of two
+ * blocks while the parser consumes the other, so decompression and
+ * decoding run on separate cores.
+ */
+
+struct decomp_block {
+	uint8_t data[DIAG_DECOMP_BLOCK];
+	size_t len;
+	int full;
+};
+
+struct diag_decomp {
+	int fd;
+	enum diag_compression comp;
+	pthread_t thread;
+	int started;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct decomp_block block[2];
+	int rd;		/* block the parser reads next */
+	int wr;		/* block the worker fills next */
+	int done;
+	int error;
+	int stop;
+#ifdef HAVE_ZLIB
+	gzFile gz;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zds;
+	ZSTD_inBuffer in;
+	size_t zs_left;		/* non-zero within a frame */
+	uint8_t in_buf[1 << 17];
+#endif
+};
+
+enum diag_compression diag_compression_detect(const uint8_t *buf, size_t len)
+{
+	if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b)
+		return DIAG_COMP_GZIP;
+	if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f && buf[3] == 0xfd)
+		return DIAG_COMP_ZSTD;
+
+	return DIAG_COMP_NONE;
+}
+
+const char *diag_compression_name(enum diag_compression comp)
+{
+	switch (comp) {
+	case DIAG_COMP_GZIP:
+		return "gzip";
+	case DIAG_COMP_ZSTD:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+int diag_decomp_supported(enum diag_compression comp)
+{
+	switch (comp) {
+#ifdef HAVE_ZLIB
+	case DIAG_COMP_GZIP:
+		return 1;
+#endif
+#ifdef HAVE_ZSTD
+	case DIAG_COMP_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Fill a block, returns its length, 0 at the end and -1 on errors. A
+ * short block may still carry an error, flagged in dd->error.
+ */
+static ssize_t decomp_fill(struct diag_decomp *dd, uint8_t *out, size_t out_len)
+{
+	switch (dd->comp) {
+#ifdef HAVE_ZLIB
+	case DIAG_COMP_GZIP: {
+		size_t len = 0;
+		int rc, errnum;
+
+		while (len < out_len) {
+			rc = gzread(dd->gz, &out[len], out_len - len);
+			if (rc < 0) {
+				fprintf(stderr, "gzip: %s\n", gzerror(dd->gz, &errnum));
+				return -1;
+			}
+			if (rc == 0)
+				break;
+			len += rc;
+		}
+		return len;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case DIAG_COMP_ZSTD: {
+		ZSTD_outBuffer ob = { out, out_len, 0 };
+		ssize_t rc;
+		size_t ret;
+
+		while (ob.pos < ob.size) {
+			if (dd->in.pos == dd->in.size) {
+				rc = read(dd->fd, dd->in_buf, sizeof(dd->in_buf));
+				if (rc < 0 && errno == EINTR)
+					continue;
+				if (rc < 0)
+					return -1;
+				if (rc == 0 && dd->zs_left) {
+					/* truncated: the block is still passed on, then the error */
+					fprintf(stderr, "zstd: unexpected end of file\n");
+					dd->error = 1;
+				}
+				if (rc == 0)
+					break;
+				dd->in.src = dd->in_buf;
+				dd->in.size = rc;
+				dd->in.pos = 0;
+			}
+			ret = ZSTD_decompressStream(dd->zds, &ob, &dd->in);
+			if (ZSTD_isError(ret)) {
+				fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+				return -1;
+			}
+			dd->zs_left = ret;
+		}
+		return ob.pos;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+static void *decomp_thread(void *arg)
+{
+	struct diag_decomp *dd = (struct diag_decomp *) arg;
+	struct decomp_block *b;
+	ssize_t len;
+
+	for (;;) {
+		pthread_mutex_lock(&dd->lock);
+		while (dd->block[dd->wr].full && !dd->stop)
+			pthread_cond_wait(&dd->cond, &dd->lock);
+		if (dd->stop) {
+			pthread_mutex_unlock(&dd->lock);
+			break;
+		}
+		b = &dd->block[dd->wr];
+		pthread_mutex_unlock(&dd->lock);
+
+		/* the parser does not touch a block until it is marked full */
+		len = decomp_fill(dd, b->data, sizeof(b->data));
+
+		pthread_mutex_lock(&dd->lock);
+		if (len > 0) {
+			b->len = len;
+			b->full = 1;
+			dd->wr ^= 1;
+		}
+		if (len < (ssize_t) sizeof(b->data)) {
+			dd->error |= len < 0;
+			dd->done = 1;
+		}
+		pthread_cond_broadcast(&dd->cond);
+		pthread_mutex_unlock(&dd->lock);
+
+		if (dd->done)
+			break;
+	}
+
+	return NULL;
+}
+
+struct diag_decomp *diag_decomp_start(int fd, enum diag_compression comp)
+{
+	struct diag_decomp *dd;
+
+	if (!diag_decomp_supported(comp))
+		return NULL;
+
+	dd = (struct diag_decomp *) calloc(1, sizeof(struct diag_decomp));
+	if (!dd)
+		return NULL;
+
+	dd->fd = fd;
+	dd->comp = comp;
+
+	switch (comp) {
+#ifdef HAVE_ZLIB
+	case DIAG_COMP_GZIP:
+		dd->gz = gzdopen(dup(fd), "rb");
+		if (!dd->gz)
+			goto error;
+		gzbuffer(dd->gz, 1 << 17);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case DIAG_COMP_ZSTD:
+		dd->zds = ZSTD_createDStream();
+		if (!dd->zds)
+			goto error;
+		ZSTD_initDStream(dd->zds);
+		break;
+#endif
+	default:
+		goto error;
+	}
+
+	pthread_mutex_init(&dd->lock, NULL);
+	pthread_cond_init(&dd->cond, NULL);
+
+	if (pthread_create(&dd->thread, NULL, decomp_thread, dd)) {
+		fprintf(stderr, "Cannot start decompressor thread\n");
+		diag_decomp_stop(dd);
+		return NULL;
+	}
+	dd->started = 1;
+
+	return dd;
+
+error:
+	free(dd);
+	return NULL;
+}
+
+/*
+ * Wait for the next decompressed block. Returns its length, 0 at the end
+ * of the stream and -1 on errors. The block stays valid until
+ * diag_decomp_release().
+ */
+ssize_t diag_decomp_read(struct diag_decomp *dd, const uint8_t **data)
+{
+	struct decomp_block *b = &dd->block[dd->rd];
+	ssize_t len;
+
+	pthread_mutex_lock(&dd->lock);
+	while (!b->full && !dd->done)
+		pthread_cond_wait(&dd->cond, &dd->lock);
+
+	if (b->full) {
+		*data = b->data;
+		len = b->len;
+	} else {
+		len = dd->error ? -1 : 0;
+	}
+	pthread_mutex_unlock(&dd->lock);
+
+	return len;
+}
+
+void diag_decomp_release(struct diag_decomp *dd)
+{
+	pthread_mutex_lock(&dd->lock);
+	dd->block[dd->rd].full = 0;
+	dd->rd ^= 1;
+	pthread_cond_broadcast(&dd->cond);
+	pthread_mutex_unlock(&dd->lock);
+}
+
+void diag_decomp_stop(struct diag_decomp *dd)
+{
+	if (!dd)
+		return;
+
+	if (dd->started) {
+		pthread_mutex_lock(&dd->lock);
+		dd->stop = 1;
+		pthread_cond_broadcast(&dd->cond);
+		pthread_mutex_unlock(&dd->lock);
+		pthread_join(dd->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&dd->lock);
+	pthread_cond_destroy(&dd->cond);
+
+#ifdef HAVE_ZLIB
+	if (dd->gz)
+		gzclose(dd->gz);
+#endif
+#ifdef HAVE_ZSTD
+	if (dd->zds)
+		ZSTD_freeDStream(dd->zds);
+#endif
+
+	free(dd);
+}
@@ -0,0 +1,27 @@
+#ifndef DIAG_DECOMP_H
+#define DIAG_DECOMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define DIAG_DECOMP_BLOCK	(1 << 20)
+
+enum diag_compression {
+	DIAG_COMP_NONE = 0,
+	DIAG_COMP_GZIP,
+	DIAG_COMP_ZSTD,
+};
+
+struct diag_decomp;
+
+enum diag_compression diag_compression_detect(const uint8_t *buf, size_t len);
+const char *diag_compression_name(enum diag_compression comp);
+int diag_decomp_supported(enum diag_compression comp);
+
+struct diag_decomp *diag_decomp_start(int fd, enum diag_compression comp);
+ssize_t diag_decomp_read(struct diag_decomp *dd, const uint8_t **data);
+void diag_decomp_release(struct diag_decomp *dd);
+void diag_decomp_stop(struct diag_decomp *dd);
+
+#endif
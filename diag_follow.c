@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <err.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+
+#include "diag_follow.h"
+#include "diag_input.h"
+#include "session.h"
+#include "latency.h"
+
+/*
+ * Tail a growing capture. The file is read up to EOF, then we sleep on
+ * inotify until it grows, is moved away or a newer file of the sequence
+ * shows up in its directory. Deframer state and parser sessions carry
+ * over EOFs and rotations (a frame cut by a size based rotation continues
+ * in the next file), each byte is read exactly once.
+ */
+
+#define FOLLOW_BUF	65536
+
+struct follow_state {
+	int fd;
+	char path[FILENAME_MAX];
+	uint8_t buf[FOLLOW_BUF];
+	struct diag_stream st;
+};
+
+static void split_path(const char *path, char *dir, size_t dir_len, const char **base)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (!slash) {
+		snprintf(dir, dir_len, ".");
+		*base = path;
+	} else if (slash == path) {
+		snprintf(dir, dir_len, "/");
+		*base = slash + 1;
+	} else {
+		snprintf(dir, dir_len, "%.*s", (int) (slash - path), path);
+		*base = slash + 1;
+	}
+}
+
+/* The next capture is the first name after ours with the same suffix */
+static int next_in_sequence(const char *cur, char *next, size_t next_len)
+{
+	char dir[FILENAME_MAX];
+	const char *base, *suffix;
+	const char *best = NULL;
+	char best_name[FILENAME_MAX];
+	struct dirent *de;
+	DIR *dp;
+	size_t slen, nlen;
+	int n;
+
+	split_path(cur, dir, sizeof(dir), &base);
+	suffix = strrchr(base, '.');
+	if (!suffix)
+		suffix = "";
+	slen = strlen(suffix);
+
+	dp = opendir(dir);
+	if (!dp)
+		return 0;
+
+	while ((de = readdir(dp)) != NULL) {
+		nlen = strlen(de->d_name);
+		if (nlen < slen || strcmp(&de->d_name[nlen - slen], suffix))
+			continue;
+		if (strcmp(de->d_name, base) <= 0)
+			continue;
+		if (best && strcmp(de->d_name, best_name) >= 0)
+			continue;
+		/* a truncated name would open some other file */
+		if ((size_t) (base - cur) + nlen >= next_len)
+			continue;
+		snprintf(best_name, sizeof(best_name), "%s", de->d_name);
+		best = best_name;
+	}
+	closedir(dp);
+
+	if (!best)
+		return 0;
+
+	n = snprintf(next, next_len, "%.*s%s", (int) (base - cur), cur, best);
+	return n >= 0 && (size_t) n < next_len;
+}
+
+static void follow_open(struct follow_state *fs, const char *path)
+{
+	snprintf(fs->path, sizeof(fs->path), "%s", path);
+
+	fs->fd = open(fs->path, O_RDONLY);
+	if (fs->fd < 0)
+		err(1, "Cannot open input file: %s", fs->path);
+
+	diag_stream_next_file(&fs->st);
+	diag_set_filename(fs->path);
+
+	if (msg_verbose) {
+		fprintf(stderr, "Following %s\n", fs->path);
+	}
+}
+
+/* Read everything available, returns 0 at EOF */
+static int follow_read(struct follow_state *fs, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	ssize_t rc;
+
+	rc = read(fs->fd, fs->buf, sizeof(fs->buf));
+	if (rc < 0) {
+		if (errno == EINTR)
+			return 0;
+		err(1, "Cannot read input file: %s", fs->path);
+	}
+
+	/* the format is only detected at EOF if what we have tells it */
+	diag_stream_feed(&fs->st, fs->buf, rc, rc ? DIAG_STREAM_MORE : DIAG_STREAM_PAUSE, filter, cb);
+
+	return rc > 0;
+}
+
+void diag_follow(const char *path, const struct diag_filter *filter, diag_frame_cb cb, volatile sig_atomic_t *stop)
+{
+	static struct follow_state fs;
+	char dir[FILENAME_MAX];
+	char next[FILENAME_MAX];
+	char ev_buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *base;
+	struct stat st;
+	struct pollfd pfd;
+	int ifd, wd_file, wd_dir;
+	int gone, changed;
+	ssize_t rc;
+	char *p;
+
+	ifd = inotify_init1(IN_CLOEXEC);
+	if (ifd < 0)
+		err(1, "Cannot initialize inotify");
+
+	diag_stream_init(&fs.st);
+	follow_open(&fs, path);
+
+	while (!*stop) {
+		split_path(fs.path, dir, sizeof(dir), &base);
+		wd_file = inotify_add_watch(ifd, fs.path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+		wd_dir = inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO);
+		if (wd_file < 0 || wd_dir < 0)
+			err(1, "Cannot watch %s", fs.path);
+
+		gone = 0;
+		changed = 1;
+
+		while (!*stop) {
+			/* drain before waiting, the watch is already armed */
+			while (follow_read(&fs, filter, cb))
+				;
+
+			if (*stop)
+				break;
+
+			/* rotated: continue with the next file once this one is done */
+			if (changed) {
+				if (gone && stat(fs.path, &st) == 0) {
+					/* moved away and recreated under the same name */
+					snprintf(next, sizeof(next), "%s", fs.path);
+					break;
+				}
+				if (next_in_sequence(fs.path, next, sizeof(next)))
+					break;
+				changed = 0;
+			}
+
+			pfd.fd = ifd;
+			pfd.events = POLLIN;
+			rc = poll(&pfd, 1, latency_enabled ? LATENCY_POLL_MS : -1);
+			latency_poll();
+			if (rc <= 0) {
+				if (rc < 0 && errno != EINTR)
+					err(1, "Cannot wait for inotify events");
+				continue;
+			}
+
+			rc = read(ifd, ev_buf, sizeof(ev_buf));
+			if (rc < 0) {
+				if (errno == EINTR)
+					continue;
+				err(1, "Cannot read inotify events");
+			}
+
+			for (p = ev_buf; p < ev_buf + rc; p += sizeof(*ev) + ev->len) {
+				ev = (const struct inotify_event *) p;
+				if (ev->wd == wd_file && (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)))
+					gone = 1;
+				if (ev->wd == wd_dir)
+					changed = 1;
+			}
+			if (gone)
+				changed = 1;
+		}
+
+		inotify_rm_watch(ifd, wd_file);
+		inotify_rm_watch(ifd, wd_dir);
+		close(fs.fd);
+
+		/* this file is complete, whatever is held back has to be detected now */
+		diag_stream_feed(&fs.st, NULL, 0, DIAG_STREAM_END, filter, cb);
+
+		if (*stop)
+			break;
+
+		follow_open(&fs, next);
+	}
+
+	close(ifd);
+}
@@ -0,0 +1,11 @@
+#ifndef DIAG_FOLLOW_H
+#define DIAG_FOLLOW_H
+
+#include <signal.h>
+
+#include "diag_format.h"
+#include "diag_index.h"
+
+void diag_follow(const char *path, const struct diag_filter *filter, diag_frame_cb cb, volatile sig_atomic_t *stop);
+
+#endif
@@ -0,0 +1,407 @@
+#include <string.h>
+
+#include "diag_format.h"
+#include "latency.h"
+#include "metrics.h"
+#include "trace.h"
+#include "diag_index.h"
+
+/*
+ * A DLF record is a DIAG log packet without the command header:
+ *
+ *   le16 length (whole record), le16 log code, le64 timestamp, payload
+ *
+ * QMDL2 files start with a le32 header length and the header itself,
+ * the rest of the file is plain HDLC framed DIAG data.
+ */
+
+#define DLF_HDR_LEN	12
+#define DLF_REC_MAX	4092	/* keep in line with the HDLC reader buffer */
+#define DLF_PROBE_RECS	8
+#define QMDL2_HDR_MIN	8
+#define QMDL2_HDR_MAX	4096
+
+static inline unsigned get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int probe_dlf(const uint8_t *buf, size_t len)
+{
+	size_t off = 0;
+	unsigned rec_len;
+	int recs = 0;
+
+	while (recs < DLF_PROBE_RECS && off + DLF_HDR_LEN <= len) {
+		rec_len = get_le16(&buf[off]);
+		if (rec_len < DLF_HDR_LEN || rec_len > DLF_REC_MAX)
+			return 0;
+		off += rec_len;
+		recs++;
+	}
+
+	/* The records have to chain up, either to the end or long enough */
+	return recs > 0 && (recs == DLF_PROBE_RECS || off == len);
+}
+
+static int probe_qmdl2(const uint8_t *buf, size_t len, size_t *hdr_len)
+{
+	uint32_t n;
+	size_t end;
+
+	if (len < 4)
+		return 0;
+
+	n = get_le32(buf);
+	if (n < QMDL2_HDR_MIN || n > QMDL2_HDR_MAX || n >= len)
+		return 0;
+
+	/* A raw HDLC file has its first frame end before that */
+	if (memchr(buf, 0x7e, n))
+		return 0;
+
+	end = len - n < QMDL2_HDR_MAX ? len - n : QMDL2_HDR_MAX;
+	if (!memchr(&buf[n], 0x7e, end))
+		return 0;
+
+	*hdr_len = n;
+	return 1;
+}
+
+enum diag_format diag_format_detect(const uint8_t *buf, size_t len, size_t *data_offset)
+{
+	size_t hdr_len;
+
+	*data_offset = 0;
+
+	if (probe_dlf(buf, len))
+		return DIAG_FORMAT_DLF;
+
+	if (probe_qmdl2(buf, len, &hdr_len)) {
+		*data_offset = hdr_len;
+		return DIAG_FORMAT_QMDL2;
+	}
+
+	return DIAG_FORMAT_HDLC;
+}
+
+/*
+ * Whether the start of a capture that may still grow tells its format:
+ * not if it ends within the first HDLC frame or within a DLF record.
+ */
+static int format_settled(const uint8_t *buf, size_t len)
+{
+	size_t off = 0;
+	unsigned rec_len;
+
+	if (len >= DIAG_STREAM_DETECT)
+		return 1;
+
+	while (off + DLF_HDR_LEN <= len) {
+		rec_len = get_le16(&buf[off]);
+		if (rec_len < DLF_HDR_LEN || rec_len > DLF_REC_MAX)
+			break;
+		off += rec_len;
+	}
+
+	/* DLF records so far, ending within the last one */
+	if (off + DLF_HDR_LEN > len)
+		return off == len && off > 0;
+
+	return memchr(buf, 0x7e, len) != NULL;
+}
+
+const char *diag_format_name(enum diag_format fmt)
+{
+	switch (fmt) {
+	case DIAG_FORMAT_QMDL2:
+		return "QMDL2";
+	case DIAG_FORMAT_DLF:
+		return "DLF";
+	default:
+		return "HDLC";
+	}
+}
+
+/*
+ * Feed complete DLF records to <cb>, returns the number of bytes
+ * consumed. The record is rebuilt into the layout of an unescaped HDLC
+ * frame (log command header, record, CRC, padding) since the handlers
+ * rely on it and modify the message in place. Records not selected by the
+ * optional filter are skipped.
+ */
+size_t diag_dlf_feed(const uint8_t *buf, size_t len, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	uint8_t msg[4 + DLF_REC_MAX + 2 + 1];
+	size_t off = 0;
+	unsigned rec_len;
+
+	while (off + DLF_HDR_LEN <= len) {
+		rec_len = get_le16(&buf[off]);
+		if (rec_len < DLF_HDR_LEN) {
+			/* corrupted, nothing sensible follows */
+			return len;
+		}
+		if (off + rec_len > len)
+			break;
+
+		if (rec_len <= DLF_REC_MAX) {
+			msg[0] = 0x10;
+			msg[1] = 0x00;
+			msg[2] = rec_len & 0xff;
+			msg[3] = rec_len >> 8;
+			memcpy(&msg[4], &buf[off], rec_len);
+			msg[4 + rec_len] = 0;
+			msg[4 + rec_len + 1] = 0;
+			msg[4 + rec_len + 2] = 0x2b;
+
+			if (!filter || diag_filter_frame(filter, msg, 4 + rec_len + 2))
+				cb(msg, 4 + rec_len + 2);
+		}
+
+		off += rec_len;
+	}
+
+	return off;
+}
+
+void hdlc_deframer_init(struct hdlc_deframer *d, uint64_t offset)
+{
+	d->len = 0;
+	d->escape = 0;
+	d->done = 0;
+	d->offset = offset;
+	d->frame_start = offset;
+}
+
+/*
+ * Consume input until a frame is complete, returns the number of bytes
+ * used. When *complete is set the unescaped frame is in d->msg/d->len
+ * (without the 0x7e terminator) and d->frame_start is its offset; the
+ * next call starts a new frame. Frames filling the whole buffer are
+ * returned unterminated, like fread_unescape() does. A partial frame
+ * left at the end of the input stays in d->msg.
+ */
+size_t hdlc_deframe(struct hdlc_deframer *d, const uint8_t *buf, size_t len, int *complete)
+{
+	size_t i = 0, run;
+	uint8_t b;
+
+	*complete = 0;
+
+	if (d->done) {
+		d->len = 0;
+		d->done = 0;
+	}
+	if (d->len == 0 && !d->escape)
+		d->frame_start = d->offset;
+
+	while (i < len) {
+		if (d->len == sizeof(d->msg)) {
+			*complete = 1;
+			break;
+		}
+
+		if (d->escape) {
+			d->msg[d->len++] = (buf[i++] & 0x0f) | 0x70;
+			d->escape = 0;
+			continue;
+		}
+
+		/* copy the run up to the next special byte in one go */
+		for (run = 0; i + run < len && run < sizeof(d->msg) - d->len; run++) {
+			b = buf[i + run];
+			if (b == 0x7e || b == 0x7d)
+				break;
+		}
+		memcpy(&d->msg[d->len], &buf[i], run);
+		d->len += run;
+		i += run;
+
+		if (i == len || d->len == sizeof(d->msg))
+			continue;
+
+		if (buf[i++] == 0x7e) {
+			*complete = 1;
+			break;
+		}
+		d->escape = 1;
+	}
+
+	d->done = *complete;
+	d->offset += i;
+	return i;
+}
+
+void diag_stream_init(struct diag_stream *st)
+{
+	hdlc_deframer_init(&st->d, 0);
+	diag_stream_next_file(st);
+}
+
+/*
+ * Start over with format detection, e.g. after a file rotation. The
+ * deframer is kept: a frame may continue in the next raw HDLC file.
+ */
+void diag_stream_next_file(struct diag_stream *st)
+{
+	st->detected = 0;
+	st->fmt = DIAG_FORMAT_HDLC;
+	st->skip = 0;
+	st->have = 0;
+}
+
+static void hdlc_frame(struct hdlc_deframer *d, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	/* skip empty frames, a live stream may well have them */
+	if (d->len < 1)
+		return;
+	if (d->len < sizeof(d->msg))
+		metrics_hdlc_frame(d->msg, d->len);
+	if (filter && !diag_filter_frame(filter, d->msg, d->len))
+		return;
+
+	/* Terminate message with standard GSM padding */
+	if (d->len < sizeof(d->msg) - 1)
+		d->msg[d->len] = 0x2b;
+
+	cb(d->msg, d->len);
+}
+
+/* Deframe the next piece of an HDLC stream, frames go to <cb> */
+void diag_hdlc_feed(struct hdlc_deframer *d, const uint8_t *data, size_t len, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	size_t pos = 0;
+	int complete;
+
+	uint64_t t;
+	size_t n;
+
+	while (pos < len) {
+		trace_begin(TRACE_FRAME, 0);
+		trace_begin(TRACE_DEFRAME, 0);
+		t = latency_start();
+		n = hdlc_deframe(d, &data[pos], len - pos, &complete);
+		latency_stop(LATENCY_DEFRAME, t, n);
+		trace_end(TRACE_DEFRAME, n);
+		pos += n;
+		if (!complete) {
+			trace_end(TRACE_FRAME, 0);
+			break;
+		}
+		hdlc_frame(d, filter, cb);
+		trace_end(TRACE_FRAME, d->len);
+	}
+}
+
+static void stream_dlf(struct diag_stream *st, const uint8_t *data, size_t len, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	size_t n, need, used;
+
+	/* complete the record left over from the last piece */
+	while (st->have && len) {
+		if (st->have < 2) {
+			st->buf[st->have++] = *data++;
+			len--;
+			continue;
+		}
+
+		need = get_le16(st->buf);
+		if (need < DLF_HDR_LEN || need > sizeof(st->buf)) {
+			/* corrupted, drop what we have */
+			st->have = 0;
+			break;
+		}
+
+		n = need - st->have;
+		if (n > len)
+			n = len;
+		memcpy(&st->buf[st->have], data, n);
+		st->have += n;
+		data += n;
+		len -= n;
+
+		if (st->have == need) {
+			diag_dlf_feed(st->buf, st->have, filter, cb);
+			st->have = 0;
+		}
+	}
+
+	if (!len)
+		return;
+
+	used = diag_dlf_feed(data, len, filter, cb);
+	n = len - used;
+	if (n <= sizeof(st->buf)) {
+		memcpy(st->buf, &data[used], n);
+		st->have = n;
+	} else {
+		/* oversized record, skip the rest of it */
+		st->skip = get_le16(&data[used]) - n;
+	}
+}
+
+static void stream_data(struct diag_stream *st, const uint8_t *data, size_t len, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	size_t n;
+
+	if (st->skip) {
+		n = st->skip < len ? st->skip : len;
+		st->skip -= n;
+		data += n;
+		len -= n;
+	}
+
+	if (st->fmt == DIAG_FORMAT_DLF)
+		stream_dlf(st, data, len, filter, cb);
+	else
+		diag_hdlc_feed(&st->d, data, len, filter, cb);
+}
+
+/*
+ * Feed the next piece of a stream. The first DIAG_STREAM_DETECT bytes
+ * (or less at EOF) are held back to detect the container format.
+ */
+void diag_stream_feed(struct diag_stream *st, const uint8_t *data, size_t len, int at_eof, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	uint8_t held[DIAG_STREAM_DETECT];
+	size_t n, held_len;
+
+	if (filter && !diag_filter_active(filter))
+		filter = NULL;
+
+	if (!st->detected) {
+		n = sizeof(st->buf) - st->have;
+		if (n > len)
+			n = len;
+		if (n)
+			memcpy(&st->buf[st->have], data, n);
+		st->have += n;
+		data += n;
+		len -= n;
+
+		if (st->have < sizeof(st->buf) && (!at_eof || !st->have))
+			return;
+		if (at_eof == DIAG_STREAM_PAUSE && !format_settled(st->buf, st->have))
+			return;
+
+		st->fmt = diag_format_detect(st->buf, st->have, &st->skip);
+		st->detected = 1;
+		if (st->fmt != DIAG_FORMAT_HDLC)
+			hdlc_deframer_init(&st->d, 0);
+
+		/* the held back bytes go first, buf is reused for DLF leftovers */
+		held_len = st->have;
+		memcpy(held, st->buf, held_len);
+		st->have = 0;
+		stream_data(st, held, held_len, filter, cb);
+	}
+
+	if (len)
+		stream_data(st, data, len, filter, cb);
+}
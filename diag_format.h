@@ -0,0 +1,61 @@
+#ifndef DIAG_FORMAT_H
+#define DIAG_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Container formats of DIAG capture files */
+enum diag_format {
+	DIAG_FORMAT_HDLC = 0,	/* raw QMDL, HDLC framed */
+	DIAG_FORMAT_QMDL2,	/* QMDL2 file header followed by HDLC frames */
+	DIAG_FORMAT_DLF,	/* length-prefixed log records (DLF/ISF style) */
+};
+
+#define HDLC_FRAME_MAX	4096
+
+/* Incremental HDLC deframer, same rules as fread_unescape() */
+struct hdlc_deframer {
+	uint8_t msg[HDLC_FRAME_MAX];
+	unsigned len;
+	int escape;
+	int done;
+	uint64_t offset;	/* stream offset of the next input byte */
+	uint64_t frame_start;	/* stream offset of the current frame */
+};
+
+#define DIAG_STREAM_DETECT	4096	/* bytes needed to detect the format */
+
+/* Container detection and deframing for data arriving in pieces */
+struct diag_stream {
+	int detected;
+	enum diag_format fmt;
+	size_t skip;		/* container header left to skip */
+	size_t have;		/* buffered bytes: detection data or a partial DLF record */
+	uint8_t buf[DIAG_STREAM_DETECT];
+	struct hdlc_deframer d;
+};
+
+enum diag_format diag_format_detect(const uint8_t *buf, size_t len, size_t *data_offset);
+const char *diag_format_name(enum diag_format fmt);
+struct diag_filter;
+
+/* Receives one unescaped frame, like handle_diag() */
+typedef void (*diag_frame_cb)(uint8_t *msg, unsigned len);
+
+size_t diag_dlf_feed(const uint8_t *buf, size_t len, const struct diag_filter *filter, diag_frame_cb cb);
+
+void hdlc_deframer_init(struct hdlc_deframer *d, uint64_t offset);
+size_t hdlc_deframe(struct hdlc_deframer *d, const uint8_t *buf, size_t len, int *complete);
+void diag_hdlc_feed(struct hdlc_deframer *d, const uint8_t *data, size_t len, const struct diag_filter *filter, diag_frame_cb cb);
+
+void diag_stream_init(struct diag_stream *st);
+void diag_stream_next_file(struct diag_stream *st);
+
+/* at_eof of diag_stream_feed() */
+#define DIAG_STREAM_MORE	0	/* more data follows */
+#define DIAG_STREAM_END		1	/* end of the input */
+#define DIAG_STREAM_PAUSE	2	/* end of a file that may still grow */
+
+void diag_stream_feed(struct diag_stream *st, const uint8_t *data, size_t len, int at_eof, const struct diag_filter *filter, diag_frame_cb cb);
+
+#endif
@@ -2,28 +2,187 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <err.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "diag_input.h"
+#include "diag_format.h"
+#include "diag_index.h"
+#include "diag_stats.h"
+#include "diag_follow.h"
+#include "diag_source.h"
+#include "diag_decomp.h"
 #include "bit_func.h"
 #include "session.h"
+#include "output.h"
+#include "column_export.h"
+#include "sqlite_store.h"
+#include "shm_ring.h"
+#include "stream_server.h"
+#include "dlog.h"
+#include "latency.h"
+#include "metrics.h"
+#include "trace.h"
 #include <stdlib.h>
 
 void process_file(char *infile_name, int do_init);
 
+static struct diag_filter filter;
+static int index_only = 0;
+static int write_index = 0;
+static diag_frame_cb frame_cb = handle_diag;
+static volatile sig_atomic_t stop = 0;
+
+enum {
+	OPT_FROM = 256,
+	OPT_TO,
+	OPT_CODE,
+	OPT_INDEX,
+	OPT_WRITE_INDEX,
+	OPT_STATS,
+	OPT_FOLLOW,
+	OPT_ROTATE_SIZE,
+	OPT_ROTATE_SECS,
+	OPT_ROTATE_COUNT,
+	OPT_COLUMNS,
+	OPT_COLUMNS_L3,
+	OPT_SQLITE,
+	OPT_SQLITE_ROWS,
+	OPT_SQLITE_MS,
+	OPT_SHM,
+	OPT_SHM_SIZE,
+	OPT_STREAM,
+	OPT_STREAM_QUEUE,
+	OPT_LOG_LEVEL,
+	OPT_LATENCY,
+	OPT_METRICS,
+	OPT_TRACE_OUT,
+	OPT_TRACE_SAMPLE,
+};
+
+static const struct option long_options[] = {
+	{ "from",	required_argument,	NULL, OPT_FROM },
+	{ "to",		required_argument,	NULL, OPT_TO },
+	{ "code",	required_argument,	NULL, OPT_CODE },
+	{ "index",	no_argument,		NULL, OPT_INDEX },
+	{ "write-index",	no_argument,		NULL, OPT_WRITE_INDEX },
+	{ "stats",	no_argument,		NULL, OPT_STATS },
+	{ "follow",	no_argument,		NULL, OPT_FOLLOW },
+	{ "rotate-size",	required_argument,	NULL, OPT_ROTATE_SIZE },
+	{ "rotate-secs",	required_argument,	NULL, OPT_ROTATE_SECS },
+	{ "rotate-count",	required_argument,	NULL, OPT_ROTATE_COUNT },
+	{ "columns",	required_argument,	NULL, OPT_COLUMNS },
+	{ "columns-l3",	no_argument,		NULL, OPT_COLUMNS_L3 },
+	{ "sqlite",	required_argument,	NULL, OPT_SQLITE },
+	{ "sqlite-rows",	required_argument,	NULL, OPT_SQLITE_ROWS },
+	{ "sqlite-ms",	required_argument,	NULL, OPT_SQLITE_MS },
+	{ "shm",	required_argument,	NULL, OPT_SHM },
+	{ "shm-size",	required_argument,	NULL, OPT_SHM_SIZE },
+	{ "stream",	required_argument,	NULL, OPT_STREAM },
+	{ "stream-queue",	required_argument,	NULL, OPT_STREAM_QUEUE },
+	{ "log-level",	required_argument,	NULL, OPT_LOG_LEVEL },
+	{ "latency",	no_argument,		NULL, OPT_LATENCY },
+	{ "metrics",	required_argument,	NULL, OPT_METRICS },
+	{ "trace-out",	required_argument,	NULL, OPT_TRACE_OUT },
+	{ "trace-sample",	required_argument,	NULL, OPT_TRACE_SAMPLE },
+	{ NULL, 0, NULL, 0 }
+};
+
 static void usage(const char *progname, const char *reason)
 {
 	printf("%s\n", reason);
 	printf("Usage: %s [-f <filelist>] [filenames]\n", progname);
 	printf("	-g <target>   - Target host for GSMTAP UDP stream\n");
-	printf("	-p <pcapfile> - Write to PCAP file\n");
+	printf("	-p <pcapfile> - Write to PCAP file (.pcapng, .gz/.zst)\n");
 	printf("	-f <filelist> - Read list of input files from <filelist>\n");
 	printf("	-i            - Initialize device\n");
-	printf("	-v            - Verbose messages\n");
-	printf("	[filenames]   - Read DIAG data from [filenames]\n");
+	printf("	-v            - Verbose messages, -vv and -vvv for debug output\n");
+	printf("	--from <time> - Only log packets from UNIX time <time> on\n");
+	printf("	--to <time>   - Only log packets up to UNIX time <time>\n");
+	printf("	--code <code> - Only log packets with log code <code> (hex, repeatable)\n");
+	printf("	--index       - Only build the .didx frame index of the inputs\n");
+	printf("	--write-index - Also write the .didx frame index while decoding\n");
+	printf("	--stats       - Only count frames per log code, RAT and time\n");
+	printf("	--follow      - Keep reading the last file as it grows and rotates,\n");
+	printf("	                or the last named pipe as writers come and go\n");
+	printf("	--rotate-size <size>   - Start a new pcap file after <size> bytes (k, M, G suffix)\n");
+	printf("	--rotate-secs <secs>   - Start a new pcap file every <secs> seconds\n");
+	printf("	--rotate-count <count> - Start a new pcap file after <count> packets\n");
+	printf("	--columns <file>       - Export decoded messages to a column file\n");
+	printf("	--columns-l3           - Include the L3 payload in the column file\n");
+	printf("	--sqlite <file>        - Store closed sessions and their cells in SQLite\n");
+	printf("	--sqlite-rows <rows>   - Commit every <rows> sessions (default %u)\n", SQLITE_STORE_ROWS);
+	printf("	--sqlite-ms <ms>       - Commit at least every <ms> milliseconds (default %u)\n", SQLITE_STORE_MS);
+	printf("	--shm <name>           - Publish GSMTAP packets in a shared memory ring\n");
+	printf("	--shm-size <size>      - Size of the shared memory ring (default 16M)\n");
+	printf("	--stream <path>        - Serve filtered messages to clients on a unix socket\n");
+	printf("	--stream-queue <size>  - Bytes queued per stream client (default 1M)\n");
+	printf("	--log-level <levels>   - Log levels per module, e.g. diag=2,l3=1 (modules diag, l3, session)\n");
+	printf("	--latency              - Latency histograms per pipeline stage, printed on SIGUSR1 and at exit\n");
+	printf("	--metrics <addr>       - Serve Prometheus metrics on [<host>:]<port> or unix:<path>\n");
+	printf("	--trace-out <file>     - Write a Chrome trace of the pipeline stages to <file> at exit\n");
+	printf("	--trace-sample <n>     - Trace one in <n> frames (default 1)\n");
+	printf("	[filenames]   - Read DIAG data from [filenames], which may also be\n");
+	printf("	                serial devices, named pipes, unix:<path> or tcp:<host>:<port>\n");
 	exit(1);
 }
 
+static uint64_t
+parse_size(const char *arg)
+{
+	char *end;
+	uint64_t size = strtoull(arg, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g':
+		size <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		size <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		size <<= 10;
+	}
+
+	return size;
+}
+
+static void
+stop_handler(int sig)
+{
+	stop = 1;
+}
+
+static void
+latency_handler(int sig)
+{
+	latency_request_dump();
+}
+
+/* Files are read right away, live inputs are served later from one loop */
+static void
+open_input(char *name, int do_init, int keep_open)
+{
+	if (strcmp(name, "-") && diag_source_is_stream(name)) {
+		if (diag_source_open(name, do_init, keep_open) < 0)
+			errx(1, "Cannot open input: %s", name);
+		return;
+	}
+
+	process_file(name, do_init);
+}
+
+static int
+is_fifo(const char *name)
+{
+	struct stat st;
+
+	return stat(name, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
 static void
 chop_newline(char *line)
 {
@@ -47,10 +206,28 @@ int main(int argc, char *argv[])
 	long cid = 0;
 	int line = 0;
 	int init = 0;
+	int follow = 0;
+	uint64_t rotate_size = 0;
+	unsigned rotate_secs = 0;
+	unsigned long rotate_count = 0;
+	char *columns_target = NULL;
+	int columns_l3 = 0;
+	char *sqlite_target = NULL;
+	unsigned sqlite_rows = SQLITE_STORE_ROWS;
+	unsigned sqlite_ms = SQLITE_STORE_MS;
+	char *shm_name = NULL;
+	uint64_t shm_size = SHM_RING_SIZE;
+	char *stream_path = NULL;
+	unsigned stream_queue = STREAM_QUEUE_SIZE;
+	char *log_levels = NULL;
+	char *metrics_addr = NULL;
+	char *trace_path = NULL;
+	unsigned trace_sample = 1;
+	struct sigaction sa;
 
 	msg_verbose = 0;
 
-	while ((ch = getopt(argc, argv, "p:g:f:vi")) != -1) {
+	while ((ch = getopt_long(argc, argv, "p:g:f:vi", long_options, NULL)) != -1) {
 		switch (ch) {
 			case 'g':
 				gsmtap_target = strdup(optarg);
@@ -67,12 +244,92 @@ int main(int argc, char *argv[])
 			case 'v':
 				msg_verbose++;
 				break;
+			case OPT_FROM:
+				filter.from = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_TO:
+				filter.to = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_CODE:
+				if (filter.n_codes == DIAG_FILTER_CODES)
+					usage(argv[0], "Too many log codes");
+				filter.codes[filter.n_codes++] = strtoul(optarg, NULL, 16);
+				break;
+			case OPT_INDEX:
+				index_only = 1;
+				break;
+			case OPT_WRITE_INDEX:
+				write_index = 1;
+				break;
+			case OPT_STATS:
+				frame_cb = diag_stats_frame;
+				break;
+			case OPT_FOLLOW:
+				follow = 1;
+				break;
+			case OPT_ROTATE_SIZE:
+				rotate_size = parse_size(optarg);
+				break;
+			case OPT_ROTATE_SECS:
+				rotate_secs = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_ROTATE_COUNT:
+				rotate_count = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_COLUMNS:
+				columns_target = strdup(optarg);
+				break;
+			case OPT_COLUMNS_L3:
+				columns_l3 = 1;
+				break;
+			case OPT_SQLITE:
+				sqlite_target = strdup(optarg);
+				break;
+			case OPT_SQLITE_ROWS:
+				sqlite_rows = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_SQLITE_MS:
+				sqlite_ms = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_SHM:
+				shm_name = strdup(optarg);
+				break;
+			case OPT_SHM_SIZE:
+				shm_size = parse_size(optarg);
+				break;
+			case OPT_STREAM:
+				stream_path = strdup(optarg);
+				break;
+			case OPT_STREAM_QUEUE:
+				stream_queue = parse_size(optarg);
+				break;
+			case OPT_LOG_LEVEL:
+				log_levels = strdup(optarg);
+				break;
+			case OPT_LATENCY:
+				latency_enable();
+				break;
+			case OPT_METRICS:
+				metrics_addr = strdup(optarg);
+				break;
+			case OPT_TRACE_OUT:
+				trace_path = strdup(optarg);
+				break;
+			case OPT_TRACE_SAMPLE:
+				trace_sample = strtoul(optarg, NULL, 0);
+				break;
 			case '?':
 			default:
 				usage(argv[0], "Invalid arguments");
 		}
 	}
 
+	dlog_init(msg_verbose);
+	if (log_levels && dlog_set_levels(log_levels) < 0)
+	{
+		usage(argv[0], "Invalid log levels");
+	}
+
 	argc -= optind;
 	argv += optind;
 
@@ -81,19 +338,73 @@ int main(int argc, char *argv[])
 		errx(1, "Invalid arguments");
 	}
 
+	if (follow && (argc == 0 || init || strcmp(argv[argc - 1], "-") == 0))
+	{
+		errx(1, "--follow needs a capture file or named pipe as the last argument");
+	}
+
+	if (columns_target && column_export_open(columns_target, columns_l3) < 0)
+	{
+		exit(1);
+	}
+
+	if (sqlite_target && sqlite_store_open(sqlite_target, sqlite_rows, sqlite_ms) < 0)
+	{
+		exit(1);
+	}
+
+	if (shm_name && shm_ring_create(shm_name, shm_size) < 0)
+	{
+		exit(1);
+	}
+
+	if (stream_path && stream_server_open(stream_path, stream_queue) < 0)
+	{
+		exit(1);
+	}
+
+	if (metrics_addr && metrics_open(metrics_addr) < 0)
+	{
+		exit(1);
+	}
+
+	if (trace_path && trace_open(trace_path, trace_sample) < 0)
+	{
+		exit(1);
+	}
+
+	net_set_rotation(rotate_size, rotate_secs, rotate_count);
 	diag_init(sid, cid, gsmtap_target, pcap_target, NULL, appid);
 
 	printf("PARSER_OK\n");
 	fflush(stdout);
 
+	dlog_start();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (latency_enabled) {
+		sa.sa_handler = latency_handler;
+		sigaction(SIGUSR1, &sa, NULL);
+	}
+
 	//  Handle files passed to command line first
-	while (argc > 0)
+	while (argc > follow)
 	{
-		process_file(argv[0], init);
+		open_input(argv[0], init, 0);
 		argc--;
 		argv++;
 	};
 
+	//  With --follow a named pipe stays open while writers come and go
+	if (follow && is_fifo(argv[0]))
+	{
+		open_input(argv[0], init, 1);
+		follow = 0;
+	}
+
 	//  Handle file list
 	if (filelist_name)
 	{
@@ -113,23 +424,254 @@ int main(int argc, char *argv[])
 			}
 			if (ret) {
 				chop_newline(infile_name);
-				process_file(infile_name, init);
+				open_input(infile_name, init, 0);
 			}
 		}
 		fclose(filelist);
 	}
 
+	//  Serve devices, pipes and sockets until they close or we are interrupted
+	diag_source_run(&stop, &filter, frame_cb == handle_diag ? NULL : frame_cb);
+	diag_source_close_all();
+
+	//  Tail the last file until interrupted
+	if (follow && !stop)
+	{
+		diag_follow(argv[0], &filter, frame_cb, &stop);
+	}
+
+	if (frame_cb == diag_stats_frame)
+		diag_stats_print(stdout);
+
+	metrics_close();
 	diag_destroy(&sid, &cid);
+	latency_dump(stderr);
+	trace_close();
+	column_export_close();
+	sqlite_store_close();
+	shm_ring_destroy();
+	stream_server_close();
+	dlog_stop();
 
 	return 0;
 }
 
+/* What to do with each deframed frame */
+struct frame_sink {
+	struct diag_index *idx;			/* index to extend */
+	const struct diag_filter *filter;	/* frames to pass on */
+	int dispatch;				/* pass frames to frame_cb */
+};
+
+/* Returns 0 if the input ends here */
+static int
+sink_frame(struct frame_sink *sink, struct hdlc_deframer *d)
+{
+	/* Like the stdio reader, an empty frame ends the input */
+	if (d->len < 1)
+		return 0;
+
+	if (sink->idx)
+		diag_index_add(sink->idx, d->frame_start, d->msg, d->len);
+
+	if (!sink->dispatch)
+		return 1;
+	/* counted on the pass that dispatches, an indexing pass may come first */
+	if (d->len < sizeof(d->msg))
+		metrics_hdlc_frame(d->msg, d->len);
+	if (sink->filter && !diag_filter_frame(sink->filter, d->msg, d->len))
+		return 1;
+
+	/* Terminate message with standard GSM padding */
+	if (d->len < sizeof(d->msg) - 1) {
+		d->msg[d->len] = 0x2b;
+	}
+
+	frame_cb(d->msg, d->len);
+	return 1;
+}
+
+/* Deframe the HDLC data in [start, end) of the mapping */
+static int
+deframe_range(const uint8_t *map, uint64_t start, uint64_t end, struct frame_sink *sink)
+{
+	static struct hdlc_deframer d;
+	uint64_t pos = start;
+	int complete = 0;
+
+	hdlc_deframer_init(&d, start);
+
+	while (pos < end) {
+		pos += hdlc_deframe(&d, &map[pos], end - pos, &complete);
+		if (!complete)
+			break;
+		if (!sink_frame(sink, &d))
+			return 0;
+	}
+
+	/* unterminated frame at the end of the file */
+	if (!complete && d.len)
+		return sink_frame(sink, &d);
+
+	return 1;
+}
+
+/* Only deframe the index blocks that may hold frames matching the filter */
+static void
+extract_range(const uint8_t *map, uint64_t size, const struct diag_index *idx)
+{
+	struct frame_sink sink = { NULL, &filter, 1 };
+	uint64_t end;
+	unsigned i;
+
+	for (i = 0; i < idx->hdr.count; i++) {
+		if (!diag_filter_block(&filter, &idx->e[i]))
+			continue;
+
+		end = (i + 1 < idx->hdr.count) ? idx->e[i + 1].offset : size;
+		if (!deframe_range(map, idx->e[i].offset, end, &sink))
+			break;
+	}
+}
+
+/*
+ * Map a regular file and detect its container format. Returns 1 if the
+ * whole file was handled.
+ */
+static int
+process_mapped(FILE *infile, const char *infile_name)
+{
+	struct stat st;
+	uint8_t *map;
+	size_t offset = 0;
+	enum diag_format fmt;
+	struct diag_index idx;
+	struct frame_sink sink;
+	char idx_name[FILENAME_MAX];
+	int have_idx;
+
+	if (fstat(fileno(infile), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+	if (map == MAP_FAILED)
+		return 0;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	fmt = diag_format_detect(map, st.st_size, &offset);
+	if (msg_verbose) {
+		fprintf(stderr, "Input format %s\n", diag_format_name(fmt));
+	}
+
+	if (fmt == DIAG_FORMAT_DLF) {
+		/* records are length-prefixed, no index needed to skip them */
+		if (!index_only)
+			diag_dlf_feed(map, st.st_size, diag_filter_active(&filter) ? &filter : NULL, frame_cb);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	snprintf(idx_name, sizeof(idx_name), "%s.didx", infile_name);
+	have_idx = !diag_index_read(&idx, idx_name, st.st_size, st.st_mtime);
+
+	if (!have_idx) {
+		/* Index on the first pass unless we only need some of the blocks */
+		diag_index_init(&idx, st.st_size, st.st_mtime, offset);
+		sink.idx = &idx;
+		sink.filter = NULL;
+		sink.dispatch = !index_only && !diag_filter_active(&filter);
+		deframe_range(map, offset, st.st_size, &sink);
+
+		/* captures may well sit in read-only directories, write only if asked */
+		if (index_only || write_index) {
+			if (diag_index_write(&idx, idx_name) < 0) {
+				if (msg_verbose)
+					fprintf(stderr, "Cannot write index %s\n", idx_name);
+			} else if (msg_verbose) {
+				fprintf(stderr, "Wrote index %s (%u blocks)\n", idx_name, idx.hdr.count);
+			}
+		}
+
+		if (sink.dispatch || index_only)
+			goto out;
+	}
+
+	if (index_only)
+		goto out;
+
+	if (diag_filter_active(&filter)) {
+		madvise(map, st.st_size, MADV_RANDOM);
+		extract_range(map, st.st_size, &idx);
+	} else {
+		sink.idx = NULL;
+		sink.filter = NULL;
+		sink.dispatch = 1;
+		deframe_range(map, offset, st.st_size, &sink);
+	}
+
+out:
+	diag_index_free(&idx);
+	munmap(map, st.st_size);
+	return 1;
+}
+
+/*
+ * Decompress .gz/.zst captures on a worker thread, returns 1 if the file
+ * was compressed and has been handled.
+ */
+static int
+process_compressed(FILE *infile)
+{
+	static struct diag_stream st;
+	struct diag_decomp *dd;
+	enum diag_compression comp;
+	const uint8_t *data;
+	uint8_t magic[4];
+	ssize_t len;
+
+	if (pread(fileno(infile), magic, sizeof(magic), 0) != sizeof(magic))
+		return 0;
+
+	comp = diag_compression_detect(magic, sizeof(magic));
+	if (comp == DIAG_COMP_NONE)
+		return 0;
+
+	if (!diag_decomp_supported(comp))
+		errx(1, "No %s support built in", diag_compression_name(comp));
+
+	if (msg_verbose) {
+		fprintf(stderr, "Input compression %s\n", diag_compression_name(comp));
+	}
+
+	/* Compressed captures cannot be indexed or seeked, just filtered */
+	if (index_only)
+		return 1;
+
+	dd = diag_decomp_start(fileno(infile), comp);
+	if (!dd)
+		errx(1, "Cannot start %s decompression", diag_compression_name(comp));
+
+	diag_stream_init(&st);
+	while ((len = diag_decomp_read(dd, &data)) > 0) {
+		diag_stream_feed(&st, data, len, DIAG_STREAM_MORE, &filter, frame_cb);
+		diag_decomp_release(dd);
+	}
+	diag_stream_feed(&st, NULL, 0, DIAG_STREAM_END, &filter, frame_cb);
+
+	if (len < 0)
+		fprintf(stderr, "Decompression failed, input truncated\n");
+
+	diag_decomp_stop(dd);
+	return 1;
+}
+
 void
 process_file(char *infile_name, int do_init)
 {
 	uint8_t msg[4096];
 	FILE *infile = NULL;
 	unsigned len = 0;
+	uint64_t t;
 
 	if (strcmp(infile_name, "-") == 0)
 	{
@@ -148,19 +690,42 @@ process_file(char *infile_name, int do_init)
 		diag_set_log(infile);
 	diag_set_filename(infile_name);
 
+	/* Capture files are decompressed or read straight from a mapping */
+	if (!do_init && infile != stdin &&
+	    (process_compressed(infile) || process_mapped(infile, infile_name))) {
+		fclose(infile);
+		return;
+	}
+
 	for (;;) {
+		trace_begin(TRACE_FRAME, 0);
+		trace_begin(TRACE_DEFRAME, 0);
+		t = latency_start();
 		len = fread_unescape(infile, msg, sizeof(msg));
+		latency_stop(LATENCY_DEFRAME, t, len);
+		trace_end(TRACE_DEFRAME, len);
 
 		if (len < 1) {
+			trace_end(TRACE_FRAME, 0);
 			break;
 		}
 
+		if (len < sizeof(msg)) {
+			metrics_hdlc_frame(msg, len);
+		}
+
+		if (diag_filter_active(&filter) && !diag_filter_frame(&filter, msg, len)) {
+			trace_end(TRACE_FRAME, len);
+			continue;
+		}
+
 		/* Terminate message with standard GSM padding */
 		if (len < sizeof(msg) - 1) {
 			msg[len] = 0x2b;
 		}
 
-		handle_diag(msg, len);
+		frame_cb(msg, len);
+		trace_end(TRACE_FRAME, len);
 	}
 	fclose(infile);
 }
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag_index.h"
+
+/*
+ * Frame offset index kept next to a capture as <file>.didx. Every
+ * DIAG_INDEX_INTERVAL frames a new entry records where the block starts,
+ * the time range of its log packets and a bloom filter of their log
+ * codes, so time range and log code extraction only deframes the blocks
+ * that can contain matching packets.
+ */
+
+#define GPS_EPOCH_OFFSET	315964800
+
+static inline int log_packet(const uint8_t *msg, unsigned len)
+{
+	return len >= 16 && msg[0] == 0x10 && msg[1] == 0x00;
+}
+
+static inline uint16_t log_code(const uint8_t *msg)
+{
+	return msg[6] | (msg[7] << 8);
+}
+
+/* Same scale as get_epoch(), but 0 instead of the wall clock fallback */
+uint32_t diag_frame_epoch(const uint8_t *qd_time)
+{
+	double qd_ts;
+
+	qd_ts = qd_time[1];
+	qd_ts += ((uint32_t)qd_time[2]) << 8;
+	qd_ts += ((uint32_t)qd_time[3]) << 16;
+	qd_ts += ((uint32_t)qd_time[4]) << 24;
+	qd_ts *= 1.25*256.0/1000.0;
+
+	if (qd_ts < 1000000000)
+		return 0;
+
+	return qd_ts + GPS_EPOCH_OFFSET;
+}
+
+static inline void bloom_bits(uint16_t code, unsigned *a, unsigned *b)
+{
+	*a = (code ^ (code >> 8)) & 0xff;
+	*b = (code * 0x9e3779b1u) >> 24;
+}
+
+static void bloom_add(uint64_t *bloom, uint16_t code)
+{
+	unsigned a, b;
+
+	bloom_bits(code, &a, &b);
+	bloom[a >> 6] |= 1ULL << (a & 63);
+	bloom[b >> 6] |= 1ULL << (b & 63);
+}
+
+static int bloom_has(const uint64_t *bloom, uint16_t code)
+{
+	unsigned a, b;
+
+	bloom_bits(code, &a, &b);
+	return (bloom[a >> 6] & (1ULL << (a & 63))) && (bloom[b >> 6] & (1ULL << (b & 63)));
+}
+
+void diag_index_init(struct diag_index *idx, uint64_t file_size, uint64_t file_mtime, uint64_t data_offset)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->hdr.magic = DIAG_INDEX_MAGIC;
+	idx->hdr.version = DIAG_INDEX_VERSION;
+	idx->hdr.interval = DIAG_INDEX_INTERVAL;
+	idx->hdr.file_size = file_size;
+	idx->hdr.file_mtime = file_mtime;
+	idx->hdr.data_offset = data_offset;
+}
+
+static struct diag_index_entry *new_entry(struct diag_index *idx, uint64_t offset)
+{
+	struct diag_index_entry *e;
+
+	if (idx->hdr.count == idx->alloc) {
+		idx->alloc = idx->alloc ? idx->alloc * 2 : 256;
+		idx->e = realloc(idx->e, idx->alloc * sizeof(*idx->e));
+		if (!idx->e) {
+			fprintf(stderr, "Out of memory for the frame index\n");
+			exit(1);
+		}
+	}
+
+	e = &idx->e[idx->hdr.count++];
+	memset(e, 0, sizeof(*e));
+	e->offset = offset;
+	e->epoch_min = UINT32_MAX;
+
+	return e;
+}
+
+/* Account one deframed frame starting at file offset <offset> */
+void diag_index_add(struct diag_index *idx, uint64_t offset, const uint8_t *msg, unsigned len)
+{
+	struct diag_index_entry *e;
+	uint32_t epoch;
+	uint16_t code;
+
+	if (idx->hdr.count == 0 || idx->e[idx->hdr.count - 1].frames >= idx->hdr.interval) {
+		e = new_entry(idx, offset);
+	} else {
+		e = &idx->e[idx->hdr.count - 1];
+	}
+
+	e->frames++;
+
+	if (!log_packet(msg, len))
+		return;
+
+	code = log_code(msg);
+	if (!e->timestamp) {
+		memcpy(&e->timestamp, &msg[8], sizeof(e->timestamp));
+		e->log_code = code;
+	}
+	bloom_add(e->code_bloom, code);
+
+	epoch = diag_frame_epoch(&msg[8]);
+	if (epoch) {
+		if (epoch < e->epoch_min)
+			e->epoch_min = epoch;
+		if (epoch > e->epoch_max)
+			e->epoch_max = epoch;
+	}
+}
+
+int diag_index_write(const struct diag_index *idx, const char *path)
+{
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -1;
+
+	ok = fwrite(&idx->hdr, sizeof(idx->hdr), 1, f) == 1;
+	if (ok && idx->hdr.count)
+		ok = fwrite(idx->e, sizeof(*idx->e), idx->hdr.count, f) == idx->hdr.count;
+	if (fclose(f))
+		ok = 0;
+
+	if (!ok) {
+		remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Load an index, fails if it is missing or does not match the capture */
+int diag_index_read(struct diag_index *idx, const char *path, uint64_t file_size, uint64_t file_mtime)
+{
+	FILE *f;
+
+	memset(idx, 0, sizeof(*idx));
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -1;
+
+	if (fread(&idx->hdr, sizeof(idx->hdr), 1, f) != 1 ||
+	    idx->hdr.magic != DIAG_INDEX_MAGIC ||
+	    idx->hdr.version != DIAG_INDEX_VERSION ||
+	    idx->hdr.file_size != file_size ||
+	    idx->hdr.file_mtime != file_mtime) {
+		fclose(f);
+		return -1;
+	}
+
+	idx->alloc = idx->hdr.count;
+	idx->e = malloc(idx->alloc * sizeof(*idx->e) + 1);
+	if (!idx->e || fread(idx->e, sizeof(*idx->e), idx->hdr.count, f) != idx->hdr.count) {
+		fclose(f);
+		diag_index_free(idx);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+void diag_index_free(struct diag_index *idx)
+{
+	free(idx->e);
+	idx->e = NULL;
+	idx->alloc = 0;
+	idx->hdr.count = 0;
+}
+
+int diag_filter_active(const struct diag_filter *f)
+{
+	return f && (f->from || f->to || f->n_codes);
+}
+
+static int filter_code(const struct diag_filter *f, uint16_t code)
+{
+	unsigned i;
+
+	if (!f->n_codes)
+		return 1;
+
+	for (i = 0; i < f->n_codes; i++) {
+		if (f->codes[i] == code)
+			return 1;
+	}
+	return 0;
+}
+
+/* Can the block contain frames selected by the filter? */
+int diag_filter_block(const struct diag_filter *f, const struct diag_index_entry *e)
+{
+	unsigned i;
+
+	if (f->from || f->to) {
+		if (e->epoch_min > e->epoch_max)
+			return 0;
+		if (f->from && e->epoch_max < f->from)
+			return 0;
+		if (f->to && e->epoch_min > f->to)
+			return 0;
+	}
+
+	if (f->n_codes) {
+		for (i = 0; i < f->n_codes; i++) {
+			if (bloom_has(e->code_bloom, f->codes[i]))
+				return 1;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Non-log frames always pass, they carry state like the time packets */
+int diag_filter_frame(const struct diag_filter *f, const uint8_t *msg, unsigned len)
+{
+	uint32_t epoch;
+
+	if (!log_packet(msg, len))
+		return 1;
+
+	if (f->from || f->to) {
+		epoch = diag_frame_epoch(&msg[8]);
+		if (!epoch)
+			return 0;
+		if (f->from && epoch < f->from)
+			return 0;
+		if (f->to && epoch > f->to)
+			return 0;
+	}
+
+	return filter_code(f, log_code(msg));
+}
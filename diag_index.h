@@ -0,0 +1,63 @@
+#ifndef DIAG_INDEX_H
+#define DIAG_INDEX_H
+
+#include <stdint.h>
+
+#define DIAG_INDEX_MAGIC	0x58444944	/* "DIDX" */
+#define DIAG_INDEX_VERSION	1
+#define DIAG_INDEX_INTERVAL	1024		/* frames per index entry */
+#define DIAG_FILTER_CODES	32
+
+/* .didx sidecar header */
+struct diag_index_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t interval;
+	uint32_t count;
+	uint64_t file_size;
+	uint64_t file_mtime;
+	uint64_t data_offset;
+} __attribute__((packed));
+
+/* One entry per block of DIAG_INDEX_INTERVAL frames */
+struct diag_index_entry {
+	uint64_t offset;	/* file offset of the first frame */
+	uint64_t timestamp;	/* Qualcomm timestamp of the first log packet */
+	uint32_t epoch_min;	/* UNIX time range of the log packets */
+	uint32_t epoch_max;
+	uint16_t log_code;	/* log code of the first log packet */
+	uint16_t pad;
+	uint32_t frames;
+	uint64_t code_bloom[4];	/* log codes seen in the block */
+};
+
+/* The entries are written as they are, without any padding */
+_Static_assert(sizeof(struct diag_index_entry) == 64, "diag_index_entry must be 64 bytes");
+
+struct diag_index {
+	struct diag_index_hdr hdr;
+	struct diag_index_entry *e;
+	unsigned alloc;
+};
+
+/* Time range and log code selection for extraction */
+struct diag_filter {
+	uint32_t from;
+	uint32_t to;
+	unsigned n_codes;
+	uint16_t codes[DIAG_FILTER_CODES];
+};
+
+void diag_index_init(struct diag_index *idx, uint64_t file_size, uint64_t file_mtime, uint64_t data_offset);
+void diag_index_add(struct diag_index *idx, uint64_t offset, const uint8_t *msg, unsigned len);
+int diag_index_write(const struct diag_index *idx, const char *path);
+int diag_index_read(struct diag_index *idx, const char *path, uint64_t file_size, uint64_t file_mtime);
+void diag_index_free(struct diag_index *idx);
+
+uint32_t diag_frame_epoch(const uint8_t *qd_time);
+
+int diag_filter_active(const struct diag_filter *f);
+int diag_filter_block(const struct diag_filter *f, const struct diag_index_entry *e);
+int diag_filter_frame(const struct diag_filter *f, const uint8_t *msg, unsigned len);
+
+#endif
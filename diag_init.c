@@ -51,7 +51,7 @@ static const uint16_t crc_ccit16[256] =
         0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
 };
 
-static uint16_t crc16(const uint8_t *data, size_t len)
+uint16_t diag_crc16(const uint8_t *data, size_t len)
 {
         uint16_t crc = CRC_SEED;
 
@@ -95,7 +95,7 @@ int frame_pack(const uint8_t *in, const size_t in_len, uint8_t *out, const size_
         }
 
         /* two bytes CRC */
-        uint16_t crc = crc16(in, in_len);
+        uint16_t crc = diag_crc16(in, in_len);
 
         c = (uint8_t) (crc & 0xFF);
         DO_ESCAPE(c, idx, out, out_len);
@@ -14,6 +14,14 @@
 #include "session.h"
 #include "diag_structs.h"
 #include "l3_handler.h"
+#include "freq_cache.h"
+#include "hopping.h"
+#include "callback.h"
+#include "dlog.h"
+#include "latency.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
 
 struct diag_packet {
 	uint16_t msg_class;
@@ -27,12 +35,8 @@ struct diag_packet {
 	uint8_t data[0];
 } __attribute__ ((packed));
 
-struct burst_info {
-	uint32_t fn;
-	uint16_t arfcn[4];
-} last_burst;
-
-struct radio_message *last_m = NULL;
+/* Parser state of the default input, using the global sessions */
+static struct diag_ctx default_ctx = { .s = _s };
 
 void diag_init(unsigned start_sid, unsigned start_cid, const char *gsmtap_target, const char *pcap_target, char *filename, uint32_t appid)
 {
@@ -45,7 +49,8 @@ void diag_init(unsigned start_sid, unsigned start_cid, const char *gsmtap_target
 	auto_timestamp = 0;
 #endif
 
-	memset(&last_burst, 0, sizeof(last_burst));
+	memset(&default_ctx.last_burst, 0, sizeof(default_ctx.last_burst));
+	default_ctx.last_m = NULL;
 
 	session_init(start_sid, 0, gsmtap_target, pcap_target, callback_type);
 
@@ -72,6 +77,13 @@ void diag_set_appid(uint32_t appid)
 
 void diag_destroy(unsigned *last_sid, unsigned *last_cid)
 {
+	if (DLOG_ENABLED(DLOG_DIAG, DLOG_INFO)) {
+		unsigned long hits, misses;
+
+		freq_cache_stats(&hits, &misses);
+		DLOG(DLOG_DIAG, DLOG_INFO, "Frequency list cache: %lu hits, %lu misses\n", hits, misses);
+	}
+
 	session_destroy(last_sid, last_cid);
 }
 
@@ -109,11 +121,38 @@ uint32_t get_epoch(uint8_t *qd_time)
 	return qd_ts;
 }
 
+/* Like get_epoch(), with the nanoseconds past the second taken from the same tick count */
+uint32_t get_epoch_ns(uint8_t *qd_time, uint32_t *nsec)
+{
+	uint64_t ticks, ns;
+	struct timeval tv;
+
+	ticks = qd_time[0];
+	ticks |= ((uint64_t)qd_time[1]) << 8;
+	ticks |= ((uint64_t)qd_time[2]) << 16;
+	ticks |= ((uint64_t)qd_time[3]) << 24;
+	ticks |= ((uint64_t)qd_time[4]) << 32;
+
+	/* One tick is 1.25 ms */
+	ns = ticks * 1250000;
+
+	/* Sanity check on timestamp (year > 2011) */
+	if (auto_timestamp || ns < 1000000000ULL * 1000000000) {
+		gettimeofday(&tv, NULL);
+		*nsec = tv.tv_usec * 1000;
+		return tv.tv_sec;
+	}
+
+	*nsec = ns % 1000000000;
+
+	return ns / 1000000000 + 315964800;
+}
+
 void print_common(struct diag_packet *dp, unsigned len)
 {
-	printf("%u [%02u] ", get_fn(dp), dp->len);
-	printf("%04x/%03u/%03u ", dp->msg_protocol, dp->msg_type, dp->msg_subtype);
-	printf("[%03u] %s\n", dp->data_len, osmo_hexdump_nospc(dp->data, len-2-sizeof(struct diag_packet)));
+	DLOG(DLOG_DIAG, DLOG_DEBUG, "%u [%02u] %04x/%03u/%03u [%03u] %s\n", get_fn(dp), dp->len,
+		dp->msg_protocol, dp->msg_type, dp->msg_subtype,
+		dp->data_len, DLOG_HEX(dp->data, len-2-sizeof(struct diag_packet)));
 }
 
 struct radio_message * handle_3G(struct diag_packet *dp, unsigned len)
@@ -168,9 +207,7 @@ struct radio_message * handle_3G(struct diag_packet *dp, unsigned len)
 		}
 		break;
 	default:
-		if (msg_verbose > 1) {
-			printf("Discarding 3G message type=%d data=%s\n", dp->msg_type, osmo_hexdump_nospc(dp->data, payload_len));
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "Discarding 3G message type=%d data=%s\n", dp->msg_type, DLOG_HEX(dp->data, payload_len));
 		free(m);
 		return 0;
 	}
@@ -261,9 +298,7 @@ struct radio_message * handle_4G(struct diag_packet *dp, unsigned len)
 		break;
 	case 0xb0f3: // EMM ciphering and integrity keys
 	default:
-		if (msg_verbose > 1) {
-			printf("Discarding 4G message type=%d data=%s\n", dp->msg_type, osmo_hexdump_nospc(dp->data, payload_len));
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "Discarding 4G message type=%d data=%s\n", dp->msg_type, DLOG_HEX(dp->data, payload_len));
 		free(m);
 		return NULL;
 	}
@@ -309,9 +344,7 @@ struct radio_message * handle_bcch_and_rr(struct diag_packet *dp, unsigned len)
 	case 0x84: /* SACCH DL RR */
 		return new_l3(dp->data, dtap_len, RAT_GSM, DOMAIN_CS, get_fn(dp), 0, MSG_SACCH);
 	default:
-		if (msg_verbose > 1) {
-			print_common(dp, len);
-		}
+		print_common(dp, len);
 	}
 
 	return 0;
@@ -324,84 +357,99 @@ void handle_gsm_l1_txlev_timing_advance(struct diag_packet *dp, unsigned len)
 	decoded->arfcn_and_band = ntohs(decoded->arfcn_and_band);
 
 	if (len-16-2 != 4) {
-		if (msg_verbose > 1) {
-			printf("x gsm_l1_txlev_timing_advance length incorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gsm_l1_txlev_timing_advance length incorrect\n");
 		return;
 	}
 
-	if (msg_verbose > 1) {
-		//printf("x %s\n", osmo_hexdump_nospc(&dp->msg_type, len-16) );
-		printf("x -> arfcn: %d\n", get_arfcn_from_arfcn_and_band(decoded->arfcn_and_band));
-		printf("x -> band: %d\n", get_band_from_arfcn_and_band(decoded->arfcn_and_band));
-		printf("x -> timing advance: %u\n", decoded->timing_advance);
-		printf("x -> tx_power_level: %u\n", decoded->tx_power_level);
-	}
+	DLOG(DLOG_DIAG, DLOG_DEBUG, "x -> arfcn: %d\nx -> band: %d\nx -> timing advance: %u\nx -> tx_power_level: %u\n",
+		get_arfcn_from_arfcn_and_band(decoded->arfcn_and_band),
+		get_band_from_arfcn_and_band(decoded->arfcn_and_band),
+		decoded->timing_advance,
+		decoded->tx_power_level);
 }
 
-void handle_gsm_l1_surround_cell_ba_list(struct diag_packet *dp, unsigned len)
+void handle_gsm_l1_surround_cell_ba_list(struct diag_ctx *ctx, struct diag_packet *dp, unsigned len)
 {
 	struct gsm_l1_surround_cell_ba_list *cl = (struct gsm_l1_surround_cell_ba_list *)&dp->msg_type;
 	struct surrounding_cell *sc = cl->surr_cells;
+	unsigned old_count = arfcn_set_count(&ctx->s[0].neigh_arfcns);
+	int i;
 
 	if (len-16-2 != sizeof(struct surrounding_cell)*cl->cell_count + 1) {
-		if (msg_verbose > 1) {
-			printf("x gsm_l1_surround_cell_ba_list length incorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gsm_l1_surround_cell_ba_list length incorrect\n");
 		return;
 	}
 
-	if (msg_verbose > 1) {
-		int i;
+	for (i = 0; i < cl->cell_count; i++) {
+		uint8_t band = get_band_from_arfcn_and_band(ntohs(sc[i].bcch_arfcn_and_band));
+		uint16_t n_arfcn = get_arfcn_from_arfcn_and_band(ntohs(sc[i].bcch_arfcn_and_band));
 
-		for (i = 0; i < cl->cell_count; i++) {
-			uint8_t band = get_band_from_arfcn_and_band(ntohs(sc[i].bcch_arfcn_and_band));
-			if (band == 8 || band == 9) {
-				printf("arfcn neighbor %u %d %u\n",
-					get_arfcn_from_arfcn_and_band(ntohs(sc[i].bcch_arfcn_and_band)),
-					sc[i].rx_power,
-					sc[i].frame_number_offset
-				);
-			}
-		}
+		if (band != 8 && band != 9)
+			continue;
+
+		/* Keep the BA list of the serving cell */
+		arfcn_set_add(&ctx->s[0].neigh_arfcns, n_arfcn);
+		arfcn_set_add(&ctx->s[1].neigh_arfcns, n_arfcn);
+
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "arfcn neighbor %u %d %u\n",
+			n_arfcn,
+			sc[i].rx_power,
+			sc[i].frame_number_offset);
 	}
+
+	if (arfcn_set_count(&ctx->s[0].neigh_arfcns) != old_count)
+		callback_cell_update(&ctx->s[0]);
 }
 
-void handle_gsm_l1_burst_metrics(struct diag_packet *dp, unsigned len)
+void handle_gsm_l1_burst_metrics(struct diag_ctx *ctx, struct diag_packet *dp, unsigned len)
 {
 	struct gsm_l1_burst_metrics *dat = (struct gsm_l1_burst_metrics *)&dp->msg_type;
+	struct hopping_seq *hs;
 	int i;
 
 	if (len-16-2 != sizeof(struct gsm_l1_burst_metrics)) {
-		if (msg_verbose > 1) {
-			printf("x gsm_l1_burst_metrics length incorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gsm_l1_burst_metrics length incorrect\n");
 		return;
 	}
 
-	last_burst.fn = get_fn(dp);
+	ctx->last_burst.fn = get_fn(dp);
+
+	/* Hopping sequence of the current dedicated channel, if any */
+	if (!ctx->hopping && ctx->s[0].ga.h)
+		ctx->hopping = (struct hopping_cache *) calloc(1, sizeof(struct hopping_cache));
+	hs = ctx->hopping ? hopping_from_assignment(ctx->hopping, &ctx->s[0].ga) : NULL;
 
 	/* log burst information */
 	for (i = 0; i < 4; i++) {
 		uint8_t band = get_band_from_arfcn_and_band(ntohs(dat->metrics[i].arfcn_and_band));
 		uint16_t n_arfcn = get_arfcn_from_arfcn_and_band(ntohs(dat->metrics[i].arfcn_and_band));
 		if (band == 8 || band == 9) {
-			last_burst.arfcn[i] = n_arfcn;
+			ctx->last_burst.arfcn[i] = n_arfcn;
+		} else if (hs) {
+			ctx->last_burst.arfcn[i] = hopping_arfcn(hs, dat->metrics[i].frame_number);
 		} else {
-			last_burst.arfcn[i] = last_burst.arfcn[0];
+			ctx->last_burst.arfcn[i] = ctx->last_burst.arfcn[0];
 		}
 	}
 
-	if (msg_verbose > 1) {
+	if (DLOG_ENABLED(DLOG_DIAG, DLOG_DEBUG)) {
 		for (i = 0; i < 4; i++) {
 			uint8_t band = get_band_from_arfcn_and_band(ntohs(dat->metrics[i].arfcn_and_band));
-			if (band == 8 || band == 9) {
-				printf("arfcn burst %u %d %u %u\n",
+			if (band != 8 && band != 9)
+				continue;
+			if (hs) {
+				DLOG(DLOG_DIAG, DLOG_DEBUG, "arfcn burst %u %d %u %u hopping %u\n",
 					get_arfcn_from_arfcn_and_band(ntohs(dat->metrics[i].arfcn_and_band)),
 					dat->metrics[i].rx_power,
 					dat->metrics[i].frame_number,
-					get_fn(dp)
-				);
+					get_fn(dp),
+					hopping_arfcn(hs, dat->metrics[i].frame_number));
+			} else {
+				DLOG(DLOG_DIAG, DLOG_DEBUG, "arfcn burst %u %d %u %u\n",
+					get_arfcn_from_arfcn_and_band(ntohs(dat->metrics[i].arfcn_and_band)),
+					dat->metrics[i].rx_power,
+					dat->metrics[i].frame_number,
+					get_fn(dp));
 			}
 		}
 	}
@@ -412,13 +460,11 @@ void handle_gsm_l1_neighbor_cell_auxiliary_measurments(struct diag_packet *dp, u
 	struct gsm_l1_neighbor_cell_auxiliary_measurments *cl = (struct gsm_l1_neighbor_cell_auxiliary_measurments *)&dp->msg_type;
 
 	if (len-16-2 != sizeof(struct cell)*cl->cell_count + 1) {
-		if (msg_verbose > 1) {
-			printf("x gsm_l1_neighbor_cell_auxiliary_measurments length icorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gsm_l1_neighbor_cell_auxiliary_measurments length icorrect\n");
 		return;
 	}
 
-	if (msg_verbose > 1) {
+	if (DLOG_ENABLED(DLOG_DIAG, DLOG_DEBUG)) {
 		int i;
 
 		for (i = 0; i < cl->cell_count; i++) {
@@ -426,10 +472,9 @@ void handle_gsm_l1_neighbor_cell_auxiliary_measurments(struct diag_packet *dp, u
 			uint8_t band = get_band_from_arfcn_and_band(ntohs(c[i].arfcn_and_band));
 
 			if (band == 8 || band == 9) {
-				printf("arfcn neighbor %u %d\n",
+				DLOG(DLOG_DIAG, DLOG_DEBUG, "arfcn neighbor %u %d\n",
 					get_arfcn_from_arfcn_and_band(ntohs(c[i].arfcn_and_band)),
-					c[i].rx_power
-				);
+					c[i].rx_power);
 			}
 		}
 	}
@@ -440,25 +485,22 @@ void handle_gsm_monitor_bursts_v2(struct diag_packet *dp, unsigned len)
 	struct gsm_monitor_bursts_v2 *cl = (struct gsm_monitor_bursts_v2 *)&dp->msg_type;
 
 	if (len-16-2 != sizeof(struct monitor_record)*cl->number_of_records + 4) {
-		if (msg_verbose > 1) {
-			printf("x gsm_monitor_bursts_v2 length incorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gsm_monitor_bursts_v2 length incorrect\n");
 		return;
 	}
 
-	if (msg_verbose > 1) {
+	if (DLOG_ENABLED(DLOG_DIAG, DLOG_DEBUG)) {
 		int i;
 
 		for (i = 0; i < cl->number_of_records; i++) {
 			struct monitor_record* c = cl->records + i;
 			uint8_t band = get_band_from_arfcn_and_band(ntohs(c[i].arfcn_and_band));
 			if (band == 8 || band == 9) {
-				printf("arfcn monitor %u %d %d %u\n",
+				DLOG(DLOG_DIAG, DLOG_DEBUG, "arfcn monitor %u %d %d %u\n",
 					get_arfcn_from_arfcn_and_band(ntohs(c[i].arfcn_and_band)),
 					c[i].rx_power,
 					c[i].frame_number,
-					get_fn(dp)
-				);
+					get_fn(dp));
 			}
 		}
 	}
@@ -471,56 +513,58 @@ void handle_gprs_grr_cell_reselection_measurements(struct diag_packet *dp, unsig
 	//printf("num %d len: %d, shoudl be %d\n", cl->neighboring_6_strongest_cells_count, len-16-2, sizeof(struct neighbor)*cl->neighboring_6_strongest_cells_count + 26);
 	//assert(len-16-2 == sizeof(struct neighbor)*cl->neighboring_6_strongest_cells_count + 26);
 	if (len-16-2 != sizeof(struct gprs_grr_cell_reselection_measurements)) {
-		if (msg_verbose > 1) {
-			printf("x gprs_grr_cell_reselection_measurements length incorrect\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gprs_grr_cell_reselection_measurements length incorrect\n");
 		return;
 	}
 
-	if (msg_verbose > 1) {
+	if (DLOG_ENABLED(DLOG_DIAG, DLOG_DEBUG)) {
 		int i;
 
-		printf("x gprs_grr_cell_reselection_measurements\n");
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "x gprs_grr_cell_reselection_measurements\n");
 
 		for (i = 0; i < cl->neighboring_6_strongest_cells_count; i++) {
 			struct neighbor* c = cl->neigbors + i;
-			printf("x -> neighbor %d -- BCC arfcn %u band: %u  PBCC arfcn %u band: %u rx_level_avg %u\n",
+			DLOG(DLOG_DIAG, DLOG_DEBUG, "x -> neighbor %d -- BCC arfcn %u band: %u  PBCC arfcn %u band: %u rx_level_avg %u\n",
 				i,
 				get_arfcn_from_arfcn_and_band(ntohs(c[i].neighbor_cell_bcch_arfcn_and_band)),
 				get_band_from_arfcn_and_band(ntohs(c[i].neighbor_cell_bcch_arfcn_and_band)),
 				get_arfcn_from_arfcn_and_band(ntohs(c[i].neighbor_cell_pbcch_arfcn_and_band)),
 				get_band_from_arfcn_and_band(ntohs(c[i].neighbor_cell_pbcch_arfcn_and_band)),
-				c[i].neighbor_cell_rx_level_average
-			);
+				c[i].neighbor_cell_rx_level_average);
 		}
 	}
 }
 
-void handle_sacch_report(struct diag_packet *dp, unsigned len)
+void handle_sacch_report(struct diag_ctx *ctx, struct diag_packet *dp, unsigned len)
 {
 	uint16_t b_arfcn = (uint16_t)(dp->msg_type) << 8 | dp->msg_subtype;
-	uint16_t old_arfcn = _s[0].arfcn;
+	uint16_t old_arfcn = ctx->s[0].arfcn;
 
-	_s[1].arfcn = _s[0].arfcn = get_arfcn_from_arfcn_and_band(b_arfcn);
+	ctx->s[1].arfcn = ctx->s[0].arfcn = get_arfcn_from_arfcn_and_band(b_arfcn);
 
-	if (old_arfcn != _s[0].arfcn) {
-		printf("SACCH report old=%d new=%d\n", old_arfcn, _s[0].arfcn);
+	if (old_arfcn != ctx->s[0].arfcn) {
+		/* the BA list belonged to the old serving cell */
+		arfcn_set_clear(&ctx->s[0].neigh_arfcns);
+		arfcn_set_clear(&ctx->s[1].neigh_arfcns);
+		DLOG(DLOG_DIAG, DLOG_NOTICE, "SACCH report old=%d new=%d\n", old_arfcn, ctx->s[0].arfcn);
+		callback_cell_update(&ctx->s[0]);
 	}
 }
 
-void handle_diag(uint8_t *msg, unsigned len)
+static void ctx_handle(struct diag_ctx *ctx, uint8_t *msg, unsigned len)
 {
 	struct diag_packet *dp = (struct diag_packet *) msg;
 	struct radio_message *m = NULL;
+	unsigned msg_len;
+	uint32_t nsec;
+	uint64_t t;
 
 	if (dp->msg_class != 0x0010) {
 		if (dp->msg_class == 0x001d && len > 9) {
-			_s[0].timestamp.tv_sec = get_epoch(&msg[3]);
-			_s[1].timestamp = _s[0].timestamp;
-		}
-		if (msg_verbose > 1) {
-			fprintf(stderr, "Class %04x is not supported\n", dp->msg_class);
+			ctx->s[0].timestamp.tv_sec = get_epoch(&msg[3]);
+			ctx->s[1].timestamp = ctx->s[0].timestamp;
 		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "Class %04x is not supported\n", dp->msg_class);
 		return;
 	}
 
@@ -528,27 +572,23 @@ void handle_diag(uint8_t *msg, unsigned len)
 	if (len < 16)
 		return;
 
-	now = get_epoch((uint8_t *) &dp->timestamp);
+	PROBE2(dispatch, dp->msg_protocol, len);
+
+	now = get_epoch_ns((uint8_t *) &dp->timestamp, &nsec);
 
 	switch(dp->msg_protocol) {
 	case 0x5071:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gsm_l1_surround_cell_ba_list\n");
-		}
-		handle_gsm_l1_surround_cell_ba_list(dp, len);
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gsm_l1_surround_cell_ba_list\n");
+		handle_gsm_l1_surround_cell_ba_list(ctx, dp, len);
 		break;
 
 	case 0x506C:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gsm_l1_burst_metrics\n");
-		}
-		handle_gsm_l1_burst_metrics(dp, len);
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gsm_l1_burst_metrics\n");
+		handle_gsm_l1_burst_metrics(ctx, dp, len);
 		break;
 
 	case 0x5076:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gsm_l1_txlev_timing_advance\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gsm_l1_txlev_timing_advance\n");
 		handle_gsm_l1_txlev_timing_advance(dp, len);
 		break;
 
@@ -558,60 +598,44 @@ void handle_diag(uint8_t *msg, unsigned len)
 		break;
 
 	case 0x507B:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gsm_l1_neighbor_cell_auxiliary_measurments\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gsm_l1_neighbor_cell_auxiliary_measurments\n");
 		handle_gsm_l1_neighbor_cell_auxiliary_measurments(dp,len);
 		break;
 
 	case 0x5082:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gsm_monitor_bursts_v2\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gsm_monitor_bursts_v2\n");
 		handle_gsm_monitor_bursts_v2(dp, len);
 		break;
 
 	case 0x513A:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_sacch_report\n");
-		}
-		handle_sacch_report(dp, len);
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_sacch_report\n");
+		handle_sacch_report(ctx, dp, len);
 		break;
 
 	case 0x51FC:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "handle_gprs_grr_cell_reselection_measurements\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "handle_gprs_grr_cell_reselection_measurements\n");
 		handle_gprs_grr_cell_reselection_measurements(dp, len);
 		break;
 
 	case 0x412f: // 3G RRC
-		if (msg_verbose > 1) {
-			fprintf(stderr, "-> Handling 3G\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "-> Handling 3G\n");
 		m = handle_3G(dp, len);
 		break;
 
 	case 0x512f: // GSM RR
-		if (msg_verbose > 1) {
-			fprintf(stderr, "Handling GSM RR\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "Handling GSM RR\n");
 		m = handle_bcch_and_rr(dp, len);
 		break;
 
 	case 0x5230: // GPRS GMM (doubled msg)
-		if (msg_verbose > 1) {
-			fprintf(stderr, "-> Not handling GPRS GMM\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "-> Not handling GPRS GMM\n");
 		/* downlink handling, UL goes through DTAP */
 		if (dp->msg_type == 0x01)
 			m = new_l3(dp->data + 1, dp->data_len, RAT_GSM, DOMAIN_PS, get_fn(dp), dp->msg_type, MSG_SDCCH);
 		break;
 
 	case 0x713a: // DTAP (2G, 3G)
-		if (msg_verbose > 1) {
-			fprintf(stderr, "-> Handling NAS\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "-> Handling NAS\n");
 		m = handle_nas(dp, len);
 		break;
 
@@ -624,9 +648,7 @@ void handle_diag(uint8_t *msg, unsigned len)
 	case 0xb0eb: // LTE NAS EMM UL (protected)
 	case 0xb0ec: // LTE NAS EMM DL
 	case 0xb0ed: // LTE NAS EMM UL
-		if (msg_verbose > 1) {
-			fprintf(stderr, "-> Handling 4G\n");
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "-> Handling 4G\n");
 		m = handle_4G(dp, len);
 		break;
 
@@ -634,37 +656,114 @@ void handle_diag(uint8_t *msg, unsigned len)
 		break;
 
 	default:
-		if (msg_verbose > 1) {
-			fprintf(stderr, "-> Handling default case\n");
-			print_common(dp, len);
-		}
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "-> Handling default case\n");
+		print_common(dp, len);
 		break;
 	}
 
 	if (m) {
 		/* Attach timestamp */
 		m->timestamp.tv_sec = now;
-		if (m->bb.fn[0] > last_burst.fn) {
+		m->ts_nsec = nsec;
+		m->log_code = dp->msg_protocol;
+		if (m->bb.fn[0] > ctx->last_burst.fn) {
 			struct radio_message *z;
 			/* Swap m */
 			z = m;
-			m = last_m;
-			last_m = z;
+			m = ctx->last_m;
+			ctx->last_m = z;
 		}
 	} else {
 		/* Deliver delayed message */
-		m = last_m;
-		last_m = NULL;
+		m = ctx->last_m;
+		ctx->last_m = NULL;
 	}
 
 	if (m) {
 		/* Attach ARFCN */
-		if (m->bb.fn[0] == last_burst.fn) {
+		if (m->bb.fn[0] == ctx->last_burst.fn) {
 			int i;
 			for (i = 0; i < 4; i++) {
-				m->bb.arfcn[i] = last_burst.arfcn[i];
+				m->bb.arfcn[i] = ctx->last_burst.arfcn[i];
 			}
 		}
-		handle_radio_msg(_s, m);
+		if (metrics_enabled && m->rat < 3)
+			metric_add(&metrics.messages[m->rat], 1);
+
+		/* m may be freed by the time decoding returns */
+		msg_len = m->msg_len;
+		t = latency_start();
+		handle_radio_msg(ctx->s, m);
+		latency_stop(LATENCY_DECODE, t, msg_len);
+	}
+}
+
+void diag_ctx_handle(struct diag_ctx *ctx, uint8_t *msg, unsigned len)
+{
+	uint64_t t = latency_start();
+
+	PROBE2(frame, len, msg);
+	trace_begin(TRACE_DIAG, len >= 16 && msg[0] == 0x10 ? msg[6] | (msg[7] << 8) : 0);
+	metrics_frame(msg, len);
+	ctx_handle(ctx, msg, len);
+	latency_stop(LATENCY_DIAG, t, len);
+	trace_end(TRACE_DIAG, 0);
+
+	if (metrics_enabled && ctx == &default_ctx) {
+		metric_set(&metrics.sessions_open,
+			   (ctx->s[0].started && !ctx->s[0].closed) +
+			   (ctx->s[1].started && !ctx->s[1].closed));
+	}
+}
+
+void handle_diag(uint8_t *msg, unsigned len)
+{
+	diag_ctx_handle(&default_ctx, msg, len);
+}
+
+/* Context with its own pair of sessions */
+struct diag_ctx_alloc {
+	struct diag_ctx ctx;
+	struct session_info s[2];
+};
+
+struct diag_ctx *diag_ctx_new()
+{
+	struct diag_ctx_alloc *ca;
+
+	ca = (struct diag_ctx_alloc *) calloc(1, sizeof(struct diag_ctx_alloc));
+	if (!ca) {
+		fprintf(stderr, "Cannot allocate parser context\n");
+		exit(1);
 	}
+
+	ca->ctx.s = ca->s;
+	session_pair_init(ca->s);
+
+	return &ca->ctx;
+}
+
+/* End of input: deliver the message still waiting for its burst and close the sessions */
+void diag_ctx_flush(struct diag_ctx *ctx)
+{
+	struct radio_message *m = ctx->last_m;
+
+	ctx->last_m = NULL;
+	if (m)
+		handle_radio_msg(ctx->s, m);
+
+	session_pair_destroy(ctx->s);
+	session_pair_init(ctx->s);
+}
+
+void diag_ctx_free(struct diag_ctx *ctx)
+{
+	if (!ctx || ctx == &default_ctx)
+		return;
+
+	session_pair_destroy(ctx->s);
+	/* not flushed, the message is dropped */
+	free(ctx->last_m);
+	free(ctx->hopping);
+	free(ctx);
 }
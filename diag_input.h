@@ -4,11 +4,33 @@
 #include <stdint.h>
 #include <stdio.h>
 
+struct session_info;
+struct radio_message;
+struct hopping_cache;
+
+struct burst_info {
+	uint32_t fn;
+	uint16_t arfcn[4];
+};
+
+/* Parser state of one DIAG input */
+struct diag_ctx {
+	struct session_info *s;		/* CS and PS session */
+	struct burst_info last_burst;	/* ARFCNs of the last burst metrics */
+	struct radio_message *last_m;	/* message waiting for its burst */
+	struct hopping_cache *hopping;	/* allocated on first use */
+};
+
 void diag_init(unsigned start_sid, unsigned start_cid, const char *gsmtap_target, const char *pcap_target, char *filename, uint32_t appid);
 void diag_set_log(FILE* file);
+uint16_t diag_crc16(const uint8_t *data, size_t len);
 void diag_set_filename(char *filename);
 void diag_set_appid(uint32_t appid);
 void handle_diag(uint8_t *msg, unsigned len);
+struct diag_ctx *diag_ctx_new();
+void diag_ctx_flush(struct diag_ctx *ctx);
+void diag_ctx_free(struct diag_ctx *ctx);
+void diag_ctx_handle(struct diag_ctx *ctx, uint8_t *msg, unsigned len);
 void diag_destroy();
 
 #endif
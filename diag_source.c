@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "diag_source.h"
+#include "diag_input.h"
+#include "session.h"
+#include "latency.h"
+
+/*
+ * Event driven input for live sources: modem ports, named pipes and
+ * stream sockets. All sources are non-blocking and served from a single
+ * epoll loop; every source deframes into its own parser context so the
+ * sessions of different devices do not mix.
+ */
+
+#define MAX_EVENTS	16
+
+static struct diag_source *sources = NULL;
+static int n_sources = 0;
+static int epfd = -1;
+static struct diag_source *current = NULL;	/* source being deframed */
+
+int diag_source_is_stream(const char *spec)
+{
+	struct stat st;
+
+	if (!strncmp(spec, "unix:", 5) || !strncmp(spec, "tcp:", 4))
+		return 1;
+
+	if (stat(spec, &st) < 0)
+		return 0;
+
+	return S_ISCHR(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+}
+
+static int set_raw_tty(int fd)
+{
+	struct termios tio;
+
+	if (tcgetattr(fd, &tio) < 0)
+		return -1;
+
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &tio) < 0)
+		return -1;
+
+	tcflush(fd, TCIOFLUSH);
+	return 0;
+}
+
+static int connect_unix(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int connect_tcp(const char *hostport)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1;
+
+	port = strrchr(hostport, ':');
+	if (!port || port == hostport || (size_t) (port - hostport) >= sizeof(host)) {
+		fprintf(stderr, "Expected tcp:<host>:<port>, got %s\n", hostport);
+		return -1;
+	}
+	snprintf(host, sizeof(host), "%.*s", (int) (port - hostport), hostport);
+	port++;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+/* Send the logging configuration through a duplicate stdio handle */
+static void source_init_device(struct diag_source *src)
+{
+	FILE *f;
+	int fd;
+
+	fd = dup(src->fd);
+	if (fd < 0 || !(f = fdopen(fd, "wb"))) {
+		if (fd >= 0)
+			close(fd);
+		fprintf(stderr, "Cannot initialize %s\n", src->name);
+		return;
+	}
+
+	diag_set_log(f);
+	fclose(f);
+}
+
+/*
+ * A named pipe ends when its last writer closes it, unless keep_open is
+ * set: then it is opened read-write, so the pipe survives writers coming
+ * and going and is served until the program is interrupted.
+ */
+int diag_source_open(const char *spec, int do_init, int keep_open)
+{
+	struct diag_source *src;
+	struct epoll_event ev;
+	struct stat st;
+
+	if (epfd < 0) {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0) {
+			perror("epoll_create1");
+			return -1;
+		}
+	}
+
+	src = (struct diag_source *) calloc(1, sizeof(struct diag_source));
+	if (!src)
+		return -1;
+	snprintf(src->name, sizeof(src->name), "%s", spec);
+
+	if (!strncmp(spec, "unix:", 5)) {
+		src->type = DIAG_SOURCE_UNIX;
+		src->fd = connect_unix(&spec[5]);
+	} else if (!strncmp(spec, "tcp:", 4)) {
+		src->type = DIAG_SOURCE_TCP;
+		src->fd = connect_tcp(&spec[4]);
+	} else if (stat(spec, &st) == 0 && S_ISFIFO(st.st_mode)) {
+		src->type = DIAG_SOURCE_FIFO;
+		src->fd = open(spec, (keep_open ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	} else if (stat(spec, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		src->type = DIAG_SOURCE_UNIX;
+		src->fd = connect_unix(spec);
+	} else {
+		src->type = DIAG_SOURCE_TTY;
+		src->fd = open(spec, O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (src->fd >= 0 && isatty(src->fd) && set_raw_tty(src->fd) < 0) {
+			fprintf(stderr, "Cannot set raw mode on %s\n", spec);
+		}
+	}
+
+	if (src->fd < 0) {
+		fprintf(stderr, "Cannot open input %s: %s\n", spec, strerror(errno));
+		free(src);
+		return -1;
+	}
+
+	if (do_init && src->type != DIAG_SOURCE_FIFO)
+		source_init_device(src);
+
+	fcntl(src->fd, F_SETFL, fcntl(src->fd, F_GETFL) | O_NONBLOCK);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = src;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+		perror("epoll_ctl");
+		close(src->fd);
+		free(src);
+		return -1;
+	}
+
+	src->ctx = diag_ctx_new();
+	hdlc_deframer_init(&src->d, 0);
+
+	src->next = sources;
+	sources = src;
+	n_sources++;
+
+	if (msg_verbose) {
+		fprintf(stderr, "Reading %s\n", src->name);
+	}
+
+	return 0;
+}
+
+static void source_close(struct diag_source *src)
+{
+	struct diag_source **p;
+
+	for (p = &sources; *p; p = &(*p)->next) {
+		if (*p == src) {
+			*p = src->next;
+			break;
+		}
+	}
+	n_sources--;
+
+	if (msg_verbose) {
+		fprintf(stderr, "Closing %s\n", src->name);
+	}
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+	close(src->fd);
+	/* deliver the message still waiting for its burst */
+	diag_ctx_flush(src->ctx);
+	diag_ctx_free(src->ctx);
+	free(src);
+}
+
+static void source_frame(uint8_t *msg, unsigned len)
+{
+	diag_ctx_handle(current->ctx, msg, len);
+}
+
+/*
+ * Read one buffer, the rest waits for the next round of the loop so that
+ * a busy source cannot starve the others. Returns 0 once the source is gone.
+ */
+static int source_read(struct diag_source *src, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	ssize_t rc;
+
+	rc = read(src->fd, src->buf, sizeof(src->buf));
+	if (rc > 0) {
+		current = src;
+		diag_hdlc_feed(&src->d, src->buf, rc, filter, cb ? cb : source_frame);
+		current = NULL;
+		return 1;
+	}
+	if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return 1;
+	if (rc < 0)
+		fprintf(stderr, "Read error on %s: %s\n", src->name, strerror(errno));
+	return 0;
+}
+
+/*
+ * Serve all sources until they are closed or *stop is set. With a frame
+ * callback the frames go there, otherwise to the source's own context.
+ */
+void diag_source_run(volatile sig_atomic_t *stop, const struct diag_filter *filter, diag_frame_cb cb)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct diag_source *src;
+	int i, n;
+
+	if (filter && !diag_filter_active(filter))
+		filter = NULL;
+
+	while (n_sources > 0 && !*stop) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, latency_enabled ? LATENCY_POLL_MS : -1);
+		latency_poll();
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			src = (struct diag_source *) events[i].data.ptr;
+			if (!source_read(src, filter, cb))
+				source_close(src);
+		}
+	}
+}
+
+void diag_source_close_all()
+{
+	while (sources)
+		source_close(sources);
+
+	if (epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef DIAG_SOURCE_H
+#define DIAG_SOURCE_H
+
+#include <signal.h>
+
+#include "diag_format.h"
+#include "diag_index.h"
+
+#define DIAG_SOURCE_BUF	65536
+
+enum diag_source_type {
+	DIAG_SOURCE_TTY,	/* modem DIAG port */
+	DIAG_SOURCE_FIFO,	/* named pipe */
+	DIAG_SOURCE_UNIX,	/* unix:<path>, e.g. diag-router */
+	DIAG_SOURCE_TCP,	/* tcp:<host>:<port>, e.g. adb forward */
+};
+
+struct diag_ctx;
+
+/* A live DIAG input with its own deframer and parser context */
+struct diag_source {
+	int fd;
+	enum diag_source_type type;
+	char name[FILENAME_MAX];
+	struct diag_ctx *ctx;
+	struct hdlc_deframer d;
+	uint8_t buf[DIAG_SOURCE_BUF];
+	struct diag_source *next;
+};
+
+int diag_source_is_stream(const char *spec);
+int diag_source_open(const char *spec, int do_init, int keep_open);
+void diag_source_run(volatile sig_atomic_t *stop, const struct diag_filter *filter, diag_frame_cb cb);
+void diag_source_close_all();
+
+#endif
@@ -0,0 +1,116 @@
+#include "diag_stats.h"
+#include "diag_index.h"
+
+/*
+ * Count-only scan: histograms over the DIAG header fields of each frame,
+ * without running the message handlers.
+ */
+
+#define STATS_RAT_NUM	7
+
+static const char *rat_names[STATS_RAT_NUM] = {
+	"other", "CDMA", "WCDMA", "GSM", "UMTS NAS", "LTE", "NR",
+};
+
+static struct {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t classes[256];		/* frames by command code */
+	uint64_t codes[65536];		/* log packets by log code */
+	uint64_t code_bytes[65536];
+	uint64_t rats[STATS_RAT_NUM];
+	uint32_t first;			/* UNIX time range of log packets */
+	uint32_t last;
+	uint64_t no_time;		/* log packets without a usable time */
+} stats;
+
+/*
+ * RAT of a log code, by its equipment ID nibble. LTE and NR share 0xB:
+ * LTE is 0xB0xx-0xB1xx, NR5G 0xB8xx-0xB9xx.
+ */
+static unsigned code_rat(uint16_t code)
+{
+	switch (code >> 12) {
+	case 0x1:
+		return 1;
+	case 0x4:
+		return 2;
+	case 0x5:
+		return 3;
+	case 0x7:
+		return 4;
+	case 0xb:
+		if (code < 0xb200)
+			return 5;
+		if (code >= 0xb800 && code < 0xba00)
+			return 6;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+void diag_stats_frame(uint8_t *msg, unsigned len)
+{
+	uint16_t code;
+	uint32_t epoch;
+
+	stats.frames++;
+	stats.bytes += len;
+	stats.classes[msg[0]]++;
+
+	/* log packets only */
+	if (len < 16 || msg[0] != 0x10 || msg[1] != 0x00)
+		return;
+
+	code = msg[6] | (msg[7] << 8);
+	stats.codes[code]++;
+	stats.code_bytes[code] += len;
+	stats.rats[code_rat(code)]++;
+
+	epoch = diag_frame_epoch(&msg[8]);
+	if (!epoch) {
+		stats.no_time++;
+		return;
+	}
+	if (!stats.first || epoch < stats.first)
+		stats.first = epoch;
+	if (epoch > stats.last)
+		stats.last = epoch;
+}
+
+void diag_stats_print(FILE *out)
+{
+	unsigned i;
+
+	fprintf(out, "frames %llu bytes %llu\n",
+		(unsigned long long) stats.frames, (unsigned long long) stats.bytes);
+
+	if (stats.first) {
+		fprintf(out, "time %u - %u (%u s)\n", stats.first, stats.last, stats.last - stats.first);
+	}
+	if (stats.no_time) {
+		fprintf(out, "log packets without time %llu\n", (unsigned long long) stats.no_time);
+	}
+
+	fprintf(out, "\nclass      frames\n");
+	for (i = 0; i < 256; i++) {
+		if (stats.classes[i])
+			fprintf(out, "0x%02x %12llu\n", i, (unsigned long long) stats.classes[i]);
+	}
+
+	fprintf(out, "\nrat        frames\n");
+	for (i = 0; i < STATS_RAT_NUM; i++) {
+		if (stats.rats[i])
+			fprintf(out, "%-8s %12llu\n", rat_names[i], (unsigned long long) stats.rats[i]);
+	}
+
+	fprintf(out, "\ncode     frames        bytes  rat\n");
+	for (i = 0; i < 65536; i++) {
+		if (stats.codes[i])
+			fprintf(out, "0x%04x %8llu %12llu  %s\n", i,
+				(unsigned long long) stats.codes[i],
+				(unsigned long long) stats.code_bytes[i],
+				rat_names[code_rat(i)]);
+	}
+}
@@ -0,0 +1,10 @@
+#ifndef DIAG_STATS_H
+#define DIAG_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+void diag_stats_frame(uint8_t *msg, unsigned len);
+void diag_stats_print(FILE *out);
+
+#endif
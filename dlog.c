@@ -0,0 +1,601 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dlog.h"
+
+/*
+ * Every thread that logs gets its own single producer ring. A record
+ * holds the format pointer, the arguments as struct dlog_arg and the
+ * bytes of string and hex arguments behind them. The producer publishes
+ * head with release semantics once a record is complete, the logger
+ * publishes tail the same way once it has formatted it. Records never
+ * wrap: the rest of the ring is filled with a pad record instead.
+ *
+ * A global sequence number taken when the line is logged lets the logger
+ * merge the rings back into call order.
+ *
+ * An idle logger sets sleeping and waits on a condition variable. Both
+ * sides store first and load second with full fences in between, so
+ * either the producer sees the flag and wakes the logger, or the logger
+ * sees the new record before it goes to sleep. A producer waiting for
+ * space for a stdout line does the same with waiting and the tail.
+ */
+
+#define REC_ALIGN	8
+#define REC_PAD		0xff
+#define REC_MAX		(sizeof(struct dlog_rec) + DLOG_MAX_ARGS * (sizeof(struct dlog_arg) + DLOG_HEX_MAX) + REC_ALIGN)
+#define LINE_LEN	4096
+
+struct dlog_rec {
+	uint32_t len;		/* bytes including this header, a multiple of REC_ALIGN */
+	uint8_t module;		/* REC_PAD up to the end of the ring */
+	uint8_t level;
+	uint8_t n_args;
+	uint8_t reserved;
+	uint64_t seq;
+	const char *fmt;
+	struct dlog_arg args[];
+};
+
+struct dlog_out {
+	FILE *stream;
+	unsigned len;
+	char buf[64 << 10];
+};
+
+struct dlog_ring {
+	uint8_t *buf;
+	uint64_t head;
+	uint64_t tail;
+	unsigned long dropped;
+	struct dlog_ring *next;
+};
+
+static const char *module_names[DLOG_MODULES] = {
+	[DLOG_DIAG] = "diag",
+	[DLOG_L3] = "l3",
+	[DLOG_SESSION] = "session",
+};
+
+uint8_t dlog_levels[DLOG_MODULES];
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;	/* protects the ring list */
+	struct dlog_ring *rings;
+	uint64_t seq;
+	int running;
+	int sleeping;		/* the logger waits for wake */
+	int waiting;		/* producers waiting for space */
+	pthread_mutex_t wake_lock;
+	pthread_cond_t wake;
+	pthread_cond_t space;
+	struct dlog_out out[2];	/* INFO to stdout, the rest to stderr */
+	unsigned long dropped;	/* all lines dropped so far */
+} lg = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread struct dlog_ring *own_ring;
+
+static unsigned arg_bytes(const struct dlog_arg *a)
+{
+	switch (a->type) {
+	case DLOG_ARG_STR:
+		return strnlen(a->v.p ? a->v.p : "(null)", DLOG_STR_MAX);
+	case DLOG_ARG_HEX:
+		return a->len < DLOG_HEX_MAX ? a->len : DLOG_HEX_MAX;
+	default:
+		return 0;
+	}
+}
+
+static unsigned rec_size(const struct dlog_arg *args, unsigned n_args)
+{
+	unsigned i, len;
+
+	len = sizeof(struct dlog_rec) + n_args * sizeof(struct dlog_arg);
+	for (i = 0; i < n_args; i++)
+		len += arg_bytes(&args[i]);
+
+	return (len + REC_ALIGN - 1) & ~(REC_ALIGN - 1);
+}
+
+static void rec_fill(struct dlog_rec *rec, unsigned len, unsigned module, unsigned level,
+		     const char *fmt, const struct dlog_arg *args, unsigned n_args)
+{
+	uint8_t *data = (uint8_t *) &rec->args[n_args];
+	unsigned i;
+
+	rec->len = len;
+	rec->module = module;
+	rec->level = level;
+	rec->n_args = n_args;
+	rec->seq = __atomic_fetch_add(&lg.seq, 1, __ATOMIC_RELAXED);
+	rec->fmt = fmt;
+
+	for (i = 0; i < n_args; i++) {
+		rec->args[i] = args[i];
+		if (args[i].type == DLOG_ARG_STR || args[i].type == DLOG_ARG_HEX) {
+			rec->args[i].len = arg_bytes(&args[i]);
+			memcpy(data, args[i].v.p ? args[i].v.p : "(null)", rec->args[i].len);
+			data += rec->args[i].len;
+		}
+	}
+}
+
+/* Append to line, never past its end */
+static void put(char *line, unsigned *pos, const char *spec, ...)
+{
+	va_list ap;
+	int n;
+
+	if (*pos >= LINE_LEN - 1)
+		return;
+
+	va_start(ap, spec);
+	n = vsnprintf(line + *pos, LINE_LEN - *pos, spec, ap);
+	va_end(ap);
+
+	if (n > 0)
+		*pos = *pos + n < LINE_LEN - 1 ? *pos + n : LINE_LEN - 1;
+}
+
+static int64_t arg_int(const struct dlog_arg *a)
+{
+	return a->type == DLOG_ARG_DOUBLE ? (int64_t) a->v.d : a->v.i;
+}
+
+/*
+ * Format with the C library one conversion at a time. Length modifiers
+ * of the format are replaced by the type the argument was stored as,
+ * then the value is truncated as printf would have done with the
+ * original type, so the output matches a direct printf.
+ */
+static unsigned rec_format(const struct dlog_rec *rec, char *line)
+{
+	static const char hex[] = "0123456789abcdef";
+	const uint8_t *data = (const uint8_t *) &rec->args[rec->n_args];
+	char spec[64], str[2 * DLOG_HEX_MAX + 1];
+	const struct dlog_arg *a;
+	const char *f = rec->fmt;
+	unsigned pos = 0, n = 0, s, bits, i;
+	uint64_t u;
+
+	while (*f) {
+		if (*f != '%') {
+			if (pos < LINE_LEN - 1)
+				line[pos++] = *f;
+			f++;
+			continue;
+		}
+		if (f[1] == '%') {
+			put(line, &pos, "%%");
+			f += 2;
+			continue;
+		}
+
+		/* flags, width and precision, '*' taken from the arguments */
+		spec[0] = '%';
+		s = 1;
+		for (f++; *f && strchr("-+ #0'", *f); f++)
+			if (s < 8)
+				spec[s++] = *f;
+		if (*f == '*') {
+			s += snprintf(spec + s, 16, "%d", n < rec->n_args ? (int) arg_int(&rec->args[n++]) : 0);
+			f++;
+		}
+		while (*f >= '0' && *f <= '9' && s < 24)
+			spec[s++] = *f++;
+		if (*f == '.') {
+			spec[s++] = *f++;
+			if (*f == '*') {
+				s += snprintf(spec + s, 16, "%d", n < rec->n_args ? (int) arg_int(&rec->args[n++]) : 0);
+				f++;
+			}
+			while (*f >= '0' && *f <= '9' && s < 48)
+				spec[s++] = *f++;
+		}
+		bits = 64;
+		for (; *f && strchr("hlLqjzt", *f); f++)
+			if (*f == 'h')
+				bits = bits == 16 ? 8 : 16;
+		if (!*f)
+			break;
+
+		if (n >= rec->n_args) {
+			put(line, &pos, "(missing)");
+			f++;
+			continue;
+		}
+		a = &rec->args[n++];
+		if (bits == 64 && (a->type == DLOG_ARG_I32 || a->type == DLOG_ARG_U32))
+			bits = 32;
+
+		switch (*f) {
+		case 'd':
+		case 'i':
+			strcpy(spec + s, "lld");
+			u = (uint64_t) arg_int(a) << (64 - bits);
+			put(line, &pos, spec, (long long) ((int64_t) u >> (64 - bits)));
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec[s] = 'l';
+			spec[s + 1] = 'l';
+			spec[s + 2] = *f;
+			spec[s + 3] = 0;
+			u = (uint64_t) arg_int(a);
+			if (bits < 64)
+				u &= (1ULL << bits) - 1;
+			put(line, &pos, spec, (unsigned long long) u);
+			break;
+		case 'c':
+			strcpy(spec + s, "c");
+			put(line, &pos, spec, (int) arg_int(a));
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			spec[s] = *f;
+			spec[s + 1] = 0;
+			if (a->type == DLOG_ARG_DOUBLE)
+				put(line, &pos, spec, a->v.d);
+			else if (a->type == DLOG_ARG_U32 || a->type == DLOG_ARG_U64)
+				put(line, &pos, spec, (double) a->v.u);
+			else
+				put(line, &pos, spec, (double) a->v.i);
+			break;
+		case 's':
+			strcpy(spec + s, "s");
+			if (a->type == DLOG_ARG_STR) {
+				memcpy(str, data, a->len);
+				str[a->len] = 0;
+			} else if (a->type == DLOG_ARG_HEX) {
+				for (i = 0; i < a->len; i++) {
+					str[2 * i] = hex[data[i] >> 4];
+					str[2 * i + 1] = hex[data[i] & 0xf];
+				}
+				str[2 * a->len] = 0;
+			} else {
+				strcpy(str, "(?)");
+			}
+			put(line, &pos, spec, str);
+			break;
+		case 'p':
+			strcpy(spec + s, "p");
+			put(line, &pos, spec, a->v.p);
+			break;
+		default:
+			break;
+		}
+		if (a->type == DLOG_ARG_STR || a->type == DLOG_ARG_HEX)
+			data += a->len;
+		f++;
+	}
+
+	return pos;
+}
+
+static FILE *rec_stream(const struct dlog_rec *rec)
+{
+	return rec->level <= DLOG_INFO ? stdout : stderr;
+}
+
+/* The logger collects lines per stream, stderr is not buffered */
+static void out_flush(struct dlog_out *o)
+{
+	if (o->len)
+		fwrite(o->buf, 1, o->len, o->stream);
+	o->len = 0;
+}
+
+static void out_rec(const struct dlog_rec *rec)
+{
+	struct dlog_out *o = rec->level <= DLOG_INFO ? &lg.out[0] : &lg.out[1];
+
+	if (o->len + LINE_LEN > sizeof(o->buf))
+		out_flush(o);
+	o->len += rec_format(rec, o->buf + o->len);
+}
+
+static void logger_wake()
+{
+	pthread_mutex_lock(&lg.wake_lock);
+	__atomic_store_n(&lg.sleeping, 0, __ATOMIC_RELAXED);
+	pthread_cond_signal(&lg.wake);
+	pthread_mutex_unlock(&lg.wake_lock);
+}
+
+/* Format in the calling thread, without a logger */
+static void push_direct(unsigned len, unsigned module, unsigned level, const char *fmt,
+			const struct dlog_arg *args, unsigned n_args)
+{
+	uint64_t buf[REC_MAX / sizeof(uint64_t)];
+	struct dlog_rec *rec = (struct dlog_rec *) buf;
+	char line[LINE_LEN];
+
+	rec_fill(rec, len, module, level, fmt, args, n_args);
+	fwrite(line, 1, rec_format(rec, line), rec_stream(rec));
+}
+
+/* Ring space for len bytes after pad, given the tail */
+static int ring_fits(const struct dlog_ring *r, uint64_t pad, unsigned len)
+{
+	return r->head + pad + len - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) <= DLOG_RING_SIZE;
+}
+
+/* Wait until the logger made room, 0 if it stopped meanwhile */
+static int ring_wait(struct dlog_ring *r, uint64_t pad, unsigned len)
+{
+	int running;
+
+	logger_wake();
+
+	pthread_mutex_lock(&lg.wake_lock);
+	__atomic_fetch_add(&lg.waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while ((running = __atomic_load_n(&lg.running, __ATOMIC_ACQUIRE)) && !ring_fits(r, pad, len))
+		pthread_cond_wait(&lg.space, &lg.wake_lock);
+	__atomic_fetch_sub(&lg.waiting, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lg.wake_lock);
+
+	return running;
+}
+
+/* Let producers waiting for space look at their ring again */
+static void space_wake()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&lg.waiting, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&lg.wake_lock);
+	pthread_cond_broadcast(&lg.space);
+	pthread_mutex_unlock(&lg.wake_lock);
+}
+
+void dlog_push(unsigned module, unsigned level, const char *fmt, const struct dlog_arg *args, unsigned n_args)
+{
+	struct dlog_ring *r = own_ring;
+	struct dlog_rec *rec;
+	uint64_t pad;
+	unsigned len;
+
+	len = rec_size(args, n_args);
+
+	if (!__atomic_load_n(&lg.running, __ATOMIC_ACQUIRE)) {
+		push_direct(len, module, level, fmt, args, n_args);
+		return;
+	}
+
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r || !(r->buf = malloc(DLOG_RING_SIZE))) {
+			free(r);
+			return;
+		}
+		pthread_mutex_lock(&lg.lock);
+		r->next = lg.rings;
+		lg.rings = r;
+		pthread_mutex_unlock(&lg.lock);
+		own_ring = r;
+	}
+
+	pad = DLOG_RING_SIZE - (r->head & (DLOG_RING_SIZE - 1));
+	if (pad >= len)
+		pad = 0;
+	if (!ring_fits(r, pad, len)) {
+		/* stdout is the output of the program, only diagnostics are dropped */
+		if (level > DLOG_INFO) {
+			__atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if (!ring_wait(r, pad, len)) {
+			push_direct(len, module, level, fmt, args, n_args);
+			return;
+		}
+	}
+
+	if (pad) {
+		rec = (struct dlog_rec *) &r->buf[r->head & (DLOG_RING_SIZE - 1)];
+		rec->len = pad;
+		rec->module = REC_PAD;
+	}
+	rec = (struct dlog_rec *) &r->buf[(r->head + pad) & (DLOG_RING_SIZE - 1)];
+	rec_fill(rec, len, module, level, fmt, args, n_args);
+
+	__atomic_store_n(&r->head, r->head + pad + len, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&lg.sleeping, __ATOMIC_RELAXED))
+		logger_wake();
+}
+
+/* Oldest record of a ring, pad records skipped */
+static struct dlog_rec *ring_peek(struct dlog_ring *r)
+{
+	struct dlog_rec *rec;
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	while (r->tail != head) {
+		rec = (struct dlog_rec *) &r->buf[r->tail & (DLOG_RING_SIZE - 1)];
+		if (rec->module != REC_PAD)
+			return rec;
+		__atomic_store_n(&r->tail, r->tail + rec->len, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/* Write out everything queued in call order, returns the lines written */
+static unsigned drain()
+{
+	struct dlog_ring *r, *min_r;
+	struct dlog_rec *rec, *min_rec;
+	unsigned long dropped = 0;
+	unsigned count = 0;
+
+	pthread_mutex_lock(&lg.lock);
+	for (;;) {
+		min_r = NULL;
+		min_rec = NULL;
+		for (r = lg.rings; r; r = r->next) {
+			rec = ring_peek(r);
+			if (rec && (!min_rec || rec->seq < min_rec->seq)) {
+				min_r = r;
+				min_rec = rec;
+			}
+		}
+		if (!min_rec)
+			break;
+
+		out_rec(min_rec);
+		__atomic_store_n(&min_r->tail, min_r->tail + min_rec->len, __ATOMIC_RELEASE);
+		count++;
+	}
+	for (r = lg.rings; r; r = r->next)
+		dropped += __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lg.lock);
+	if (count)
+		space_wake();
+
+	out_flush(&lg.out[0]);
+	out_flush(&lg.out[1]);
+	if (dropped) {
+		__atomic_fetch_add(&lg.dropped, dropped, __ATOMIC_RELAXED);
+		fprintf(stderr, "Log buffer full, %lu lines dropped\n", dropped);
+	}
+	if (count || dropped) {
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	return count;
+}
+
+/* Any record queued that drain() has not seen yet */
+static int pending()
+{
+	struct dlog_ring *r;
+	int ret = 0;
+
+	pthread_mutex_lock(&lg.lock);
+	for (r = lg.rings; r && !ret; r = r->next)
+		ret = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail;
+	pthread_mutex_unlock(&lg.lock);
+
+	return ret;
+}
+
+static void *logger_thread(void *arg)
+{
+	while (__atomic_load_n(&lg.running, __ATOMIC_ACQUIRE)) {
+		if (drain())
+			continue;
+
+		pthread_mutex_lock(&lg.wake_lock);
+		__atomic_store_n(&lg.sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (pending())
+			__atomic_store_n(&lg.sleeping, 0, __ATOMIC_RELAXED);
+		while (__atomic_load_n(&lg.sleeping, __ATOMIC_RELAXED) &&
+		       __atomic_load_n(&lg.running, __ATOMIC_ACQUIRE))
+			pthread_cond_wait(&lg.wake, &lg.wake_lock);
+		pthread_mutex_unlock(&lg.wake_lock);
+	}
+	drain();
+
+	return NULL;
+}
+
+unsigned long dlog_dropped()
+{
+	return __atomic_load_n(&lg.dropped, __ATOMIC_RELAXED);
+}
+
+void dlog_init(unsigned level)
+{
+	unsigned i;
+
+	for (i = 0; i < DLOG_MODULES; i++)
+		dlog_levels[i] = level;
+}
+
+int dlog_set_levels(const char *spec)
+{
+	char *copy, *tok, *save, *eq;
+	unsigned i, level;
+	int ret = 0;
+
+	copy = strdup(spec);
+	if (!copy)
+		return -1;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		eq = strchr(tok, '=');
+		level = strtoul(eq ? eq + 1 : tok, NULL, 0);
+		if (!eq) {
+			dlog_init(level);
+			continue;
+		}
+		*eq = 0;
+		for (i = 0; i < DLOG_MODULES; i++) {
+			if (!strcmp(tok, module_names[i]))
+				break;
+		}
+		if (i == DLOG_MODULES) {
+			fprintf(stderr, "Unknown log module %s\n", tok);
+			ret = -1;
+			break;
+		}
+		dlog_levels[i] = level;
+	}
+
+	free(copy);
+	return ret;
+}
+
+int dlog_start()
+{
+	lg.out[0].stream = stdout;
+	lg.out[1].stream = stderr;
+	__atomic_store_n(&lg.running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&lg.thread, NULL, logger_thread, NULL)) {
+		fprintf(stderr, "Cannot start logger thread\n");
+		lg.running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void dlog_stop()
+{
+	if (!__atomic_load_n(&lg.running, __ATOMIC_ACQUIRE))
+		return;
+
+	/* rings stay registered, their threads may log again after a restart */
+	__atomic_store_n(&lg.running, 0, __ATOMIC_RELEASE);
+	logger_wake();
+	pthread_join(lg.thread, NULL);
+
+	/* producers still waiting for space format their line themselves */
+	pthread_mutex_lock(&lg.wake_lock);
+	pthread_cond_broadcast(&lg.space);
+	pthread_mutex_unlock(&lg.wake_lock);
+}
@@ -0,0 +1,147 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+
+/*
+ * Asynchronous logging. DLOG() stores the format pointer and the raw
+ * arguments in a ring buffer of the calling thread; a logger thread
+ * merges the rings of all threads in call order and does the formatting.
+ * The caller takes no lock and makes no system call, except to wake an
+ * idle logger. If its ring is full, a NOTICE or INFO line waits for the
+ * logger, so a slow stdout holds the caller back as printf would; DEBUG
+ * and TRACE lines are dropped and counted instead.
+ * Without a running logger thread lines are formatted by the caller.
+ *
+ * Levels follow the -v count: NOTICE lines are always logged, INFO is
+ * the decoded message listing, both go to stdout. DEBUG and TRACE are
+ * diagnostics and go to stderr.
+ * Each module has its own level. Lines above DLOG_LEVEL_MAX are removed
+ * at compile time, e.g. with CFLAGS=-DDLOG_LEVEL_MAX=DLOG_INFO.
+ *
+ * The format must be a string literal with at most DLOG_MAX_ARGS
+ * arguments: integers, doubles, strings (copied when the line is logged)
+ * and pointers. DLOG_HEX(data, len) copies len bytes that are printed
+ * as hex by a %s conversion.
+ */
+
+enum dlog_module {
+	DLOG_DIAG,	/* "diag": DIAG packet handling */
+	DLOG_L3,	/* "l3": layer 3 decoding */
+	DLOG_SESSION,	/* "session": session tracking */
+	DLOG_MODULES
+};
+
+#define DLOG_NOTICE	0
+#define DLOG_INFO	1
+#define DLOG_DEBUG	2
+#define DLOG_TRACE	3
+
+#ifndef DLOG_LEVEL_MAX
+#define DLOG_LEVEL_MAX	DLOG_TRACE
+#endif
+
+#define DLOG_MAX_ARGS	8
+#define DLOG_STR_MAX	256		/* bytes kept of a string argument */
+#define DLOG_HEX_MAX	512		/* bytes kept of a DLOG_HEX argument */
+#define DLOG_RING_SIZE	(1 << 20)	/* ring bytes per thread, a power of two */
+
+enum dlog_arg_type {
+	DLOG_ARG_I32,
+	DLOG_ARG_I64,
+	DLOG_ARG_U32,
+	DLOG_ARG_U64,
+	DLOG_ARG_DOUBLE,
+	DLOG_ARG_STR,
+	DLOG_ARG_HEX,
+	DLOG_ARG_PTR,
+};
+
+struct dlog_hex {
+	const void *data;
+	unsigned len;
+};
+
+struct dlog_arg {
+	uint32_t type;		/* DLOG_ARG_* */
+	uint32_t len;		/* bytes of a string or hex argument */
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		const void *p;
+	} v;
+};
+
+extern uint8_t dlog_levels[DLOG_MODULES];
+
+#define DLOG_HEX(data, len) ((struct dlog_hex) { (data), (len) })
+
+static inline struct dlog_arg dlog_arg_i32(int32_t x) { struct dlog_arg a = { DLOG_ARG_I32 }; a.v.i = x; return a; }
+static inline struct dlog_arg dlog_arg_i64(int64_t x) { struct dlog_arg a = { DLOG_ARG_I64 }; a.v.i = x; return a; }
+static inline struct dlog_arg dlog_arg_u32(uint32_t x) { struct dlog_arg a = { DLOG_ARG_U32 }; a.v.u = x; return a; }
+static inline struct dlog_arg dlog_arg_u64(uint64_t x) { struct dlog_arg a = { DLOG_ARG_U64 }; a.v.u = x; return a; }
+static inline struct dlog_arg dlog_arg_double(double x) { struct dlog_arg a = { DLOG_ARG_DOUBLE }; a.v.d = x; return a; }
+static inline struct dlog_arg dlog_arg_str(const char *x) { struct dlog_arg a = { DLOG_ARG_STR }; a.v.p = x; return a; }
+static inline struct dlog_arg dlog_arg_hex(struct dlog_hex x) { struct dlog_arg a = { DLOG_ARG_HEX, x.len }; a.v.p = x.data; return a; }
+static inline struct dlog_arg dlog_arg_ptr(const void *x) { struct dlog_arg a = { DLOG_ARG_PTR }; a.v.p = x; return a; }
+
+#define DLOG_ARG(x) _Generic((x), \
+	char: dlog_arg_i32, \
+	signed char: dlog_arg_i32, \
+	short: dlog_arg_i32, \
+	int: dlog_arg_i32, \
+	long: dlog_arg_i64, \
+	long long: dlog_arg_i64, \
+	unsigned char: dlog_arg_u32, \
+	unsigned short: dlog_arg_u32, \
+	unsigned int: dlog_arg_u32, \
+	unsigned long: dlog_arg_u64, \
+	unsigned long long: dlog_arg_u64, \
+	float: dlog_arg_double, \
+	double: dlog_arg_double, \
+	char *: dlog_arg_str, \
+	const char *: dlog_arg_str, \
+	struct dlog_hex: dlog_arg_hex, \
+	default: dlog_arg_ptr)(x)
+
+#define DLOG_ARGS0(...)
+#define DLOG_ARGS1(a) DLOG_ARG(a)
+#define DLOG_ARGS2(a, ...) DLOG_ARG(a), DLOG_ARGS1(__VA_ARGS__)
+#define DLOG_ARGS3(a, ...) DLOG_ARG(a), DLOG_ARGS2(__VA_ARGS__)
+#define DLOG_ARGS4(a, ...) DLOG_ARG(a), DLOG_ARGS3(__VA_ARGS__)
+#define DLOG_ARGS5(a, ...) DLOG_ARG(a), DLOG_ARGS4(__VA_ARGS__)
+#define DLOG_ARGS6(a, ...) DLOG_ARG(a), DLOG_ARGS5(__VA_ARGS__)
+#define DLOG_ARGS7(a, ...) DLOG_ARG(a), DLOG_ARGS6(__VA_ARGS__)
+#define DLOG_ARGS8(a, ...) DLOG_ARG(a), DLOG_ARGS7(__VA_ARGS__)
+#define DLOG_NARGS(...) DLOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a ## b
+
+#define DLOG_ENABLED(module, level) \
+	((level) <= DLOG_LEVEL_MAX && dlog_levels[module] >= (level))
+
+#define DLOG(module, level, fmt, ...) do { \
+	if (DLOG_ENABLED(module, level)) { \
+		const struct dlog_arg _dlog_args[] = { DLOG_CAT(DLOG_ARGS, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__) }; \
+		dlog_push(module, level, "" fmt, _dlog_args, sizeof(_dlog_args) / sizeof(_dlog_args[0])); \
+	} \
+} while (0)
+
+void dlog_push(unsigned module, unsigned level, const char *fmt, const struct dlog_arg *args, unsigned n_args);
+
+/* All modules to level */
+void dlog_init(unsigned level);
+
+/* "module=level[,...]" or a level for all modules, -1 if malformed */
+int dlog_set_levels(const char *spec);
+
+/* Lines dropped because a ring was full */
+unsigned long dlog_dropped();
+
+/* Start and stop the logger thread, stopping writes out what is queued */
+int dlog_start();
+void dlog_stop();
+
+#endif
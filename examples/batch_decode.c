@@ -0,0 +1,113 @@
+/*
+ * Decode many capture files in one process through the embedding API of
+ * libmetagsm, one context per file, and report the time per file. Used
+ * by examples/bench_batch.sh to compare against one diag_parser process
+ * per file:
+ *
+ *	make bench-batch CAPTURES="a.qmdl b.qmdl ..."
+ *
+ * Only metagsm.h is used, so this is what an application embedding the
+ * library would do.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metagsm.h"
+
+struct counts {
+	unsigned long messages;
+	unsigned long sessions;
+	unsigned long cell_updates;
+};
+
+static void drain(metagsm_t *ctx, struct counts *c)
+{
+	struct metagsm_event ev;
+
+	while (metagsm_poll(ctx, &ev, sizeof(ev))) {
+		switch (ev.type) {
+		case METAGSM_EVENT_MESSAGE:
+			c->messages++;
+			break;
+		case METAGSM_EVENT_SESSION_CLOSE:
+			c->sessions++;
+			break;
+		case METAGSM_EVENT_CELL_UPDATE:
+			c->cell_updates++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static int decode_file(const char *name, struct counts *c)
+{
+	static uint8_t buf[1 << 16];
+	metagsm_t *ctx;
+	ssize_t len;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		perror(name);
+		return -1;
+	}
+
+	ctx = metagsm_create();
+	if (!ctx) {
+		fprintf(stderr, "Cannot create a metagsm context\n");
+		close(fd);
+		return -1;
+	}
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		metagsm_feed(ctx, buf, len);
+		drain(ctx, c);
+	}
+	metagsm_finish(ctx);
+	drain(ctx, c);
+	metagsm_destroy(ctx);
+
+	close(fd);
+	return len < 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct counts c;
+	struct timespec t0, t1;
+	double secs;
+	int i, failed = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <file> [...]\n", argv[0]);
+		return 1;
+	}
+
+	if (metagsm_version() != METAGSM_API_VERSION) {
+		fprintf(stderr, "libmetagsm has API version %u, built for %u\n",
+			metagsm_version(), METAGSM_API_VERSION);
+		return 1;
+	}
+
+	memset(&c, 0, sizeof(c));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 1; i < argc; i++)
+		failed |= decode_file(argv[i], &c) < 0;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("files:        %d\n", argc - 1);
+	printf("messages:     %lu\n", c.messages);
+	printf("sessions:     %lu\n", c.sessions);
+	printf("cell updates: %lu\n", c.cell_updates);
+	printf("time:         %.3f s, %.3f ms per file\n", secs, secs * 1000 / (argc - 1));
+
+	return failed;
+}
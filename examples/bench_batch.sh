@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Decode the same capture files once with one diag_parser process per
+# file and once in a single process through libmetagsm, and compare the
+# wall clock time. Run from the source directory after "make" and
+# "make examples", or through "make bench-batch CAPTURES=...".
+#
+#	examples/bench_batch.sh captures/*.qmdl
+
+if [ $# -eq 0 ]; then
+	echo "Usage: $0 <file> [...]" >&2
+	exit 1
+fi
+
+for tool in ./diag_parser examples/batch_decode; do
+	if [ ! -x $tool ]; then
+		echo "$tool not found, run make and make examples first" >&2
+		exit 1
+	fi
+done
+
+now() {
+	date +%s.%N
+}
+
+t0=$(now)
+for f in "$@"; do
+	./diag_parser "$f" > /dev/null || exit 1
+done
+t1=$(now)
+examples/batch_decode "$@" > /dev/null || exit 1
+t2=$(now)
+
+awk -v n=$# -v t0=$t0 -v t1=$t1 -v t2=$t2 'BEGIN {
+	printf "process per file: %8.3f s, %8.3f ms per file\n", t1 - t0, (t1 - t0) * 1000 / n
+	printf "one process:      %8.3f s, %8.3f ms per file\n", t2 - t1, (t2 - t1) * 1000 / n
+	if (t2 > t1)
+		printf "speedup:          %8.2fx\n", (t1 - t0) / (t2 - t1)
+}'
@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "freq_cache.h"
+
+/*
+ * Small LRU cache for decoded frequency lists and mobile allocations.
+ * The key holds the raw IE octets (plus the cell allocation they refer
+ * to), so a hit returns exactly what a fresh decode would produce.
+ */
+
+struct freq_cache_entry {
+	uint32_t hash;
+	uint32_t last_use;
+	unsigned key_len;
+	uint8_t key[FREQ_CACHE_KEY_MAX];
+	struct freq_alloc fa;
+};
+
+static struct freq_cache_entry cache[FREQ_CACHE_ENTRIES];
+static uint32_t use_clock = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+/* FNV-1a */
+static uint32_t key_hash(const uint8_t *key, unsigned key_len)
+{
+	uint32_t h = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < key_len; i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+const struct freq_alloc *freq_cache_get(const uint8_t *key, unsigned key_len)
+{
+	uint32_t hash = key_hash(key, key_len);
+	unsigned i;
+
+	for (i = 0; i < FREQ_CACHE_ENTRIES; i++) {
+		struct freq_cache_entry *e = &cache[i];
+
+		if (!e->key_len || e->hash != hash || e->key_len != key_len)
+			continue;
+		if (memcmp(e->key, key, key_len))
+			continue;
+
+		e->last_use = ++use_clock;
+		cache_hits++;
+		return &e->fa;
+	}
+
+	cache_misses++;
+	return NULL;
+}
+
+void freq_cache_put(const uint8_t *key, unsigned key_len, const struct freq_alloc *fa)
+{
+	struct freq_cache_entry *victim = &cache[0];
+	unsigned i;
+
+	if (key_len == 0 || key_len > FREQ_CACHE_KEY_MAX)
+		return;
+
+	/* Pick an empty slot or the least recently used one */
+	for (i = 0; i < FREQ_CACHE_ENTRIES; i++) {
+		if (!cache[i].key_len) {
+			victim = &cache[i];
+			break;
+		}
+		if (cache[i].last_use < victim->last_use)
+			victim = &cache[i];
+	}
+
+	victim->hash = key_hash(key, key_len);
+	victim->last_use = ++use_clock;
+	victim->key_len = key_len;
+	memcpy(victim->key, key, key_len);
+	victim->fa = *fa;
+}
+
+void freq_cache_flush()
+{
+	memset(cache, 0, sizeof(cache));
+	use_clock = 0;
+}
+
+void freq_cache_stats(unsigned long *hits, unsigned long *misses)
+{
+	if (hits)
+		*hits = cache_hits;
+	if (misses)
+		*misses = cache_misses;
+}
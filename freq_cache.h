@@ -0,0 +1,24 @@
+#ifndef FREQ_CACHE_H
+#define FREQ_CACHE_H
+
+#include <stdint.h>
+
+#include "arfcn_set.h"
+
+#define FREQ_CACHE_ENTRIES	16
+#define FREQ_CACHE_KEY_MAX	(4 + 2*255 + sizeof(struct arfcn_set))
+
+/* Decoded frequency allocation and the hopping list derived from it */
+struct freq_alloc {
+	struct arfcn_set arfcns;
+	uint16_t ma[128];
+	int ma_len;
+	int ma_known;		/* 0: only ma_len, the cell allocation was unknown */
+};
+
+const struct freq_alloc *freq_cache_get(const uint8_t *key, unsigned key_len);
+void freq_cache_put(const uint8_t *key, unsigned key_len, const struct freq_alloc *fa);
+void freq_cache_flush();
+void freq_cache_stats(unsigned long *hits, unsigned long *misses);
+
+#endif
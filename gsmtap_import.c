@@ -118,6 +118,7 @@ void process_gsmtap(const struct pcap_pkthdr* pkt_hdr, const u_char* pkt_data, u
 	if (m->flags) {
 		_s->timestamp = pkt_hdr->ts;
 		m->timestamp = pkt_hdr->ts;
+		m->ts_nsec = pkt_hdr->ts.tv_usec * 1000;
 		handle_radio_msg(_s, m);
 	}
 
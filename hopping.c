@@ -0,0 +1,134 @@
+#include <string.h>
+#include <osmocom/gsm/gsm_utils.h>
+
+#include "hopping.h"
+
+/* GSM 05.02 6.2.3, table 1 */
+static const uint8_t rn_table[114] = {
+	 48,  98,  63,   1,  36,  95,  78, 102,  94,  73,
+	  0,  64,  25,  81,  76,  59, 124,  23, 104, 100,
+	101,  47, 118,  85,  18,  56,  96,  86,  54,   2,
+	 80,  34, 127,  13,   6,  89,  57, 103,  12,  74,
+	 55, 111,  75,  38, 109,  71, 112,  29,  11,  88,
+	 87,  19,   3,  68, 110,  26,  33,  31,   8,  45,
+	 82,  58,  40, 107,  32,   5, 106,  92,  62,  67,
+	 77, 108, 122,  37,  60,  66, 121,  42,  51, 126,
+	117, 114,   4,  90,  43,  52,  53, 113, 120,  72,
+	 16,  49,   7,  79, 119,  61,  22,  84,   9,  97,
+	 91,  15,  21,  24,  46,  39,  93, 105,  65,  70,
+	125,  99,  17, 123,
+};
+
+static void hopping_setup(struct hopping_seq *hs, uint8_t hsn, uint8_t maio, const uint16_t *ma, unsigned n)
+{
+	unsigned t1r, t3, nbin = 0;
+
+	hs->hsn = hsn;
+	hs->maio = maio;
+	hs->n = n;
+	memcpy(hs->ma, ma, n * sizeof(ma[0]));
+
+	/* NBIN = INTEGER(log2(N) + 1) */
+	while ((1u << nbin) <= n)
+		nbin++;
+	hs->nbin_mask = (1u << nbin) - 1;
+
+	for (t1r = 0; t1r < 64; t1r++) {
+		for (t3 = 0; t3 < 51; t3++) {
+			hs->rn[t1r][t3] = rn_table[((hsn & 63) ^ t1r) + t3];
+		}
+	}
+
+	hs->sched_valid = 0;
+}
+
+/* Return the cached hopping sequence for (HSN, MAIO, MA), creating it if needed */
+struct hopping_seq *hopping_get(struct hopping_cache *hc, uint8_t hsn, uint8_t maio, const uint16_t *ma, unsigned ma_len)
+{
+	struct hopping_seq *victim = &hc->seq[0];
+	unsigned i;
+
+	if (ma_len == 0 || ma_len > HOPPING_MAX_N)
+		return NULL;
+
+	for (i = 0; i < HOPPING_CACHE_ENTRIES; i++) {
+		struct hopping_seq *hs = &hc->seq[i];
+
+		if (!hs->n) {
+			victim = hs;
+			continue;
+		}
+		if (hs->hsn == hsn && hs->maio == maio && hs->n == ma_len &&
+		    !memcmp(hs->ma, ma, ma_len * sizeof(ma[0]))) {
+			hs->last_use = ++hc->use_clock;
+			return hs;
+		}
+		if (victim->n && hs->last_use < victim->last_use)
+			victim = hs;
+	}
+
+	hopping_setup(victim, hsn, maio, ma, ma_len);
+	victim->last_use = ++hc->use_clock;
+
+	return victim;
+}
+
+struct hopping_seq *hopping_from_assignment(struct hopping_cache *hc, const struct gsm_assignment *ga)
+{
+	/* ma_len without list: the cell allocation was unknown */
+	if (!ga->h || !ga->h1.ma_known || ga->h1.ma_len <= 0 || ga->h1.ma_len > HOPPING_MAX_N)
+		return NULL;
+
+	return hopping_get(hc, ga->h1.hsn, ga->h1.maio, ga->h1.ma, ga->h1.ma_len);
+}
+
+/* Mobile allocation index for frame number fn */
+unsigned hopping_mai(const struct hopping_seq *hs, uint32_t fn)
+{
+	unsigned t1r, t2, t3, m, s;
+
+	if (hs->hsn == 0) {
+		/* cyclic hopping */
+		return (fn + hs->maio) % hs->n;
+	}
+
+	t1r = (fn / (26 * 51)) % 64;
+	t2 = fn % 26;
+	t3 = fn % 51;
+
+	m = t2 + hs->rn[t1r][t3];
+	if ((m & hs->nbin_mask) < hs->n) {
+		s = m & hs->nbin_mask;
+	} else {
+		s = ((m & hs->nbin_mask) + (t3 & hs->nbin_mask)) % hs->n;
+	}
+
+	return (s + hs->maio) % hs->n;
+}
+
+/* ARFCNs for count consecutive frames starting at fn */
+void hopping_schedule(const struct hopping_seq *hs, uint32_t fn, unsigned count, uint16_t *arfcns)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		arfcns[i] = hs->ma[hopping_mai(hs, (fn + i) % GSM_MAX_FN)];
+	}
+}
+
+/* ARFCN used in frame fn, served from the current 26-multiframe schedule */
+uint16_t hopping_arfcn(struct hopping_seq *hs, uint32_t fn)
+{
+	uint32_t mf_fn;
+
+	fn %= GSM_MAX_FN;
+	mf_fn = fn - (fn % 26);
+
+	if (!hs->sched_valid || hs->sched_fn != mf_fn) {
+		hopping_schedule(hs, mf_fn, 26, hs->sched);
+		hs->sched_fn = mf_fn;
+		hs->sched_valid = 1;
+	}
+
+	return hs->sched[fn - mf_fn];
+}
@@ -0,0 +1,39 @@
+#ifndef HOPPING_H
+#define HOPPING_H
+
+#include <stdint.h>
+
+#include "assignment.h"
+
+#define HOPPING_MAX_N		64
+#define HOPPING_CACHE_ENTRIES	8
+
+/* Hopping sequence of one (HSN, MAIO, MA) triple, GSM 05.02 6.2.3 */
+struct hopping_seq {
+	uint8_t hsn;
+	uint8_t maio;
+	uint8_t n;
+	uint8_t nbin_mask;	/* 2^NBIN - 1 */
+	uint16_t ma[HOPPING_MAX_N];
+	/* RNTABLE((HSN xor T1R) + T3), indexed by T1R and T3 */
+	uint8_t rn[64][51];
+	/* Last generated 26-multiframe */
+	uint32_t sched_fn;
+	uint8_t sched_valid;
+	uint16_t sched[26];
+	uint32_t last_use;
+};
+
+/* Recently used sequences, one cache per parser context */
+struct hopping_cache {
+	struct hopping_seq seq[HOPPING_CACHE_ENTRIES];
+	uint32_t use_clock;
+};
+
+struct hopping_seq *hopping_get(struct hopping_cache *hc, uint8_t hsn, uint8_t maio, const uint16_t *ma, unsigned ma_len);
+struct hopping_seq *hopping_from_assignment(struct hopping_cache *hc, const struct gsm_assignment *ga);
+unsigned hopping_mai(const struct hopping_seq *hs, uint32_t fn);
+uint16_t hopping_arfcn(struct hopping_seq *hs, uint32_t fn);
+void hopping_schedule(const struct hopping_seq *hs, uint32_t fn, unsigned count, uint16_t *arfcns);
+
+#endif
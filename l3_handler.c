@@ -16,6 +16,9 @@
 #include "assignment.h"
 #include "address.h"
 #include "output.h"
+#include "dlog.h"
+#include "probes.h"
+#include "trace.h"
 
 void handle_classmark(struct session_info *s, uint8_t *data, uint8_t type)
 {
@@ -448,7 +451,7 @@ void handle_rr(struct session_info *s, struct gsm48_hdr *dtap, unsigned len, uin
 		break;
 	case GSM48_MT_RR_HANDO_CMD:
 		SET_MSG_INFO(s, "HANDOVER COMMAND");
-		parse_assignment(dtap, len, s->cell_arfcns, &s->ga);
+		parse_assignment(dtap, len, &s->cell_arfcns, &s->ga);
 		s->handover = 1;
 		s->use_jump = 2;
 		break;
@@ -459,7 +462,7 @@ void handle_rr(struct session_info *s, struct gsm48_hdr *dtap, unsigned len, uin
 		SET_MSG_INFO(s, "ASSIGNMENT COMMAND");
 		if ((s->fc.enc-s->fc.enc_null-s->fc.enc_si) == 1)
 			s->forced_ho = 1;
-		parse_assignment(dtap, len, s->cell_arfcns, &s->ga);
+		parse_assignment(dtap, len, &s->cell_arfcns, &s->ga);
 		s->assignment = 1;
 		s->use_jump = 1;
 		break;
@@ -892,9 +895,7 @@ void update_timestamps(struct session_info *s)
 void handle_radio_msg(struct session_info *s, struct radio_message *m)
 {
 	static int num_called  = 0;
-	if (msg_verbose > 1) {
-		fprintf(stderr, "handle_radio_msg %d\n", num_called++);
-	}
+	DLOG(DLOG_L3, DLOG_DEBUG, "handle_radio_msg %d\n", num_called++);
 
 	assert(s != NULL);
 	assert(m != NULL);
@@ -907,9 +908,12 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 	//s0 = CS (circuit switched) related transation
 	//s1 = PS (packet switched) related transation
 	int i;
+	int was_started[2], was_id[2];
 	for(i = 0; i < 1 + !!auto_reset; i++) {
 		assert(s[i].domain == i);
 		s[i].new_msg = m;
+		was_started[i] = s[i].started;
+		was_id[i] = s[i].id;
 	}
 
 	switch (m->rat) {
@@ -919,41 +923,38 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 			if (s->rat != RAT_GSM)
 				break;
 
-			if (msg_verbose > 1) {
-				fprintf(stderr, "-> MSG_SACCH\n");
-			}
+			DLOG(DLOG_L3, DLOG_DEBUG, "-> MSG_SACCH\n");
 			break;
 		case MSG_SDCCH: //standalone dedicated control channel
 			if (s->rat != RAT_GSM)
 				break;
 
-			if (msg_verbose > 1) {
-				fprintf(stderr, "-> MSG_SDCCH\n");
-			}
+			DLOG(DLOG_L3, DLOG_DEBUG, "-> MSG_SDCCH\n");
 			break;
 		case MSG_FACCH:
-			if (msg_verbose > 1) {
-				fprintf(stderr, "-> MSG_FACCH\n");
-			}
+			DLOG(DLOG_L3, DLOG_DEBUG, "-> MSG_FACCH\n");
 			break;
 		case MSG_BCCH:
-			if (msg_verbose > 1) {
-				fprintf(stderr, "-> MSG_BCCH\n");
-			}
+			DLOG(DLOG_L3, DLOG_DEBUG, "-> MSG_BCCH\n");
+			trace_begin(TRACE_DTAP, m->msg_len-1);
 			handle_dtap(s, &m->msg[1], m->msg_len-1, m->bb.fn[0], ul);
+			trace_end(TRACE_DTAP, 0);
 			break;
 		default:
-			if (msg_verbose > 1) {
-				fprintf(stderr, "Wrong MSG flags %02x\n", m->flags);
-			}
-			printf("Wrong MSG flags %02x\n", m->flags);
+			DLOG(DLOG_L3, DLOG_NOTICE, "Wrong MSG flags %02x\n", m->flags);
+			/* write the line out before dying */
+			dlog_stop();
 			abort();
 		}
 
 		//if s->new_msg is not m, then we have freed it.
-		if (msg_verbose && s->new_msg == m && m->flags & MSG_DECODED) {
-			printf("GSM %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
-				m->bb.fn[0], m->info[0] ? m->info : osmo_hexdump_nospc(m->msg, m->msg_len));
+		if (s->new_msg == m && m->flags & MSG_DECODED) {
+			if (m->info[0])
+				DLOG(DLOG_L3, DLOG_INFO, "GSM %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
+					m->bb.fn[0], m->info);
+			else
+				DLOG(DLOG_L3, DLOG_INFO, "GSM %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
+					m->bb.fn[0], DLOG_HEX(m->msg, m->msg_len));
 		}
 		break;
 
@@ -968,9 +969,13 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 		} else {
 			assert(0);
 		}
-		if (msg_verbose && s->new_msg == m && m->flags & MSG_DECODED) {
-			printf("RRC %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
-				m->bb.fn[0], m->info[0] ? m->info : osmo_hexdump_nospc(m->bb.data, m->msg_len));
+		if (s->new_msg == m && m->flags & MSG_DECODED) {
+			if (m->info[0])
+				DLOG(DLOG_L3, DLOG_INFO, "RRC %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
+					m->bb.fn[0], m->info);
+			else
+				DLOG(DLOG_L3, DLOG_INFO, "RRC %s %s %u : %s\n", m->domain ? "PS" : "CS", ul ? "UL" : "DL",
+					m->bb.fn[0], DLOG_HEX(m->bb.data, m->msg_len));
 		}
 		break;
 
@@ -979,9 +984,13 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 			s[0].rat = RAT_LTE;
 			s[1].rat = RAT_LTE;
 		}
-		if (msg_verbose && s->new_msg == m && m->flags & MSG_DECODED) {
-			printf("LTE %s %u : %s\n", ul ? "UL" : "DL",
-				m->bb.fn[0], m->info[0] ? m->info : osmo_hexdump_nospc(m->bb.data, m->msg_len));
+		if (s->new_msg == m && m->flags & MSG_DECODED) {
+			if (m->info[0])
+				DLOG(DLOG_L3, DLOG_INFO, "LTE %s %u : %s\n", ul ? "UL" : "DL",
+					m->bb.fn[0], m->info);
+			else
+				DLOG(DLOG_L3, DLOG_INFO, "LTE %s %u : %s\n", ul ? "UL" : "DL",
+					m->bb.fn[0], DLOG_HEX(m->bb.data, m->msg_len));
 		}
 		break;
 
@@ -989,6 +998,12 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 		return;
 	}
 
+	/* started by this message, possibly after a reset */
+	for(i = 0; i < 1 + !!auto_reset; i++) {
+		if (s[i].started && (!was_started[i] || s[i].id != was_id[i]))
+			PROBE4(session_open, s[i].id, i, s[i].rat, m->bb.fn[0]);
+	}
+
 	if (s->new_msg) {
 		/* Keep fn timestamps updated */
 		assert(m->domain < 2);
@@ -997,6 +1012,7 @@ void handle_radio_msg(struct session_info *s, struct radio_message *m)
 		if (s->new_msg->flags & MSG_DECODED) {
 			assert(s->new_msg == m);
 			s->new_msg = NULL;
+			PROBE4(message, m->rat, m->bb.fn[0], m->msg_len, m->flags);
 			net_send_msg(m);
 			free(m);
 		} else {
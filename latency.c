@@ -0,0 +1,150 @@
+#include <signal.h>
+#include <string.h>
+
+#include "latency.h"
+
+/*
+ * Bucket i < SUB_COUNT holds the value i. Above that every power of two
+ * is split into SUB_COUNT linear buckets, so the bucket width is at most
+ * 1/SUB_COUNT of the values in it.
+ */
+
+#define SUB_BITS	5
+#define SUB_COUNT	(1 << SUB_BITS)
+#define BUCKETS		((64 - SUB_BITS + 1) * SUB_COUNT)
+
+struct stage_stats {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t max;
+	uint64_t buckets[BUCKETS];
+};
+
+static const char *stage_names[LATENCY_STAGES] = {
+	[LATENCY_DEFRAME] = "deframe",
+	[LATENCY_DIAG] = "diag",
+	[LATENCY_DECODE] = "decode",
+	[LATENCY_OUTPUT] = "output",
+};
+
+int latency_enabled = 0;
+
+static struct stage_stats stats[LATENCY_STAGES];
+static volatile sig_atomic_t dump_requested = 0;
+
+/* taken together to convert ticks to nanoseconds later */
+static struct timespec start_ts;
+static uint64_t start_ticks;
+
+static unsigned bucket_index(uint64_t v)
+{
+	unsigned e;
+
+	if (v < SUB_COUNT)
+		return v;
+
+	e = 63 - __builtin_clzll(v);
+	return (e - SUB_BITS + 1) * SUB_COUNT + ((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* Middle of a bucket */
+static uint64_t bucket_value(unsigned i)
+{
+	unsigned e, shift;
+
+	if (i < SUB_COUNT)
+		return i;
+
+	e = i / SUB_COUNT + SUB_BITS - 1;
+	shift = e - SUB_BITS;
+	return ((uint64_t) (SUB_COUNT + i % SUB_COUNT) << shift) + ((1ULL << shift) >> 1);
+}
+
+void latency_record(unsigned stage, uint64_t ticks, unsigned bytes)
+{
+	struct stage_stats *st = &stats[stage];
+
+	st->count++;
+	st->bytes += bytes;
+	st->buckets[bucket_index(ticks)]++;
+	if (ticks > st->max)
+		st->max = ticks;
+
+	latency_poll();
+}
+
+void latency_poll()
+{
+	if (dump_requested) {
+		dump_requested = 0;
+		latency_dump(stderr);
+	}
+}
+
+void latency_enable()
+{
+	memset(stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	start_ticks = latency_ticks();
+	latency_enabled = 1;
+}
+
+void latency_request_dump()
+{
+	dump_requested = 1;
+}
+
+static uint64_t percentile(const struct stage_stats *st, double p)
+{
+	uint64_t rank = (uint64_t) (st->count * p), seen = 0;
+	unsigned i;
+
+	for (i = 0; i < BUCKETS; i++) {
+		seen += st->buckets[i];
+		if (seen > rank)
+			return bucket_value(i) < st->max ? bucket_value(i) : st->max;
+	}
+
+	return st->max;
+}
+
+void latency_dump(FILE *out)
+{
+	struct timespec now;
+	double secs, ns_per_tick;
+	unsigned i;
+
+	if (!latency_enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - start_ts.tv_sec) + (now.tv_nsec - start_ts.tv_nsec) / 1e9;
+#if defined(__x86_64__) || defined(__i386__)
+	ns_per_tick = latency_ticks() > start_ticks ? secs * 1e9 / (latency_ticks() - start_ticks) : 0;
+#else
+	ns_per_tick = 1;
+#endif
+	if (secs <= 0)
+		secs = 1e-9;
+
+	fprintf(out, "Latency after %.1f s (ns, stages include the stages they call)\n", secs);
+	fprintf(out, "%-8s %12s %10s %8s %8s %8s %8s %8s %10s\n",
+		"stage", "count", "count/s", "MB/s", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < LATENCY_STAGES; i++) {
+		const struct stage_stats *st = &stats[i];
+
+		if (!st->count)
+			continue;
+		fprintf(out, "%-8s %12llu %10.0f %8.2f %8.0f %8.0f %8.0f %8.0f %10.0f\n",
+			stage_names[i],
+			(unsigned long long) st->count,
+			st->count / secs,
+			st->bytes / secs / 1e6,
+			percentile(st, 0.5) * ns_per_tick,
+			percentile(st, 0.9) * ns_per_tick,
+			percentile(st, 0.99) * ns_per_tick,
+			percentile(st, 0.999) * ns_per_tick,
+			st->max * ns_per_tick);
+	}
+	fflush(out);
+}
@@ -0,0 +1,73 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Optional latency histograms of the pipeline stages. A stage's time
+ * includes the stages it calls: DIAG handling includes decoding, which
+ * includes output. Deframing is the HDLC deframer, or fread_unescape()
+ * including the read for files read through stdio.
+ *
+ * Times are taken with rdtsc where available, otherwise with
+ * CLOCK_MONOTONIC, and kept in log-linear buckets of about 3% width.
+ * Ticks are converted to nanoseconds when the statistics are printed.
+ * When disabled a stage costs one predictable branch.
+ *
+ * The stages run on the decoding thread only and are not locked.
+ */
+
+enum latency_stage {
+	LATENCY_DEFRAME,	/* HDLC deframing, bytes in */
+	LATENCY_DIAG,		/* handle_diag(), frame bytes */
+	LATENCY_DECODE,		/* handle_radio_msg(), message bytes */
+	LATENCY_OUTPUT,		/* net_send_msg(), message bytes */
+	LATENCY_STAGES
+};
+
+extern int latency_enabled;
+
+static inline uint64_t latency_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void latency_record(unsigned stage, uint64_t ticks, unsigned bytes);
+
+static inline uint64_t latency_start()
+{
+	return __builtin_expect(latency_enabled, 0) ? latency_ticks() : 0;
+}
+
+static inline void latency_stop(unsigned stage, uint64_t start, unsigned bytes)
+{
+	if (__builtin_expect(latency_enabled, 0))
+		latency_record(stage, latency_ticks() - start, bytes);
+}
+
+void latency_enable();
+
+/* Async signal safe, the statistics are printed with the next record */
+void latency_request_dump();
+
+/* Longest wait of an idle input loop, so it can serve a requested dump */
+#define LATENCY_POLL_MS	1000
+
+/* Print the statistics if a dump was requested, for loops without traffic */
+void latency_poll();
+
+void latency_dump(FILE *out);
+
+#endif
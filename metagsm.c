@@ -0,0 +1,240 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metagsm.h"
+#include "callback.h"
+#include "column_export.h"
+#include "diag_format.h"
+#include "diag_input.h"
+
+/*
+ * Opaque handle API on top of the parser contexts. The parser reports
+ * through the global callback registry and its frame callback has no
+ * user pointer, so all entry points that run the parser hold api_lock
+ * and set current to the context being fed; the callbacks turn what
+ * they are given into events on that context's queue.
+ */
+
+#define EVENTS_INITIAL	64
+
+struct metagsm {
+	struct diag_ctx *dctx;
+	struct diag_stream st;
+	struct metagsm_event *events;
+	unsigned head;		/* oldest pending event */
+	unsigned count;
+	unsigned size;		/* a power of two */
+};
+
+static pthread_mutex_t api_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned n_contexts = 0;
+static int cb_handle = -1;
+static struct metagsm *current = NULL;
+
+static struct metagsm_event *event_new(struct metagsm *ctx, enum metagsm_event_type type)
+{
+	struct metagsm_event *ev, *events;
+	unsigned i;
+
+	if (ctx->count == ctx->size) {
+		events = malloc(2 * ctx->size * sizeof(*events));
+		if (!events)
+			return NULL;
+		for (i = 0; i < ctx->count; i++)
+			events[i] = ctx->events[(ctx->head + i) & (ctx->size - 1)];
+		free(ctx->events);
+		ctx->events = events;
+		ctx->head = 0;
+		ctx->size *= 2;
+	}
+
+	ev = &ctx->events[(ctx->head + ctx->count) & (ctx->size - 1)];
+	ctx->count++;
+	ev->type = type;
+
+	return ev;
+}
+
+static void on_message(const struct radio_message *m, void *arg)
+{
+	struct metagsm_message *msg;
+	struct metagsm_event *ev;
+
+	if (!current || !(ev = event_new(current, METAGSM_EVENT_MESSAGE)))
+		return;
+
+	msg = &ev->u.msg;
+	msg->ts_ns = (uint64_t) m->timestamp.tv_sec * 1000000000 + m->ts_nsec;
+	msg->id = m->id;
+	msg->fn = m->bb.fn[0];
+	msg->arfcn = m->bb.arfcn[0];
+	msg->log_code = m->log_code;
+	msg->rat = m->rat;
+	msg->domain = m->domain;
+	msg->flags = m->flags;
+	msg->chan_nr = m->chan_nr;
+	msg->msg_len = m->msg_len;
+	msg->len = m->msg_len < sizeof(msg->data) ? m->msg_len : sizeof(msg->data);
+	/* GSM keeps the L2 frame in msg, the other RATs in bb.data */
+	memcpy(msg->data, m->rat == RAT_GSM ? m->msg : m->bb.data, msg->len);
+	memcpy(msg->info, m->info, sizeof(msg->info));
+	msg->info[sizeof(msg->info) - 1] = 0;
+	msg->msg_type = column_msg_type(m);
+}
+
+static void on_session_close(const struct session_info *s, void *arg)
+{
+	struct metagsm_session *ses;
+	struct metagsm_event *ev;
+
+	if (!current || !(ev = event_new(current, METAGSM_EVENT_SESSION_CLOSE)))
+		return;
+
+	ses = &ev->u.session;
+	memset(ses, 0, sizeof(*ses));
+	ses->ts_ns = (uint64_t) s->timestamp.tv_sec * 1000000000 + (uint64_t) s->timestamp.tv_usec * 1000;
+	ses->id = s->id;
+	ses->cid = s->cid;
+	ses->mcc = s->mcc;
+	ses->mnc = s->mnc;
+	ses->lac = s->lac;
+	ses->psc = s->psc;
+	ses->arfcn = s->arfcn;
+	ses->neigh_count = s->neigh_count;
+	ses->duration = s->duration;
+	ses->rat = s->rat;
+	ses->domain = s->domain;
+	ses->cipher = s->cipher;
+	ses->integrity = s->integrity;
+	ses->mo = s->mo;
+	ses->mt = s->mt;
+	ses->locupd = s->locupd;
+	ses->call = s->call;
+	ses->cracked = s->cracked;
+}
+
+static void on_cell_update(const struct session_info *s, void *arg)
+{
+	struct metagsm_cell *cell;
+	struct metagsm_event *ev;
+
+	if (!current || !(ev = event_new(current, METAGSM_EVENT_CELL_UPDATE)))
+		return;
+
+	cell = &ev->u.cell;
+	memset(cell, 0, sizeof(*cell));
+	cell->cid = s->cid;
+	cell->mcc = s->mcc;
+	cell->mnc = s->mnc;
+	cell->lac = s->lac;
+	cell->arfcn = s->arfcn;
+	cell->neigh_count = arfcn_set_count(&s->neigh_arfcns);
+	cell->rat = s->rat;
+}
+
+static void feed_frame(uint8_t *msg, unsigned len)
+{
+	diag_ctx_handle(current->dctx, msg, len);
+}
+
+unsigned metagsm_version(void)
+{
+	return METAGSM_API_VERSION;
+}
+
+metagsm_t *metagsm_create(void)
+{
+	struct metagsm_callbacks cb = {
+		.on_message = on_message,
+		.on_session_close = on_session_close,
+		.on_cell_update = on_cell_update,
+	};
+	struct metagsm *ctx;
+
+	ctx = (struct metagsm *) calloc(1, sizeof(struct metagsm));
+	if (!ctx)
+		return NULL;
+
+	ctx->size = EVENTS_INITIAL;
+	ctx->events = malloc(ctx->size * sizeof(*ctx->events));
+	if (!ctx->events) {
+		free(ctx);
+		return NULL;
+	}
+	diag_stream_init(&ctx->st);
+
+	pthread_mutex_lock(&api_lock);
+	if (!n_contexts++) {
+		/* the shared parser, without any outputs of its own */
+		diag_init(0, 0, NULL, NULL, NULL, 0);
+		cb_handle = callback_register(&cb);
+	}
+	ctx->dctx = diag_ctx_new();
+	pthread_mutex_unlock(&api_lock);
+
+	return ctx;
+}
+
+int metagsm_feed(metagsm_t *ctx, const void *data, size_t len)
+{
+	pthread_mutex_lock(&api_lock);
+	current = ctx;
+	diag_stream_feed(&ctx->st, data, len, DIAG_STREAM_MORE, NULL, feed_frame);
+	current = NULL;
+	pthread_mutex_unlock(&api_lock);
+
+	return 0;
+}
+
+int metagsm_finish(metagsm_t *ctx)
+{
+	pthread_mutex_lock(&api_lock);
+	current = ctx;
+	diag_stream_feed(&ctx->st, NULL, 0, DIAG_STREAM_END, NULL, feed_frame);
+	diag_ctx_flush(ctx->dctx);
+	current = NULL;
+	pthread_mutex_unlock(&api_lock);
+
+	/* the next capture may come in another container format */
+	diag_stream_next_file(&ctx->st);
+
+	return 0;
+}
+
+int metagsm_poll(metagsm_t *ctx, struct metagsm_event *ev, size_t size)
+{
+	if (!ctx->count)
+		return 0;
+
+	/* the caller's struct is older (smaller) or newer (larger) than ours */
+	if (size > sizeof(*ev)) {
+		memset((uint8_t *) ev + sizeof(*ev), 0, size - sizeof(*ev));
+		size = sizeof(*ev);
+	}
+	memcpy(ev, &ctx->events[ctx->head], size);
+	ctx->head = (ctx->head + 1) & (ctx->size - 1);
+	ctx->count--;
+
+	return 1;
+}
+
+void metagsm_destroy(metagsm_t *ctx)
+{
+	unsigned last_sid, last_cid;
+
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&api_lock);
+	diag_ctx_free(ctx->dctx);
+	if (!--n_contexts) {
+		callback_unregister(cb_handle);
+		cb_handle = -1;
+		diag_destroy(&last_sid, &last_cid);
+	}
+	pthread_mutex_unlock(&api_lock);
+
+	free(ctx->events);
+	free(ctx);
+}
@@ -0,0 +1,130 @@
+#ifndef METAGSM_H
+#define METAGSM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Embedding API of libmetagsm.so. This header is all an application
+ * needs; the parser's internal structures stay hidden behind the
+ * metagsm_t handle and events are returned as copies in the structures
+ * below, which only ever grow at the end within one major version. The
+ * caller passes the size of its struct metagsm_event, so the library
+ * never writes past it; fields the library does not know are zeroed.
+ *
+ *	metagsm_t *ctx = metagsm_create();
+ *	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+ *		metagsm_feed(ctx, buf, len);
+ *		while (metagsm_poll(ctx, &ev, sizeof(ev)))
+ *			handle(&ev);
+ *	}
+ *	metagsm_finish(ctx);
+ *	while (metagsm_poll(ctx, &ev, sizeof(ev)))
+ *		handle(&ev);
+ *	metagsm_destroy(ctx);
+ *
+ * Every context has its own deframer and sessions, so one context per
+ * capture or device keeps them apart. The parser behind the contexts
+ * is shared: calls into different contexts from different threads are
+ * safe but run one at a time. A single context must only be used from
+ * one thread at a time.
+ */
+
+#define METAGSM_EXPORT	__attribute__((visibility("default")))
+
+#define METAGSM_API_VERSION	1
+
+typedef struct metagsm metagsm_t;
+
+enum metagsm_event_type {
+	METAGSM_EVENT_NONE = 0,
+	METAGSM_EVENT_MESSAGE,		/* a decoded radio message */
+	METAGSM_EVENT_SESSION_CLOSE,	/* a session ended */
+	METAGSM_EVENT_CELL_UPDATE,	/* serving ARFCN or neighbour list changed */
+};
+
+struct metagsm_message {
+	uint64_t ts_ns;		/* nanoseconds since the UNIX epoch */
+	uint32_t id;
+	uint32_t fn;
+	uint16_t arfcn;
+	uint16_t log_code;	/* DIAG log code the message came from */
+	uint8_t rat;		/* 0 GSM, 1 UMTS, 2 LTE */
+	uint8_t domain;		/* 0 CS, 1 PS */
+	uint8_t flags;
+	uint8_t chan_nr;
+	uint16_t len;		/* bytes used in data */
+	uint8_t data[256];	/* L3 message, its first 256 bytes if longer */
+	char info[128];		/* decoded message name, NUL terminated */
+	uint16_t msg_type;	/* protocol discriminator << 8 | type, 0xffff if unknown */
+	uint16_t msg_len;	/* length of the whole message, above len if data is truncated */
+};
+
+struct metagsm_session {
+	uint64_t ts_ns;		/* time the session was closed */
+	uint32_t id;
+	uint32_t cid;
+	uint16_t mcc;
+	uint16_t mnc;
+	uint16_t lac;
+	uint16_t psc;
+	uint16_t arfcn;
+	uint16_t neigh_count;
+	uint32_t duration;	/* milliseconds */
+	uint8_t rat;
+	uint8_t domain;
+	uint8_t cipher;
+	uint8_t integrity;
+	uint8_t mo;
+	uint8_t mt;
+	uint8_t locupd;
+	uint8_t call;
+	uint8_t cracked;	/* closed by a reset rather than a release */
+};
+
+struct metagsm_cell {
+	uint32_t cid;
+	uint16_t mcc;
+	uint16_t mnc;
+	uint16_t lac;
+	uint16_t arfcn;
+	uint16_t neigh_count;
+	uint8_t rat;
+};
+
+struct metagsm_event {
+	enum metagsm_event_type type;
+	union {
+		struct metagsm_message msg;
+		struct metagsm_session session;
+		struct metagsm_cell cell;
+	} u;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* METAGSM_API_VERSION the library was built with */
+METAGSM_EXPORT unsigned metagsm_version(void);
+
+/* NULL if out of memory */
+METAGSM_EXPORT metagsm_t *metagsm_create(void);
+
+/* Raw capture bytes (QMDL, QMDL2 or DLF, detected) in pieces of any size */
+METAGSM_EXPORT int metagsm_feed(metagsm_t *ctx, const void *data, size_t len);
+
+/* End of the capture: decode what is left and close open sessions */
+METAGSM_EXPORT int metagsm_finish(metagsm_t *ctx);
+
+/* 1 and the oldest pending event in ev of size bytes, 0 if there is none */
+METAGSM_EXPORT int metagsm_poll(metagsm_t *ctx, struct metagsm_event *ev, size_t size);
+
+/* Pending events are discarded */
+METAGSM_EXPORT void metagsm_destroy(metagsm_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "diag_input.h"
+#include "dlog.h"
+#include "output.h"
+#include "session.h"
+#include "stream_server.h"
+
+/*
+ * Prometheus text format exporter. One thread accepts scrapes, on TCP or
+ * a unix socket, and answers each from the counters as they are at that
+ * moment; every value is read on its own, so the set is not an atomic
+ * snapshot, but no value is ever torn.
+ */
+
+#define REQUEST_MAX	4096
+
+struct metrics metrics;
+int metrics_enabled = 0;
+
+static struct {
+	int fd;
+	char path[108];		/* unix socket to remove at close */
+	pthread_t thread;
+	time_t start;
+} exporter = {
+	.fd = -1,
+};
+
+struct body {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static void put(struct body *b, const char *fmt, ...)
+{
+	va_list ap;
+	size_t size;
+	char *data;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if (b->len + n < b->size) {
+			b->len += n;
+			return;
+		}
+
+		size = b->size ? 2 * b->size : 16384;
+		while (size <= b->len + n)
+			size *= 2;
+		data = realloc(b->data, size);
+		if (!data)
+			return;
+		b->data = data;
+		b->size = size;
+	}
+}
+
+static uint64_t get(const uint64_t *c)
+{
+	return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+static void put_metric(struct body *b, const char *name, const char *type, const char *help)
+{
+	put(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void format_metrics(struct body *b)
+{
+	static const char *rats[3] = { "gsm", "umts", "lte" };
+	uint64_t pending, dropped, n;
+	unsigned i;
+
+	put_metric(b, "diag_parser_start_time_seconds", "gauge", "Start time since the UNIX epoch");
+	put(b, "diag_parser_start_time_seconds %lld\n", (long long) exporter.start);
+
+	put_metric(b, "diag_parser_frames_total", "counter", "DIAG frames handed to the parser");
+	put(b, "diag_parser_frames_total %llu\n", (unsigned long long) get(&metrics.frames));
+
+	put_metric(b, "diag_parser_bytes_total", "counter", "Bytes of those frames");
+	put(b, "diag_parser_bytes_total %llu\n", (unsigned long long) get(&metrics.bytes));
+
+	put_metric(b, "diag_parser_crc_errors_total", "counter", "HDLC frames with a CRC mismatch");
+	put(b, "diag_parser_crc_errors_total %llu\n", (unsigned long long) get(&metrics.crc_errors));
+
+	put_metric(b, "diag_parser_log_packets_total", "counter", "Log packets by log code");
+	for (i = 0; i < 65536; i++) {
+		n = get(&metrics.codes[i]);
+		if (n)
+			put(b, "diag_parser_log_packets_total{code=\"0x%04x\"} %llu\n", i, (unsigned long long) n);
+	}
+
+	put_metric(b, "diag_parser_messages_total", "counter", "Decoded radio messages by RAT");
+	for (i = 0; i < 3; i++)
+		put(b, "diag_parser_messages_total{rat=\"%s\"} %llu\n", rats[i], (unsigned long long) get(&metrics.messages[i]));
+
+	put_metric(b, "diag_parser_sessions_closed_total", "counter", "Sessions closed");
+	put(b, "diag_parser_sessions_closed_total %llu\n", (unsigned long long) get(&metrics.sessions_closed));
+
+	put_metric(b, "diag_parser_sessions_open", "gauge", "Sessions open (CS and PS)");
+	put(b, "diag_parser_sessions_open %llu\n", (unsigned long long) get(&metrics.sessions_open));
+
+	stream_server_counts(&pending, &dropped);
+
+	put_metric(b, "diag_parser_dropped_total", "counter", "Records or lines dropped because a consumer was too slow");
+	put(b, "diag_parser_dropped_total{queue=\"stream\"} %llu\n", (unsigned long long) dropped);
+	put(b, "diag_parser_dropped_total{queue=\"log\"} %lu\n", dlog_dropped());
+
+	put_metric(b, "diag_parser_queue_depth", "gauge", "Queued output: compressed pcap batches, stream bytes");
+	put(b, "diag_parser_queue_depth{queue=\"pcap\"} %u\n", net_queue_depth());
+	put(b, "diag_parser_queue_depth{queue=\"stream\"} %llu\n", (unsigned long long) pending);
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, data, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		data += ret;
+		len -= ret;
+	}
+}
+
+static void serve(int fd)
+{
+	struct timeval tv = { 1, 0 };
+	char req[REQUEST_MAX + 1];
+	struct body b = { NULL, 0, 0 };
+	char hdr[256];
+	size_t len = 0;
+	ssize_t ret;
+	int hlen;
+
+	/* a client that never finishes its request must not hold us up */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (len < REQUEST_MAX) {
+		ret = recv(fd, req + len, REQUEST_MAX - len, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		len += ret;
+		req[len] = 0;
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = 0;
+
+	if (strncmp(req, "GET ", 4)) {
+		hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n");
+		write_all(fd, hdr, hlen);
+		return;
+	}
+	if (strncmp(req + 4, "/metrics ", 9) && strncmp(req + 4, "/ ", 2)) {
+		hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+		write_all(fd, hdr, hlen);
+		return;
+	}
+
+	format_metrics(&b);
+	hlen = snprintf(hdr, sizeof(hdr),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"\r\n", b.len);
+	write_all(fd, hdr, hlen);
+	write_all(fd, b.data, b.len);
+	free(b.data);
+}
+
+static void *exporter_thread(void *arg)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept(exporter.fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* the listening socket was shut down */
+			break;
+		}
+		serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	/* a socket left behind by an earlier run */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	exporter.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (exporter.fd < 0 || bind(exporter.fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "Cannot bind %s, %s\n", path, strerror(errno));
+		return -1;
+	}
+	snprintf(exporter.path, sizeof(exporter.path), "%s", path);
+
+	return 0;
+}
+
+static int listen_tcp(const char *addr)
+{
+	struct sockaddr_in sin;
+	const char *port;
+	char host[64];
+	int one = 1;
+
+	port = strrchr(addr, ':');
+	if (port) {
+		snprintf(host, sizeof(host), "%.*s", (int) (port - addr), addr);
+		port++;
+	} else {
+		strcpy(host, "127.0.0.1");
+		port = addr;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(strtoul(port, NULL, 10));
+	if (!inet_pton(AF_INET, host, &sin.sin_addr)) {
+		fprintf(stderr, "Invalid metrics address %s\n", addr);
+		return -1;
+	}
+
+	exporter.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (exporter.fd >= 0)
+		setsockopt(exporter.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (exporter.fd < 0 || bind(exporter.fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+		fprintf(stderr, "Cannot bind %s, %s\n", addr, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int metrics_open(const char *addr)
+{
+	int ret;
+
+	if (!strncmp(addr, "unix:", 5))
+		ret = listen_unix(addr + 5);
+	else
+		ret = listen_tcp(addr);
+
+	if (ret < 0 || listen(exporter.fd, 8) < 0) {
+		if (ret == 0)
+			fprintf(stderr, "Cannot listen on %s, %s\n", addr, strerror(errno));
+		goto fail;
+	}
+
+	exporter.start = time(NULL);
+	metrics_enabled = 1;
+
+	if (pthread_create(&exporter.thread, NULL, exporter_thread, NULL)) {
+		fprintf(stderr, "Cannot start metrics thread\n");
+		metrics_enabled = 0;
+		goto fail;
+	}
+
+	if (msg_verbose) {
+		fprintf(stderr, "Metrics on %s\n", addr);
+	}
+
+	return 0;
+
+fail:
+	if (exporter.fd >= 0)
+		close(exporter.fd);
+	if (exporter.path[0])
+		unlink(exporter.path);
+	exporter.fd = -1;
+	exporter.path[0] = 0;
+	return -1;
+}
+
+void metrics_check_crc(const uint8_t *msg, unsigned len)
+{
+	/* too short to carry a CRC */
+	if (len < 3)
+		return;
+
+	if (diag_crc16(msg, len - 2) != (msg[len - 2] | (msg[len - 1] << 8)))
+		metric_add(&metrics.crc_errors, 1);
+}
+
+void metrics_close()
+{
+	if (exporter.fd < 0)
+		return;
+
+	/* wakes up accept() */
+	shutdown(exporter.fd, SHUT_RDWR);
+	pthread_join(exporter.thread, NULL);
+
+	close(exporter.fd);
+	if (exporter.path[0])
+		unlink(exporter.path);
+	exporter.fd = -1;
+	exporter.path[0] = 0;
+	metrics_enabled = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/*
+ * Counters for the Prometheus exporter. Only the decoding thread writes
+ * them, as plain relaxed atomic stores, and the exporter thread reads
+ * them the same way, so a scrape never waits for the decoder or slows
+ * it down. Nothing is counted unless the exporter is running.
+ */
+
+struct metrics {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t crc_errors;		/* HDLC frames with a bad CRC */
+	uint64_t messages[3];		/* decoded messages by RAT */
+	uint64_t sessions_closed;
+	uint64_t sessions_open;		/* gauge, of the default parser */
+	uint64_t codes[65536];		/* log packets by log code */
+};
+
+extern struct metrics metrics;
+extern int metrics_enabled;
+
+static inline void metric_add(uint64_t *c, uint64_t n)
+{
+	__atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_set(uint64_t *c, uint64_t v)
+{
+	__atomic_store_n(c, v, __ATOMIC_RELAXED);
+}
+
+/* A frame handed to the parser */
+static inline void metrics_frame(const uint8_t *msg, unsigned len)
+{
+	if (!metrics_enabled)
+		return;
+
+	metric_add(&metrics.frames, 1);
+	metric_add(&metrics.bytes, len);
+	if (len >= 16 && msg[0] == 0x10 && msg[1] == 0x00)
+		metric_add(&metrics.codes[msg[6] | (msg[7] << 8)], 1);
+}
+
+void metrics_check_crc(const uint8_t *msg, unsigned len);
+
+/* A complete HDLC frame as deframed, with its CRC */
+static inline void metrics_hdlc_frame(const uint8_t *msg, unsigned len)
+{
+	if (metrics_enabled)
+		metrics_check_crc(msg, len);
+}
+
+/* "unix:<path>" or "[<host>:]<port>", host defaults to 127.0.0.1 */
+int metrics_open(const char *addr);
+void metrics_close();
+
+#endif
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -7,8 +8,26 @@
 #include <osmocom/core/gsmtap.h>
 #include <osmocom/core/gsmtap_util.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "callback.h"
+#include "column_export.h"
+#include "diag_decomp.h"
+#include "latency.h"
 #include "output.h"
+#include "probes.h"
+#include "shm_ring.h"
+#include "stream_server.h"
+#include "trace.h"
 
 
 /* Pcap packet header */
@@ -29,65 +48,851 @@ static size_t iptotlen_offset;		/* Ip header total length offset */
 
 static struct gsmtap_inst *gti = NULL;
 
+/*
+ * Background writer. Opening and closing rotated files and compressing
+ * the output are done on a separate thread so the decoder never blocks
+ * on file system latency or on the compressor.
+ *
+ * Compressed output is collected in batches of WR_BATCH bytes. Each
+ * batch becomes one independent zstd frame or gzip member, so readers
+ * can start decompressing at any batch boundary. zstd files end with a
+ * seek table in the zstd seekable format listing the frame sizes.
+ *
+ * The writer thread also wakes up once a second on its own, so a live
+ * capture that went quiet still gets its last batch written out and its
+ * file rotated by --rotate-secs. The decoder holds wr.lock while it adds
+ * a packet, as the timer may swap the current batch and file under it.
+ */
+
+#define WR_JOBS		16
+#define WR_BATCHES	4
+#define WR_BATCH	(1 << 20)
+
+enum wr_job_type {
+	WR_JOB_OPEN,		/* pre-open the next rotated file */
+	WR_JOB_WRITE,		/* compress a batch and write it out */
+	WR_JOB_CLOSE,		/* close and publish a finished rotated file */
+};
+
+struct wr_batch {
+	uint8_t *data;
+	size_t len;
+	time_t started;
+};
+
+struct wr_job {
+	enum wr_job_type type;
+	FILE *f;
+	unsigned seq;
+	struct wr_batch *b;
+};
+
+static struct {
+	int running;
+	enum diag_compression comp;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct wr_job jobs[WR_JOBS];
+	unsigned head, tail;
+	int stop;
+
+	struct wr_batch batch[WR_BATCHES];
+	struct wr_batch *free[WR_BATCHES];
+	unsigned n_free;
+	struct wr_batch *cur;		/* batch the decoder fills */
+
+	/* owned by the writer thread */
+	uint8_t *out;
+	size_t out_len;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+#endif
+	uint32_t (*seek)[2];		/* compressed/uncompressed size per frame */
+	unsigned n_seek, seek_max;
+
+	/* statistics */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	unsigned long batches;
+	unsigned depth_max;
+	unsigned long depth_sum;
+} wr = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Pcap rotation. Files are written as <name>_<seq>.pcap.part and renamed
+ * to <name>_<seq>.pcap once complete, so downstream watchers only ever
+ * see finished files.
+ */
+/* "_<seq>", the extension and ".part" after the base name */
+#define ROT_SUFFIX_MAX	(1 + 10 + 32 + 5)
+
+static struct {
+	int enabled;
+	uint64_t max_size;		/* bytes per file, 0 = unlimited */
+	unsigned max_secs;		/* seconds per file, 0 = unlimited */
+	unsigned long max_count;	/* packets per file, 0 = unlimited */
+
+	char base[FILENAME_MAX - ROT_SUFFIX_MAX];	/* target name without extension */
+	char ext[32];
+	unsigned seq;			/* sequence number of the current file */
+	time_t opened;
+	uint64_t written;
+	unsigned long count;
 
+	FILE *next;			/* pre-opened file for seq + 1 */
+	int next_failed;
+} rot;
 
+static const uint8_t pcap_hdr[24] = {0xd4,0xc3,0xb2,0xa1,
+				     0x02,0x00,0x04,0x00,
+				     0x00,0x00,0x00,0x00,
+				     0x00,0x00,0x00,0x00,
+				     0xff,0xff,0x00,0x00,
+				     0x01,0x00,0x00,0x00};
 
-/* Create a new pcap file */
+/*
+ * pcapng output. Packets are written as Enhanced Packet Blocks holding
+ * the IPv4/UDP/GSMTAP packet with a nanosecond timestamp and the decoded
+ * message info as comment. Each RAT gets its own interface, described
+ * the first time a file carries a packet of it.
+ */
+
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BOM		0x1a2b3c4d
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_IF_NAME		2
+#define PCAPNG_SHB_USERAPPL	4
+#define PCAPNG_IF_TSRESOL	9
+#define LINKTYPE_IPV4		228
+
+#define PCAPNG_RATS		3
+
+static int pcapng = 0;
+static int pcapng_if[PCAPNG_RATS];	/* interface id per RAT in the current file */
+static unsigned pcapng_n_if;
+static uint8_t pcapng_block[65536 + 512];
+
+static const char *pcapng_if_name[PCAPNG_RATS] = {
+	[RAT_GSM] = "GSM",
+	[RAT_UMTS] = "UMTS",
+	[RAT_LTE] = "LTE",
+};
+
+static uint8_t file_hdr[64];		/* pcap or pcapng section header */
+static size_t file_hdr_len;
+
+
+/* Create a new pcap file, compressed files get the header with the first batch */
 static FILE* trace_dump_open(const char *output_file)
 {
 	FILE *handle = NULL;
-	uint8_t pcap_hdr[24] = {0xd4,0xc3,0xb2,0xa1,
-				0x02,0x00,0x04,0x00,
-				0x00,0x00,0x00,0x00,
-				0x00,0x00,0x00,0x00,
-				0xff,0xff,0x00,0x00,
-				0x01,0x00,0x00,0x00};
 	int rc;
 
 	/* Create a new file */
 	handle = fopen(output_file,"w");
 	if (!handle) {
 		fprintf(stderr, "Cannot open pcap file %s, %s\n", output_file, strerror(errno));
-		exit(1);
+		return NULL;
 	}
 
+	if (wr.comp)
+		return handle;
+
 	/* Write header to file */
-	rc = fwrite(pcap_hdr,sizeof(pcap_hdr),1,handle);
+	rc = fwrite(file_hdr,file_hdr_len,1,handle);
 	assert(rc == 1);
 	fflush(handle);
 
 	return handle;
 }
 
+static enum diag_compression output_compression(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (len > 3 && !strcmp(&name[len - 3], ".gz"))
+		return DIAG_COMP_GZIP;
+	if (len > 4 && !strcmp(&name[len - 4], ".zst"))
+		return DIAG_COMP_ZSTD;
+
+	return DIAG_COMP_NONE;
+}
+
+static int output_pcapng(const char *name)
+{
+	size_t len = strlen(name);
+
+	switch (output_compression(name)) {
+	case DIAG_COMP_GZIP:
+		len -= 3;
+		break;
+	case DIAG_COMP_ZSTD:
+		len -= 4;
+		break;
+	default:
+		break;
+	}
+
+	return len > 7 && !strncmp(&name[len - 7], ".pcapng", 7);
+}
+
+static int wr_compress(struct wr_batch *b)
+{
+	switch (wr.comp) {
+#ifdef HAVE_ZLIB
+	case DIAG_COMP_GZIP:
+		deflateReset(&wr.zs);
+		wr.zs.next_in = b->data;
+		wr.zs.avail_in = b->len;
+		wr.zs.next_out = wr.out;
+		wr.zs.avail_out = wr.out_len;
+		if (deflate(&wr.zs, Z_FINISH) != Z_STREAM_END) {
+			fprintf(stderr, "gzip: cannot compress pcap batch\n");
+			return -1;
+		}
+		return wr.out_len - wr.zs.avail_out;
+#endif
+#ifdef HAVE_ZSTD
+	case DIAG_COMP_ZSTD: {
+		size_t ret;
+
+		ret = ZSTD_compressCCtx(wr.cctx, wr.out, wr.out_len, b->data, b->len, 3);
+		if (ZSTD_isError(ret)) {
+			fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+			return -1;
+		}
+		return ret;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+static void wr_write(FILE *f, struct wr_batch *b)
+{
+	int len;
+
+	len = wr_compress(b);
+	if (len < 0)
+		return;
+
+	if (fwrite(wr.out, len, 1, f) != 1) {
+		fprintf(stderr, "Cannot write pcap file, %s\n", strerror(errno));
+		return;
+	}
+	fflush(f);
+
+	if (wr.comp == DIAG_COMP_ZSTD) {
+		if (wr.n_seek == wr.seek_max) {
+			wr.seek_max = wr.seek_max ? 2 * wr.seek_max : 64;
+			wr.seek = realloc(wr.seek, wr.seek_max * sizeof(*wr.seek));
+			assert(wr.seek != NULL);
+		}
+		wr.seek[wr.n_seek][0] = len;
+		wr.seek[wr.n_seek][1] = b->len;
+		wr.n_seek++;
+	}
+
+	wr.bytes_in += b->len;
+	wr.bytes_out += len;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Append the zstd seek table (a skippable frame) and close the file */
+static int wr_close(FILE *f)
+{
+	uint8_t hdr[8], entry[8], footer[9];
+	unsigned i;
+
+	if (wr.comp == DIAG_COMP_ZSTD && wr.n_seek) {
+		put_le32(&hdr[0], 0x184d2a5e);
+		put_le32(&hdr[4], wr.n_seek * sizeof(entry) + sizeof(footer));
+		fwrite(hdr, sizeof(hdr), 1, f);
+		for (i = 0; i < wr.n_seek; i++) {
+			put_le32(&entry[0], wr.seek[i][0]);
+			put_le32(&entry[4], wr.seek[i][1]);
+			fwrite(entry, sizeof(entry), 1, f);
+		}
+		put_le32(&footer[0], wr.n_seek);
+		footer[4] = 0;
+		put_le32(&footer[5], 0x8f92eab1);
+		fwrite(footer, sizeof(footer), 1, f);
+		wr.bytes_out += sizeof(hdr) + wr.n_seek * sizeof(entry) + sizeof(footer);
+	}
+	wr.n_seek = 0;
+
+	return fclose(f);
+}
+
+/* Names always fit FILENAME_MAX, rot.base leaves room for the rest */
+static void rot_name(char *name, size_t len, unsigned seq, int partial)
+{
+	snprintf(name, len, "%s_%05u%s%s", rot.base, seq, rot.ext, partial ? ".part" : "");
+}
+
+/* Queue a job for the writer thread, called with wr.lock held */
+static void wr_queue(enum wr_job_type type, FILE *f, unsigned seq, struct wr_batch *b)
+{
+	unsigned depth;
+
+	while (wr.head - wr.tail == WR_JOBS)
+		pthread_cond_wait(&wr.cond, &wr.lock);
+
+	wr.jobs[wr.head % WR_JOBS].type = type;
+	wr.jobs[wr.head % WR_JOBS].f = f;
+	wr.jobs[wr.head % WR_JOBS].seq = seq;
+	wr.jobs[wr.head % WR_JOBS].b = b;
+	wr.head++;
+	pthread_cond_broadcast(&wr.cond);
+
+	if (type == WR_JOB_WRITE) {
+		depth = WR_BATCHES - wr.n_free;
+		if (depth > wr.depth_max)
+			wr.depth_max = depth;
+		wr.depth_sum += depth;
+		wr.batches++;
+	}
+}
+
+static void wr_tick();
+
+static void *wr_thread(void *arg)
+{
+	char tmp[FILENAME_MAX], final[FILENAME_MAX];
+	struct timespec deadline;
+	struct wr_job job;
+	FILE *f;
+
+	pthread_mutex_lock(&wr.lock);
+	for (;;) {
+		while (wr.head == wr.tail && !wr.stop) {
+			wr_tick();
+			if (wr.head != wr.tail)
+				break;
+			deadline.tv_sec = time(NULL) + 1;
+			deadline.tv_nsec = 0;
+			pthread_cond_timedwait(&wr.cond, &wr.lock, &deadline);
+		}
+		if (wr.head == wr.tail)
+			break;
+
+		job = wr.jobs[wr.tail % WR_JOBS];
+		wr.tail++;
+		pthread_cond_broadcast(&wr.cond);
+		pthread_mutex_unlock(&wr.lock);
+
+		rot_name(tmp, sizeof(tmp), job.seq, 1);
+
+		switch (job.type) {
+		case WR_JOB_OPEN:
+			f = trace_dump_open(tmp);
+			pthread_mutex_lock(&wr.lock);
+			rot.next = f;
+			rot.next_failed = (f == NULL);
+			pthread_cond_broadcast(&wr.cond);
+			pthread_mutex_unlock(&wr.lock);
+			break;
+		case WR_JOB_WRITE:
+			wr_write(job.f, job.b);
+			pthread_mutex_lock(&wr.lock);
+			job.b->len = 0;
+			wr.free[wr.n_free++] = job.b;
+			pthread_cond_broadcast(&wr.cond);
+			pthread_mutex_unlock(&wr.lock);
+			break;
+		case WR_JOB_CLOSE:
+			rot_name(final, sizeof(final), job.seq, 0);
+			if (wr_close(job.f) != 0)
+				fprintf(stderr, "Cannot close pcap file %s, %s\n", tmp, strerror(errno));
+			if (rename(tmp, final) != 0)
+				fprintf(stderr, "Cannot rename %s to %s, %s\n", tmp, final, strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&wr.lock);
+	}
+	pthread_mutex_unlock(&wr.lock);
+
+	return NULL;
+}
+
+/* Take an empty batch for the decoder, called with wr.lock held */
+static void wr_next_batch()
+{
+	while (!wr.n_free)
+		pthread_cond_wait(&wr.cond, &wr.lock);
+	wr.cur = wr.free[--wr.n_free];
+	wr.cur->len = 0;
+	wr.cur->started = time(NULL);
+}
+
+/* Hand the current batch to the writer thread, called with wr.lock held */
+static void wr_flush()
+{
+	if (!wr.comp || !wr.cur->len)
+		return;
+
+	wr_queue(WR_JOB_WRITE, pcap_handle, 0, wr.cur);
+	wr_next_batch();
+}
+
+/* Taken by the decoder around each packet once the writer thread runs */
+static void wr_lock()
+{
+	if (wr.running)
+		pthread_mutex_lock(&wr.lock);
+}
+
+static void wr_unlock()
+{
+	if (wr.running)
+		pthread_mutex_unlock(&wr.lock);
+}
+
+static void trace_write(const void *data, size_t len)
+{
+	int rc;
+
+	if (wr.comp) {
+		memcpy(&wr.cur->data[wr.cur->len], data, len);
+		wr.cur->len += len;
+	} else {
+		rc = fwrite(data, len, 1, pcap_handle);
+		assert(rc == 1);
+	}
+}
+
+static void wr_start()
+{
+	unsigned i;
+
+	if (wr.comp) {
+		for (i = 0; i < WR_BATCHES; i++) {
+			wr.batch[i].data = malloc(WR_BATCH);
+			assert(wr.batch[i].data != NULL);
+			wr.free[wr.n_free++] = &wr.batch[i];
+		}
+		wr_next_batch();
+	}
+
+	switch (wr.comp) {
+#ifdef HAVE_ZLIB
+	case DIAG_COMP_GZIP:
+		/* windowBits 15 + 16 selects the gzip wrapper */
+		if (deflateInit2(&wr.zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			fprintf(stderr, "Cannot initialize gzip compression\n");
+			exit(1);
+		}
+		wr.out_len = deflateBound(&wr.zs, WR_BATCH);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case DIAG_COMP_ZSTD:
+		wr.cctx = ZSTD_createCCtx();
+		if (!wr.cctx) {
+			fprintf(stderr, "Cannot initialize zstd compression\n");
+			exit(1);
+		}
+		wr.out_len = ZSTD_compressBound(WR_BATCH);
+		break;
+#endif
+	default:
+		break;
+	}
+	if (wr.out_len) {
+		wr.out = malloc(wr.out_len);
+		assert(wr.out != NULL);
+	}
+
+	if (pthread_create(&wr.thread, NULL, wr_thread, NULL)) {
+		fprintf(stderr, "Cannot start pcap writer thread\n");
+		exit(1);
+	}
+	wr.running = 1;
+}
+
+/* Stop the writer thread, then close the last file if it was not rotated */
+static void wr_finish(FILE *last)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&wr.lock);
+	wr.stop = 1;
+	pthread_cond_broadcast(&wr.cond);
+	pthread_mutex_unlock(&wr.lock);
+
+	pthread_join(wr.thread, NULL);
+	wr.running = 0;
+
+	if (last && wr_close(last) != 0)
+		fprintf(stderr, "Cannot close pcap file, %s\n", strerror(errno));
+
+	if (msg_verbose && wr.comp && wr.bytes_out) {
+		printf("Pcap %s output: %llu bytes in %lu batches compressed to %llu (ratio %.2f), queue depth max %u avg %.2f\n",
+			diag_compression_name(wr.comp),
+			(unsigned long long) wr.bytes_in, wr.batches,
+			(unsigned long long) wr.bytes_out,
+			(double) wr.bytes_in / wr.bytes_out,
+			wr.depth_max, wr.batches ? (double) wr.depth_sum / wr.batches : 0.0);
+	}
+
+#ifdef HAVE_ZLIB
+	if (wr.comp == DIAG_COMP_GZIP)
+		deflateEnd(&wr.zs);
+#endif
+#ifdef HAVE_ZSTD
+	if (wr.cctx)
+		ZSTD_freeCCtx(wr.cctx);
+	wr.cctx = NULL;
+#endif
+	for (i = 0; i < WR_BATCHES; i++) {
+		free(wr.batch[i].data);
+		wr.batch[i].data = NULL;
+	}
+	wr.n_free = 0;
+	wr.cur = NULL;
+	free(wr.out);
+	wr.out = NULL;
+	wr.out_len = 0;
+	free(wr.seek);
+	wr.seek = NULL;
+	wr.seek_max = 0;
+}
+
+/* Start a new file: compressed output carries the pcap header in its first batch */
+static void trace_file_started()
+{
+	unsigned i;
+
+	if (wr.comp)
+		trace_write(file_hdr, file_hdr_len);
+	for (i = 0; i < PCAPNG_RATS; i++)
+		pcapng_if[i] = -1;
+	pcapng_n_if = 0;
+	rot.opened = time(NULL);
+	rot.written = file_hdr_len;
+	rot.count = 0;
+}
+
+/*
+ * Switch to the pre-opened file once the current one is full, called
+ * with wr.lock held. Until the next file is open the current one is
+ * kept, so neither the decoder nor the timer waits for the file system.
+ */
+static void rot_check(time_t now)
+{
+	FILE *next;
+
+	if (!rot.count)
+		return;
+	if (!((rot.max_size && rot.written >= rot.max_size) ||
+	      (rot.max_count && rot.count >= rot.max_count) ||
+	      (rot.max_secs && now - rot.opened >= (time_t) rot.max_secs)))
+		return;
+
+	next = rot.next;
+	if (!next) {
+		/* keep writing to the current file rather than losing packets */
+		if (rot.next_failed) {
+			rot.next_failed = 0;
+			wr_queue(WR_JOB_OPEN, NULL, rot.seq + 1, NULL);
+		}
+		return;
+	}
+	rot.next = NULL;
+
+	wr_flush();
+	wr_queue(WR_JOB_CLOSE, pcap_handle, rot.seq, NULL);
+	rot.seq++;
+	wr_queue(WR_JOB_OPEN, NULL, rot.seq + 1, NULL);
+
+	pcap_handle = next;
+	trace_file_started();
+}
+
+/*
+ * Timer of the writer thread, called with wr.lock held and the job queue
+ * empty. All batches but the current one are free then and there is
+ * room for the jobs, so nothing here waits for the thread itself.
+ */
+static void wr_tick()
+{
+	time_t now = time(NULL);
+
+	if (wr.comp && wr.cur->len && now != wr.cur->started)
+		wr_flush();
+	if (rot.enabled)
+		rot_check(now);
+}
+
+static FILE *rot_start(const char *target)
+{
+	char tmp[FILENAME_MAX];
+	const char *dot = NULL;
+	size_t len, sfx = 0, base_len, i;
+	FILE *f;
+
+	/* keep a .gz/.zst suffix together with the extension before it */
+	len = strlen(target);
+	if (wr.comp)
+		sfx = strlen(strrchr(target, '.'));
+	for (i = len - sfx; i > 0 && target[i - 1] != '/'; i--) {
+		if (target[i - 1] == '.') {
+			dot = &target[i - 1];
+			break;
+		}
+	}
+
+	if (dot && strlen(dot) >= sizeof(rot.ext))
+		dot = NULL;
+	base_len = dot ? (size_t) (dot - target) : len - sfx;
+
+	/* a truncated name would publish another file than the one written */
+	if (base_len >= sizeof(rot.base) || sfx + 5 >= sizeof(rot.ext)) {
+		fprintf(stderr, "Pcap file name too long for rotation: %s\n", target);
+		exit(1);
+	}
+
+	memcpy(rot.base, target, base_len);
+	rot.base[base_len] = 0;
+	if (dot)
+		strcpy(rot.ext, dot);
+	else
+		snprintf(rot.ext, sizeof(rot.ext), ".pcap%s", &target[len - sfx]);
+
+	rot.seq = 0;
+	rot_name(tmp, sizeof(tmp), rot.seq, 1);
+	f = trace_dump_open(tmp);
+	if (!f) {
+		exit(1);
+	}
+
+	return f;
+}
+
+/* Publish the last file and drop the pre-opened one */
+static void rot_finish()
+{
+	char tmp[FILENAME_MAX];
+
+	pthread_mutex_lock(&wr.lock);
+	wr_queue(WR_JOB_CLOSE, pcap_handle, rot.seq, NULL);
+	pthread_mutex_unlock(&wr.lock);
+
+	wr_finish(NULL);
+
+	if (rot.next) {
+		fclose(rot.next);
+		rot_name(tmp, sizeof(tmp), rot.seq + 1, 1);
+		unlink(tmp);
+		rot.next = NULL;
+	}
+	rot.enabled = 0;
+}
+
+void net_set_rotation(uint64_t max_size, unsigned max_secs, unsigned long max_count)
+{
+	rot.max_size = max_size;
+	rot.max_secs = max_secs;
+	rot.max_count = max_count;
+	rot.enabled = max_size || max_secs || max_count;
+}
+
+/* Make room for a record of len bytes in the current batch */
+static void trace_reserve(size_t len)
+{
+	if (wr.comp && wr.cur->len + len > WR_BATCH)
+		wr_flush();
+}
+
+static void trace_done(size_t len)
+{
+	/* Live inputs should not hold packets back for long */
+	if (!wr.comp)
+		fflush(pcap_handle);
+	else if (time(NULL) != wr.cur->started)
+		wr_flush();
+
+	rot.written += len;
+	rot.count++;
+}
+
 /* Dump a packet into pcap file */
 static void trace_dump(trace_pkthdr_t *header, char *packet)
 {
-	int rc;
 	uint32_t len;
 	uint32_t timestamp[2];
 
 	assert(pcap_handle != NULL);
 	assert(header->caplen == header->len);
 
+	wr_lock();
+	if (rot.enabled)
+		rot_check(time(NULL));
+
+	len = header->caplen;
+
+	trace_reserve(sizeof(timestamp) + 2*sizeof(len) + len);
+
 	/* Write header */
 	timestamp[0] = header->ts.tv_sec;
 	timestamp[1] = 0;
 
-	rc = fwrite(timestamp,sizeof(timestamp),1,pcap_handle);
-	assert(rc == 1);
+	trace_write(timestamp, sizeof(timestamp));
+	trace_write(&len, sizeof(len));
+	trace_write(&len, sizeof(len));
 
-	len = header->caplen;
+	/* Write payload */
+	trace_write(packet, header->caplen);
 
-	rc = fwrite(&len,sizeof(len),1,pcap_handle);
-	assert(rc == 1);
-	rc = fwrite(&len,sizeof(len),1,pcap_handle);
-	assert(rc == 1);
+	trace_done(sizeof(timestamp) + 2*sizeof(len) + header->caplen);
+	wr_unlock();
+}
 
-	/* Write payload */
-	rc = fwrite(packet,header->caplen,1,pcap_handle);
-	assert(rc == 1);
+static size_t put_u16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return sizeof(v);
+}
+
+static size_t put_u32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return sizeof(v);
+}
+
+/* Option with its value padded to 32 bits */
+static size_t pcapng_opt(uint8_t *p, uint16_t code, const void *val, uint16_t len)
+{
+	size_t n = 0;
+
+	n += put_u16(&p[n], code);
+	n += put_u16(&p[n], len);
+	memcpy(&p[n], val, len);
+	n += len;
+	while (n % 4)
+		p[n++] = 0;
+
+	return n;
+}
+
+/* Fill in the block length at both ends, len excludes the trailing copy */
+static size_t pcapng_close_block(uint8_t *p, size_t len)
+{
+	put_u32(&p[4], len + 4);
+	put_u32(&p[len], len + 4);
+
+	return len + 4;
+}
+
+static size_t pcapng_shb(uint8_t *p)
+{
+	static const char appl[] = "diag-parser";
+	size_t n = 0;
+
+	n += put_u32(&p[n], PCAPNG_SHB);
+	n += put_u32(&p[n], 0);
+	n += put_u32(&p[n], PCAPNG_BOM);
+	n += put_u16(&p[n], 1);
+	n += put_u16(&p[n], 0);
+	/* section length not specified */
+	n += put_u32(&p[n], 0xffffffff);
+	n += put_u32(&p[n], 0xffffffff);
+	n += pcapng_opt(&p[n], PCAPNG_SHB_USERAPPL, appl, strlen(appl));
+	n += pcapng_opt(&p[n], PCAPNG_OPT_END, NULL, 0);
+
+	return pcapng_close_block(p, n);
+}
+
+static size_t pcapng_idb(uint8_t *p, uint8_t rat)
+{
+	const char *name = pcapng_if_name[rat];
+	uint8_t tsresol = 9;	/* nanoseconds */
+	size_t n = 0;
+
+	n += put_u32(&p[n], PCAPNG_IDB);
+	n += put_u32(&p[n], 0);
+	n += put_u16(&p[n], LINKTYPE_IPV4);
+	n += put_u16(&p[n], 0);
+	n += put_u32(&p[n], 65535);
+	n += pcapng_opt(&p[n], PCAPNG_IF_NAME, name, strlen(name));
+	n += pcapng_opt(&p[n], PCAPNG_IF_TSRESOL, &tsresol, 1);
+	n += pcapng_opt(&p[n], PCAPNG_OPT_END, NULL, 0);
+
+	return pcapng_close_block(p, n);
+}
+
+static size_t pcapng_epb(uint8_t *p, unsigned if_id, const uint8_t *packet, uint32_t len, const struct radio_message *m)
+{
+	uint64_t ts;
+	size_t n = 0;
+	size_t info_len;
+
+	ts = (uint64_t) m->timestamp.tv_sec * 1000000000 + m->ts_nsec;
+
+	n += put_u32(&p[n], PCAPNG_EPB);
+	n += put_u32(&p[n], 0);
+	n += put_u32(&p[n], if_id);
+	n += put_u32(&p[n], ts >> 32);
+	n += put_u32(&p[n], ts);
+	n += put_u32(&p[n], len);
+	n += put_u32(&p[n], len);
+	memcpy(&p[n], packet, len);
+	n += len;
+	while (n % 4)
+		p[n++] = 0;
+
+	info_len = strnlen(m->info, sizeof(m->info));
+	if (info_len)
+		n += pcapng_opt(&p[n], PCAPNG_OPT_COMMENT, m->info, info_len);
+	n += pcapng_opt(&p[n], PCAPNG_OPT_END, NULL, 0);
+
+	return pcapng_close_block(p, n);
+}
+
+/* Dump a packet into pcapng file, describing its interface first if needed */
+static void trace_dump_ng(const uint8_t *packet, uint32_t len, const struct radio_message *m)
+{
+	size_t n = 0;
 
-	fflush(pcap_handle);
+	assert(pcap_handle != NULL);
+
+	if (m->rat >= PCAPNG_RATS)
+		return;
+
+	wr_lock();
+	if (rot.enabled)
+		rot_check(time(NULL));
+
+	if (pcapng_if[m->rat] < 0) {
+		n += pcapng_idb(&pcapng_block[n], m->rat);
+		pcapng_if[m->rat] = pcapng_n_if++;
+	}
+	n += pcapng_epb(&pcapng_block[n], pcapng_if[m->rat], packet, len, m);
+
+	trace_reserve(n);
+	trace_write(pcapng_block, n);
+	trace_done(n);
+	wr_unlock();
 }
 
 /* IP header checksum calculator */
@@ -119,15 +924,15 @@ static uint16_t ip_checksum(void* vdata,size_t length) {
 }
 
 /* Helper function to write some payload data into the pcap file */
-static void trace_push_payload(unsigned char *payload_data, int payload_len, struct timeval *timestamp)
+static void trace_push_payload(unsigned char *payload_data, int payload_len, struct radio_message *m)
 {
 	struct trace_pkthdr pcap_pkthdr;
 	int ip_hdr_checksum;
 
 	/* Create pcap header */
 	assert(payload_len + gsmtap_offset <= 65535);
-	if(timestamp) {
-		memmove(&pcap_pkthdr.ts,timestamp,sizeof(*timestamp));
+	if(m) {
+		memmove(&pcap_pkthdr.ts,&m->timestamp,sizeof(m->timestamp));
 	} else {
 		pcap_pkthdr.ts.tv_sec = 0;
 		pcap_pkthdr.ts.tv_usec = 0;
@@ -151,8 +956,11 @@ static void trace_push_payload(unsigned char *payload_data, int payload_len, str
 	pcap_buff[iphdrchksum_offset] = (ip_hdr_checksum >> 8) & 0xFF;
 	pcap_buff[iphdrchksum_offset+1] = ip_hdr_checksum & 0xFF;
 
-	/* Dump to pcap file */
-	trace_dump(&pcap_pkthdr, pcap_buff);
+	/* Dump to pcap file, pcapng starts at the IP header */
+	if (pcapng)
+		trace_dump_ng((uint8_t *) &pcap_buff[14], pcap_pkthdr.len - 14, m);
+	else
+		trace_dump(&pcap_pkthdr, pcap_buff);
 }
 
 void net_init(const char *gsmtap_target, const char *pcap_target)
@@ -160,8 +968,41 @@ void net_init(const char *gsmtap_target, const char *pcap_target)
 	/* Avoid double initalization */
 	if(pcap_handle == NULL && pcap_target)
 	{
+		/* Output named .gz or .zst is compressed */
+		wr.comp = output_compression(pcap_target);
+		if (wr.comp && !diag_decomp_supported(wr.comp)) {
+			fprintf(stderr, "Cannot write %s, %s support not built in\n",
+				pcap_target, diag_compression_name(wr.comp));
+			exit(1);
+		}
+
+		/* Output named .pcapng (before any compression suffix) is pcapng */
+		pcapng = output_pcapng(pcap_target);
+		if (pcapng) {
+			file_hdr_len = pcapng_shb(file_hdr);
+		} else {
+			memcpy(file_hdr, pcap_hdr, sizeof(pcap_hdr));
+			file_hdr_len = sizeof(pcap_hdr);
+		}
+
 		/* Create pcap file */
-		pcap_handle = trace_dump_open(pcap_target);
+		if (rot.enabled) {
+			pcap_handle = rot_start(pcap_target);
+		} else {
+			pcap_handle = trace_dump_open(pcap_target);
+			if (!pcap_handle)
+				exit(1);
+		}
+
+		if (rot.enabled || wr.comp) {
+			wr_start();
+			if (rot.enabled) {
+				pthread_mutex_lock(&wr.lock);
+				wr_queue(WR_JOB_OPEN, NULL, rot.seq + 1, NULL);
+				pthread_mutex_unlock(&wr.lock);
+			}
+		}
+		trace_file_started();
 
 		/* Prepare buffer with hand-crafted dummy ethernet+ip+udp header */
 		char dummy_eth_hdr[] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
@@ -191,7 +1032,16 @@ void net_destroy()
 {
 	/* Close pcap file */
 	if (pcap_handle) {
-		fclose(pcap_handle);
+		wr_lock();
+		wr_flush();
+		wr_unlock();
+		if (rot.enabled) {
+			rot_finish();
+		} else if (wr.running) {
+			wr_finish(pcap_handle);
+		} else {
+			fclose(pcap_handle);
+		}
 		pcap_handle = NULL;
 	}
 	if (gti) {
@@ -204,15 +1054,18 @@ void net_destroy()
 }
 
 
-void net_send_msg(struct radio_message *m)
+static void send_msg(struct radio_message *m)
 {
 	struct msgb *msgb = 0;
 	uint8_t gsmtap_channel;
 
-	if (!pcap_handle && !gti)
+	if (!(m->flags & MSG_DECODED))
 		return;
 
-	if (!(m->flags & MSG_DECODED))
+	callback_message(m);
+	column_export_msg(m);
+
+	if (!pcap_handle && !gti && !shm_ring_active() && !stream_server_active())
 		return;
 
 	switch (m->rat) {
@@ -267,8 +1120,12 @@ void net_send_msg(struct radio_message *m)
 	if (msgb) {
 		int del = 1;
 
+		PROBE4(packet, m->rat, m->bb.fn[0], msgb->data_len, m->bb.arfcn[0]);
+		shm_ring_put_msg(m, msgb->data, msgb->data_len);
+		stream_server_msg(m, msgb->data, msgb->data_len);
+
 		if (pcap_handle)
-			trace_push_payload(msgb->data,msgb->data_len,&m->timestamp);
+			trace_push_payload(msgb->data,msgb->data_len,m);
 		if (gti) {
 			int ret = gsmtap_sendmsg(gti, msgb);
 			del = ret != 0;
@@ -278,3 +1135,26 @@ void net_send_msg(struct radio_message *m)
 	}
 }
 
+/* Compressed batches waiting for the writer thread, read without locking */
+unsigned net_queue_depth()
+{
+	unsigned n_free;
+
+	if (!wr.comp)
+		return 0;
+
+	/* one more batch is being filled by the decoder */
+	n_free = __atomic_load_n(&wr.n_free, __ATOMIC_RELAXED);
+	return n_free < WR_BATCHES ? WR_BATCHES - n_free - 1 : 0;
+}
+
+void net_send_msg(struct radio_message *m)
+{
+	uint64_t t = latency_start();
+
+	trace_begin(TRACE_OUTPUT, m->rat);
+	send_msg(m);
+	latency_stop(LATENCY_OUTPUT, t, m->msg_len);
+	trace_end(TRACE_OUTPUT, 0);
+}
+
@@ -3,8 +3,10 @@
 
 #include "session.h"
 
+void net_set_rotation(uint64_t max_size, unsigned max_secs, unsigned long max_count);
 void net_init(const char *gsmtap, const char *pcap);
 void net_destroy();
 void net_send_msg(struct radio_message *m);
+unsigned net_queue_depth();
 
 #endif
@@ -0,0 +1,29 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT (SystemTap/DTrace style) probes of the provider diag_parser, for
+ * bpftrace, perf and SystemTap. A probe is a single nop in the code and
+ * a note in the ELF file; the arguments are plain fields that are
+ * already at hand, so nothing is computed for a probe nobody listens to.
+ * Without sys/sdt.h the probes compile to nothing.
+ *
+ *	frame(len, msg)				DIAG frame received
+ *	dispatch(log_code, len)			log packet dispatched by code
+ *	message(rat, fn, len, flags)		radio message decoded
+ *	session_open(id, domain, rat, fn)	session started
+ *	session_close(id, domain, rat, fn)	session closed, fn the last one
+ *	packet(rat, fn, len, arfcn)		GSMTAP packet written
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE2(name, a, b)		DTRACE_PROBE2(diag_parser, name, a, b)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(diag_parser, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b)		do { } while (0)
+#define PROBE4(name, a, b, c, d)	do { } while (0)
+#endif
+
+#endif
@@ -37,6 +37,8 @@ struct radio_message {
 	uint8_t domain;
 	uint8_t flags;	/* MSG_* */
 	struct timeval timestamp;
+	uint32_t ts_nsec;	/* nanoseconds past timestamp.tv_sec */
+	uint16_t log_code;	/* DIAG log code, 0 if not from DIAG */
 	char info[128];
 	uint8_t chan_nr;
 	uint8_t msg[256];
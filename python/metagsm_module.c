@@ -0,0 +1,538 @@
+/*
+ * Python bindings of libmetagsm.
+ *
+ *	import numpy as np, metagsm
+ *
+ *	p = metagsm.Parser()
+ *	p.feed_file("trace.qmdl")	# or p.feed(bytes_like) in pieces
+ *	p.finish()
+ *	batch = p.messages()		# everything decoded since the last call
+ *	rows = np.asarray(batch)	# structured array, no copy
+ *	l3 = np.asarray(batch.payload)	# all L3 payloads back to back
+ *	first = l3[rows["payload_off"][0]:][:rows["payload_len"][0]]
+ *	p.truncated			# payloads cut to their first 256 bytes
+ *
+ * A Batch exports its rows through the buffer protocol with a PEP 3118
+ * struct format, so NumPy (or anything else that speaks the protocol)
+ * wraps the memory the parser filled in; no Python object is created per
+ * message and NumPy is not needed to build the module.
+ * metagsm.MESSAGE_DTYPE describes the same layout for np.frombuffer().
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metagsm.h"
+
+#define FEED_CHUNK	(1 << 16)
+
+/* One decoded message, 32 bytes without padding */
+struct message_row {
+	uint64_t ts_ns;
+	uint32_t id;
+	uint32_t fn;
+	uint32_t payload_off;
+	uint16_t payload_len;
+	uint16_t arfcn;
+	uint16_t log_code;
+	uint16_t msg_type;
+	uint8_t rat;
+	uint8_t domain;
+	uint8_t flags;
+	uint8_t chan_nr;
+};
+
+#define ROW_FORMAT	"T{<Q:ts_ns:<I:id:<I:fn:<I:payload_off:<H:payload_len:" \
+			"<H:arfcn:<H:log_code:<H:msg_type:B:rat:B:domain:B:flags:B:chan_nr:}"
+
+/* Rows and payload collected between two messages() calls */
+struct collect {
+	struct message_row *rows;
+	Py_ssize_t n_rows, rows_alloc;
+	uint8_t *payload;
+	size_t payload_len, payload_alloc;
+};
+
+typedef struct {
+	PyObject_HEAD
+	metagsm_t *ctx;
+	int busy;
+	struct collect c;
+	PyObject *sessions;	/* list of dicts */
+	unsigned long cell_updates;
+	unsigned long truncated;	/* messages longer than their payload */
+} ParserObject;
+
+typedef struct {
+	PyObject_HEAD
+	struct collect c;
+	Py_ssize_t itemsize;
+} BatchObject;
+
+typedef struct {
+	PyObject_HEAD
+	BatchObject *batch;
+	Py_ssize_t len;
+} PayloadObject;
+
+static PyTypeObject ParserType;
+static PyTypeObject BatchType;
+static PyTypeObject PayloadType;
+
+static int collect_message(struct collect *c, const struct metagsm_message *msg)
+{
+	struct message_row *row;
+	size_t alloc;
+	void *p;
+
+	if (c->n_rows == c->rows_alloc) {
+		alloc = c->rows_alloc ? 2 * c->rows_alloc : 4096;
+		p = realloc(c->rows, alloc * sizeof(*c->rows));
+		if (!p)
+			return -1;
+		c->rows = p;
+		c->rows_alloc = alloc;
+	}
+
+	if (c->payload_len + msg->len > c->payload_alloc) {
+		alloc = c->payload_alloc ? 2 * c->payload_alloc : 65536;
+		p = realloc(c->payload, alloc);
+		if (!p)
+			return -1;
+		c->payload = p;
+		c->payload_alloc = alloc;
+	}
+
+	row = &c->rows[c->n_rows++];
+	row->ts_ns = msg->ts_ns;
+	row->id = msg->id;
+	row->fn = msg->fn;
+	row->payload_off = c->payload_len;
+	row->payload_len = msg->len;
+	row->arfcn = msg->arfcn;
+	row->log_code = msg->log_code;
+	row->msg_type = msg->msg_type;
+	row->rat = msg->rat;
+	row->domain = msg->domain;
+	row->flags = msg->flags;
+	row->chan_nr = msg->chan_nr;
+
+	memcpy(&c->payload[c->payload_len], msg->data, msg->len);
+	c->payload_len += msg->len;
+
+	return 0;
+}
+
+static PyObject *session_dict(const struct metagsm_session *s)
+{
+	return Py_BuildValue("{s:K,s:I,s:I,s:H,s:H,s:H,s:H,s:H,s:H,s:I,"
+			     "s:B,s:B,s:B,s:B,s:B,s:B,s:B,s:B,s:B}",
+		"ts_ns", (unsigned long long) s->ts_ns, "id", s->id, "cid", s->cid,
+		"mcc", s->mcc, "mnc", s->mnc, "lac", s->lac, "psc", s->psc,
+		"arfcn", s->arfcn, "neigh_count", s->neigh_count, "duration", s->duration,
+		"rat", s->rat, "domain", s->domain, "cipher", s->cipher,
+		"integrity", s->integrity, "mo", s->mo, "mt", s->mt,
+		"locupd", s->locupd, "call", s->call, "cracked", s->cracked);
+}
+
+/* Move the pending events of the context into the parser object */
+static int parser_drain(ParserObject *self)
+{
+	struct metagsm_event ev;
+	PyObject *d;
+
+	while (metagsm_poll(self->ctx, &ev, sizeof(ev))) {
+		switch (ev.type) {
+		case METAGSM_EVENT_MESSAGE:
+			if (collect_message(&self->c, &ev.u.msg) < 0) {
+				PyErr_NoMemory();
+				return -1;
+			}
+			if (ev.u.msg.msg_len > ev.u.msg.len)
+				self->truncated++;
+			break;
+		case METAGSM_EVENT_SESSION_CLOSE:
+			d = session_dict(&ev.u.session);
+			if (!d || PyList_Append(self->sessions, d) < 0) {
+				Py_XDECREF(d);
+				return -1;
+			}
+			Py_DECREF(d);
+			break;
+		case METAGSM_EVENT_CELL_UPDATE:
+			self->cell_updates++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int parser_enter(ParserObject *self)
+{
+	if (!self->ctx) {
+		PyErr_SetString(PyExc_RuntimeError, "Parser is not initialized");
+		return -1;
+	}
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "Parser is in use by another thread");
+		return -1;
+	}
+	self->busy = 1;
+	return 0;
+}
+
+static int Parser_init(ParserObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { NULL };
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+		return -1;
+
+	if (self->ctx)
+		return 0;
+
+	self->ctx = metagsm_create();
+	if (!self->ctx) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	self->sessions = PyList_New(0);
+	return self->sessions ? 0 : -1;
+}
+
+static void Parser_dealloc(ParserObject *self)
+{
+	if (self->ctx)
+		metagsm_destroy(self->ctx);
+	free(self->c.rows);
+	free(self->c.payload);
+	Py_XDECREF(self->sessions);
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Parser_feed(ParserObject *self, PyObject *arg)
+{
+	Py_buffer view;
+	int ret;
+
+	if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0)
+		return NULL;
+	if (parser_enter(self) < 0) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	metagsm_feed(self->ctx, view.buf, view.len);
+	Py_END_ALLOW_THREADS
+
+	ret = parser_drain(self);
+	self->busy = 0;
+	PyBuffer_Release(&view);
+
+	if (ret < 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *Parser_feed_file(ParserObject *self, PyObject *args)
+{
+	PyObject *path;
+	uint8_t *buf;
+	FILE *f;
+	size_t len;
+	int ret = 0;
+
+	if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path))
+		return NULL;
+
+	f = fopen(PyBytes_AS_STRING(path), "rb");
+	if (!f) {
+		PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+		Py_DECREF(path);
+		return NULL;
+	}
+	Py_DECREF(path);
+
+	buf = malloc(FEED_CHUNK);
+	if (!buf) {
+		fclose(f);
+		return PyErr_NoMemory();
+	}
+	if (parser_enter(self) < 0) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+
+	for (;;) {
+		Py_BEGIN_ALLOW_THREADS
+		len = fread(buf, 1, FEED_CHUNK, f);
+		if (len)
+			metagsm_feed(self->ctx, buf, len);
+		Py_END_ALLOW_THREADS
+
+		if (!len || (ret = parser_drain(self)) < 0)
+			break;
+	}
+
+	if (!ret && ferror(f)) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		ret = -1;
+	}
+	self->busy = 0;
+	free(buf);
+	fclose(f);
+
+	if (ret < 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *Parser_finish(ParserObject *self, PyObject *unused)
+{
+	int ret;
+
+	if (parser_enter(self) < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	metagsm_finish(self->ctx);
+	Py_END_ALLOW_THREADS
+
+	ret = parser_drain(self);
+	self->busy = 0;
+
+	if (ret < 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *Parser_messages(ParserObject *self, PyObject *unused)
+{
+	BatchObject *b;
+
+	if (parser_enter(self) < 0)
+		return NULL;
+
+	b = PyObject_New(BatchObject, &BatchType);
+	if (b) {
+		/* the batch takes over the buffers */
+		b->c = self->c;
+		b->itemsize = sizeof(struct message_row);
+		memset(&self->c, 0, sizeof(self->c));
+	}
+	self->busy = 0;
+
+	return (PyObject *) b;
+}
+
+static PyObject *Parser_sessions(ParserObject *self, PyObject *unused)
+{
+	PyObject *list = self->sessions;
+
+	self->sessions = PyList_New(0);
+	if (!self->sessions) {
+		self->sessions = list;
+		return NULL;
+	}
+
+	return list;
+}
+
+static PyObject *Parser_get_cell_updates(ParserObject *self, void *closure)
+{
+	return PyLong_FromUnsignedLong(self->cell_updates);
+}
+
+static PyObject *Parser_get_truncated(ParserObject *self, void *closure)
+{
+	return PyLong_FromUnsignedLong(self->truncated);
+}
+
+static PyMethodDef Parser_methods[] = {
+	{ "feed", (PyCFunction) Parser_feed, METH_O,
+	  "feed(data)\n\nDecode a piece of a capture from any bytes-like object." },
+	{ "feed_file", (PyCFunction) Parser_feed_file, METH_VARARGS,
+	  "feed_file(path)\n\nDecode a whole capture file." },
+	{ "finish", (PyCFunction) Parser_finish, METH_NOARGS,
+	  "finish()\n\nEnd of the capture: decode what is left and close the sessions." },
+	{ "messages", (PyCFunction) Parser_messages, METH_NOARGS,
+	  "messages() -> Batch\n\nMessages decoded since the last call." },
+	{ "sessions", (PyCFunction) Parser_sessions, METH_NOARGS,
+	  "sessions() -> list of dict\n\nSessions closed since the last call." },
+	{ NULL }
+};
+
+static PyGetSetDef Parser_getset[] = {
+	{ "cell_updates", (getter) Parser_get_cell_updates, NULL,
+	  "Number of serving cell changes seen", NULL },
+	{ "truncated", (getter) Parser_get_truncated, NULL,
+	  "Number of messages whose payload was cut to its first 256 bytes", NULL },
+	{ NULL }
+};
+
+static PyTypeObject ParserType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "metagsm.Parser",
+	.tp_basicsize = sizeof(ParserObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Parser()\n\nDIAG parser context with its own sessions.",
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc) Parser_init,
+	.tp_dealloc = (destructor) Parser_dealloc,
+	.tp_methods = Parser_methods,
+	.tp_getset = Parser_getset,
+};
+
+static int Batch_getbuffer(BatchObject *self, Py_buffer *view, int flags)
+{
+	/* shape and strides point into the batch, which outlives the view */
+	view->obj = (PyObject *) self;
+	view->buf = self->c.rows;
+	view->len = self->c.n_rows * self->itemsize;
+	view->readonly = 1;
+	view->itemsize = self->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? ROW_FORMAT : NULL;
+	view->ndim = 1;
+	view->shape = (flags & PyBUF_ND) ? &self->c.n_rows : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->itemsize : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+
+	if (flags & PyBUF_WRITABLE) {
+		PyErr_SetString(PyExc_BufferError, "Batch is read-only");
+		view->obj = NULL;
+		return -1;
+	}
+
+	Py_INCREF(self);
+	return 0;
+}
+
+static PyBufferProcs Batch_as_buffer = {
+	.bf_getbuffer = (getbufferproc) Batch_getbuffer,
+};
+
+static void Batch_dealloc(BatchObject *self)
+{
+	free(self->c.rows);
+	free(self->c.payload);
+	PyObject_Free(self);
+}
+
+static Py_ssize_t Batch_len(BatchObject *self)
+{
+	return self->c.n_rows;
+}
+
+static PyObject *Batch_get_payload(BatchObject *self, void *closure)
+{
+	PayloadObject *p;
+
+	p = PyObject_New(PayloadObject, &PayloadType);
+	if (!p)
+		return NULL;
+
+	Py_INCREF(self);
+	p->batch = self;
+	p->len = self->c.payload_len;
+
+	return (PyObject *) p;
+}
+
+static PySequenceMethods Batch_as_sequence = {
+	.sq_length = (lenfunc) Batch_len,
+};
+
+static PyGetSetDef Batch_getset[] = {
+	{ "payload", (getter) Batch_get_payload, NULL,
+	  "L3 payloads of all rows, as a bytes-like object", NULL },
+	{ NULL }
+};
+
+static PyTypeObject BatchType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "metagsm.Batch",
+	.tp_basicsize = sizeof(BatchObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Decoded messages, one MESSAGE_DTYPE row each, exported through the buffer protocol.",
+	.tp_dealloc = (destructor) Batch_dealloc,
+	.tp_as_buffer = &Batch_as_buffer,
+	.tp_as_sequence = &Batch_as_sequence,
+	.tp_getset = Batch_getset,
+};
+
+static int Payload_getbuffer(PayloadObject *self, Py_buffer *view, int flags)
+{
+	return PyBuffer_FillInfo(view, (PyObject *) self, self->batch->c.payload, self->len, 1, flags);
+}
+
+static PyBufferProcs Payload_as_buffer = {
+	.bf_getbuffer = (getbufferproc) Payload_getbuffer,
+};
+
+static void Payload_dealloc(PayloadObject *self)
+{
+	Py_DECREF(self->batch);
+	PyObject_Free(self);
+}
+
+static PyTypeObject PayloadType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "metagsm.Payload",
+	.tp_basicsize = sizeof(PayloadObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Payload bytes of a Batch.",
+	.tp_dealloc = (destructor) Payload_dealloc,
+	.tp_as_buffer = &Payload_as_buffer,
+};
+
+static struct PyModuleDef metagsm_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "metagsm",
+	.m_doc = "Decode Qualcomm DIAG captures with libmetagsm.",
+	.m_size = -1,
+};
+
+/* numpy dtype spec of struct message_row, usable without importing numpy here */
+static PyObject *message_dtype()
+{
+	return Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+		"ts_ns", "<u8", "id", "<u4", "fn", "<u4", "payload_off", "<u4",
+		"payload_len", "<u2", "arfcn", "<u2", "log_code", "<u2", "msg_type", "<u2",
+		"rat", "u1", "domain", "u1", "flags", "u1", "chan_nr", "u1");
+}
+
+PyMODINIT_FUNC PyInit_metagsm(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&ParserType) < 0 || PyType_Ready(&BatchType) < 0 ||
+	    PyType_Ready(&PayloadType) < 0)
+		return NULL;
+
+	m = PyModule_Create(&metagsm_module);
+	if (!m)
+		return NULL;
+
+	Py_INCREF(&ParserType);
+	Py_INCREF(&BatchType);
+	if (PyModule_AddObject(m, "Parser", (PyObject *) &ParserType) < 0 ||
+	    PyModule_AddObject(m, "Batch", (PyObject *) &BatchType) < 0 ||
+	    PyModule_AddObject(m, "MESSAGE_DTYPE", message_dtype()) < 0 ||
+	    PyModule_AddIntConstant(m, "API_VERSION", metagsm_version()) < 0) {
+		Py_DECREF(m);
+		return NULL;
+	}
+
+	return m;
+}
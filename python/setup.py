@@ -0,0 +1,24 @@
+# Build in place against the shared library of the parent directory:
+#
+#	make libmetagsm.so
+#	cd python && python3 setup.py build_ext --inplace
+#
+# At run time libmetagsm.so.1 has to be found by the dynamic loader,
+# e.g. through LD_LIBRARY_PATH or by installing it.
+
+from setuptools import setup, Extension
+
+setup(
+    name="metagsm",
+    version="1.0",
+    description="Decode Qualcomm DIAG captures with libmetagsm",
+    ext_modules=[
+        Extension(
+            "metagsm",
+            sources=["metagsm_module.c"],
+            include_dirs=[".."],
+            library_dirs=[".."],
+            libraries=["metagsm"],
+        )
+    ],
+)
@@ -0,0 +1,103 @@
+# Tests of the metagsm module that need no capture: the parser must take
+# empty and garbage input without decoding anything, batches must export
+# the documented row layout, and errors must surface as exceptions.
+# Set METAGSM_CAPTURE to a capture file to also check that feeding it in
+# pieces decodes the same as feeding the whole file.
+#
+#	make python-check
+#	METAGSM_CAPTURE=trace.qmdl make python-check
+
+import os
+import struct
+import unittest
+
+import metagsm
+
+ROW_SIZE = 32
+STRUCT_CODES = {"u1": "B", "u2": "H", "u4": "I", "u8": "Q"}
+
+
+def rows(batch):
+    return memoryview(batch).cast("B").tobytes()
+
+
+class ParserTest(unittest.TestCase):
+    def test_layout(self):
+        names = [name for name, _ in metagsm.MESSAGE_DTYPE]
+        self.assertEqual(names[:3], ["ts_ns", "id", "fn"])
+        fmt = "<" + "".join(STRUCT_CODES[t.lstrip("<")] for _, t in metagsm.MESSAGE_DTYPE)
+        self.assertEqual(struct.calcsize(fmt), ROW_SIZE)
+        self.assertGreater(metagsm.API_VERSION, 0)
+
+    def test_empty(self):
+        p = metagsm.Parser()
+        p.feed(b"")
+        p.finish()
+        batch = p.messages()
+        self.assertEqual(len(batch), 0)
+        view = memoryview(batch)
+        self.assertEqual(view.itemsize, ROW_SIZE)
+        self.assertEqual(view.nbytes, 0)
+        self.assertTrue(view.readonly)
+        self.assertEqual(len(memoryview(batch.payload)), 0)
+        self.assertEqual(p.sessions(), [])
+        self.assertEqual(p.cell_updates, 0)
+        self.assertEqual(p.truncated, 0)
+
+    def test_garbage(self):
+        p = metagsm.Parser()
+        data = bytes(range(256)) * 64
+        p.feed(data)
+        p.feed(bytearray(b"\x7e" * 100))
+        p.feed(memoryview(data)[1000:3000])
+        p.finish()
+        self.assertEqual(len(p.messages()), 0)
+        self.assertEqual(p.sessions(), [])
+
+    def test_messages_drains(self):
+        p = metagsm.Parser()
+        p.finish()
+        p.messages()
+        self.assertEqual(len(p.messages()), 0)
+        self.assertEqual(p.sessions(), [])
+
+    def test_errors(self):
+        p = metagsm.Parser()
+        with self.assertRaises(TypeError):
+            p.feed(42)
+        with self.assertRaises(OSError):
+            p.feed_file("/nonexistent/capture.qmdl")
+
+    def test_independent(self):
+        a, b = metagsm.Parser(), metagsm.Parser()
+        a.feed(b"\x00" * 100)
+        b.finish()
+        a.finish()
+        self.assertEqual(len(a.messages()), 0)
+        self.assertEqual(len(b.messages()), 0)
+
+    @unittest.skipUnless(os.environ.get("METAGSM_CAPTURE"), "METAGSM_CAPTURE not set")
+    def test_capture_pieces(self):
+        path = os.environ["METAGSM_CAPTURE"]
+
+        whole = metagsm.Parser()
+        whole.feed_file(path)
+        whole.finish()
+        expected = whole.messages()
+
+        pieces = metagsm.Parser()
+        with open(path, "rb") as f:
+            data = f.read()
+        for i in range(0, len(data), 1000):
+            pieces.feed(data[i:i + 1000])
+        pieces.finish()
+        got = pieces.messages()
+
+        self.assertGreater(len(expected), 0)
+        self.assertEqual(len(got), len(expected))
+        self.assertEqual(rows(got), rows(expected))
+        self.assertEqual(bytes(got.payload), bytes(expected.payload))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,6 +1,11 @@
 #include "session.h"
 #include "output.h"
 #include "bit_func.h"
+#include "sqlite_store.h"
+#include "callback.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "probes.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,9 +44,6 @@ void session_init(unsigned start_sid, int console, const char *gsmtap_target, co
 {
 	output_console = console;
 
-	// Reset both domains
-	memset(_s, 0, sizeof(_s));
-
 	switch (callback) {
 	case CALLBACK_NONE:
 		break;
@@ -49,28 +51,39 @@ void session_init(unsigned start_sid, int console, const char *gsmtap_target, co
 
 	s_id = start_sid;
 
-	_s[0].id = s_id++;
-	_s[1].id = s_id++;
-	_s[1].domain = DOMAIN_PS;
+	session_pair_init(_s);
 
 	net_init(gsmtap_target, pcap_target);
 }
 
 void session_destroy(unsigned *last_sid, unsigned *last_cid)
 {
-	if (msg_verbose > 1) {
-		printf("session_destroy!\n");
-	}
+	DLOG(DLOG_SESSION, DLOG_DEBUG, "session_destroy!\n");
 
-	session_reset(&_s[0], 1);
-	_s[1].new_msg = NULL;
-	session_reset(&_s[1], 1);
+	session_pair_destroy(_s);
 	*last_sid = s_id;
 
 	net_destroy();
 }
 
-struct session_info *session_create(int id, char* name, uint8_t *key, int mcc, int mnc, int lac, int cid, struct gsm_sysinfo_freq *ca)
+/* Reset both domains of a CS/PS session pair */
+void session_pair_init(struct session_info *s)
+{
+	memset(s, 0, 2 * sizeof(struct session_info));
+
+	s[0].id = s_id++;
+	s[1].id = s_id++;
+	s[1].domain = DOMAIN_PS;
+}
+
+void session_pair_destroy(struct session_info *s)
+{
+	session_reset(&s[0], 1);
+	s[1].new_msg = NULL;
+	session_reset(&s[1], 1);
+}
+
+struct session_info *session_create(int id, char* name, uint8_t *key, int mcc, int mnc, int lac, int cid, const struct arfcn_set *ca)
 {
 	struct session_info *ns;
 
@@ -108,7 +121,7 @@ struct session_info *session_create(int id, char* name, uint8_t *key, int mcc, i
 
 	/* Store cell ARFCNs */
 	if (ca)
-		memcpy(ns->cell_arfcns, ca, 1024*sizeof(struct gsm_sysinfo_freq));
+		ns->cell_arfcns = *ca;
 
 	ns->decoded = 1;
 
@@ -186,19 +199,18 @@ void session_close(struct session_info *s)
 	}
 	s->cipher_delta *= 4.615f;
 
-#if 0
 	/* Process neighbour list */
-	s->neigh_count = 0;
-	for (i=0; i<1024; i++) {
-		if (s->neigh_arfcns[i].mask) {
-			s->neigh_count++;
-		}
-	}
-#endif
+	s->neigh_count = arfcn_set_count(&s->neigh_arfcns);
 
 	s->closed = 1;
 }
 
+/* Keep a closed session in the configured database */
+void session_store(struct session_info *s)
+{
+	sqlite_store_session(s);
+}
+
 void session_reset(struct session_info *s, int forced_release)
 {
 	struct session_info old_s;
@@ -207,9 +219,7 @@ void session_reset(struct session_info *s, int forced_release)
 	if (auto_reset == 0) {
 		return;
 	}
-	if (msg_verbose > 1) {
-		printf("Session RESET! domain: %d, forced release: %d\n", s->domain, forced_release);
-	}
+	DLOG(DLOG_SESSION, DLOG_DEBUG, "Session RESET! domain: %d, forced release: %d\n", s->domain, forced_release);
 
 	assert(s != NULL);
 
@@ -227,24 +237,31 @@ void session_reset(struct session_info *s, int forced_release)
 	if (s->started && !s->closed) {
 		switch (s->rat) {
 		case RAT_GSM:
-			printf("RAT: GSM\n");
+			DLOG(DLOG_SESSION, DLOG_NOTICE, "RAT: GSM\n");
 			break;
 		case RAT_UMTS:
-			printf("RAT: 3G\n");
+			DLOG(DLOG_SESSION, DLOG_NOTICE, "RAT: 3G\n");
 			break;
 		case RAT_LTE:
-			printf("RAT: LTE\n");
+			DLOG(DLOG_SESSION, DLOG_NOTICE, "RAT: LTE\n");
 			break;
 		default:
-			printf("RAT: UNKNOWN\n");
+			DLOG(DLOG_SESSION, DLOG_NOTICE, "RAT: UNKNOWN\n");
 		}
-		fflush(stdout);
 		s->cracked = 1;
 		session_close(s);
 	}
 
 	memcpy(&old_s, s, sizeof(struct session_info));
 
+	if (old_s.started && old_s.closed) {
+		session_store(&old_s);
+		callback_session_close(&old_s);
+		if (metrics_enabled)
+			metric_add(&metrics.sessions_closed, 1);
+		PROBE4(session_close, old_s.id, old_s.domain, old_s.rat, old_s.last_fn);
+	}
+
 	//Set up 's'
 	memset(s, 0, sizeof(struct session_info));
 	if (old_s.started && old_s.closed) {
@@ -265,6 +282,7 @@ void session_reset(struct session_info *s, int forced_release)
 		s->cid = old_s.cid;
 	}
 	s->arfcn = old_s.arfcn;
+	s->neigh_arfcns = old_s.neigh_arfcns;
 
 	if (forced_release) {
 		s->new_msg = m;
@@ -280,9 +298,7 @@ void session_reset(struct session_info *s, int forced_release)
 	/* Free allocated memory */
 
 	//TODO remove the check below, it's *expensive*
-	if (msg_verbose > 2) {
-		printf("session reset (at the end of the function), domain: %d\n", old_s.domain);
-	}
+	DLOG(DLOG_SESSION, DLOG_TRACE, "session reset (at the end of the function), domain: %d\n", old_s.domain);
 }
 
 static uint32_t parse_appid(const char *filename)
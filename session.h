@@ -8,6 +8,7 @@
 
 #include "process.h"
 #include "assignment.h"
+#include "arfcn_set.h"
 
 struct frame_count {
 	uint32_t unenc;
@@ -119,7 +120,7 @@ struct session_info {
 	uint8_t use_imsi;
 	uint8_t use_jump;
 	float r_time;
-	struct gsm_assignment ga;
+	struct gsm_assignment ga __attribute__((aligned(8)));
 	struct frame_count fc;
 	uint8_t last_dtap[256];
 	uint8_t last_dtap_len;
@@ -127,7 +128,9 @@ struct session_info {
 	struct radio_message *new_msg;
 	struct session_info *next;
 	struct session_info *prev;
-	struct gsm_sysinfo_freq cell_arfcns[1024];
+	/* aligned, so pointers to them may be passed to arfcn_set_*() */
+	struct arfcn_set cell_arfcns __attribute__((aligned(8)));
+	struct arfcn_set neigh_arfcns __attribute__((aligned(8)));
 	struct cell_info *ci;
 	int output_gsmtap;
 } __attribute__((packed));
@@ -143,7 +146,9 @@ struct session_info {
 
 void session_init(unsigned start_sid, int console, const char *gsmtap_target, const char *pcap_target, int callback);
 void session_destroy();
-struct session_info *session_create(int id, char* name, uint8_t *key, int mcc, int mnc, int lac, int cid, struct gsm_sysinfo_freq *ca);
+void session_pair_init(struct session_info *s);
+void session_pair_destroy(struct session_info *s);
+struct session_info *session_create(int id, char* name, uint8_t *key, int mcc, int mnc, int lac, int cid, const struct arfcn_set *ca);
 void session_close(struct session_info *s);
 void session_store(struct session_info *s);
 void session_reset(struct session_info *s, int forced_release);
@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_ring.h"
+#include "process.h"
+
+/*
+ * The producer publishes head with release semantics after a record is
+ * complete. Before it overwrites old records it moves tail past them and
+ * issues a release fence, so a reader that copied a record and then
+ * still finds it at or after tail (behind an acquire fence) knows the
+ * copy is intact. The reader side is in shm_ring_reader.c.
+ */
+
+static struct {
+	int fd;
+	char name[256];
+	struct shm_ring_hdr *hdr;
+	uint8_t *data;
+	size_t map_len;
+	uint64_t size;
+	uint64_t head;
+	uint64_t tail;
+} ring = {
+	.fd = -1,
+};
+
+int shm_ring_create(const char *name, uint64_t size)
+{
+	uint64_t s;
+
+	/* round up to a power of two */
+	for (s = 4096; s < size; s <<= 1)
+		;
+
+	shm_ring_path(ring.name, sizeof(ring.name), name);
+	ring.fd = shm_open(ring.name, O_RDWR | O_CREAT, 0644);
+	if (ring.fd < 0) {
+		fprintf(stderr, "Cannot create shared memory %s, %s\n", ring.name, strerror(errno));
+		return -1;
+	}
+
+	ring.map_len = sizeof(struct shm_ring_hdr) + s;
+	if (ftruncate(ring.fd, 0) < 0 || ftruncate(ring.fd, ring.map_len) < 0) {
+		fprintf(stderr, "Cannot size shared memory %s, %s\n", ring.name, strerror(errno));
+		goto fail;
+	}
+
+	ring.hdr = mmap(NULL, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, 0);
+	if (ring.hdr == MAP_FAILED) {
+		fprintf(stderr, "Cannot map shared memory %s, %s\n", ring.name, strerror(errno));
+		ring.hdr = NULL;
+		goto fail;
+	}
+	ring.data = (uint8_t *) (ring.hdr + 1);
+	ring.size = s;
+	ring.head = 0;
+	ring.tail = 0;
+
+	ring.hdr->size = s;
+	ring.hdr->seq = 1;
+	ring.hdr->version = SHM_RING_VERSION;
+	/* readers check the magic last */
+	__atomic_store_n(&ring.hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+
+fail:
+	close(ring.fd);
+	shm_unlink(ring.name);
+	ring.fd = -1;
+	return -1;
+}
+
+int shm_ring_active()
+{
+	return ring.hdr != NULL;
+}
+
+/* Drop the oldest records until the ring has room up to end */
+static void reserve(uint64_t end)
+{
+	const struct shm_ring_rec *rec;
+
+	if (end - ring.tail <= ring.size)
+		return;
+
+	while (end - ring.tail > ring.size) {
+		rec = (const struct shm_ring_rec *) &ring.data[ring.tail & (ring.size - 1)];
+		ring.tail += SHM_REC_STRIDE(rec->len);
+	}
+
+	__atomic_store_n(&ring.hdr->tail, ring.tail, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void put_rec(uint32_t type, const void *a, unsigned a_len, const void *b, unsigned b_len)
+{
+	struct shm_ring_rec *rec;
+	uint64_t off, need, room;
+
+	need = SHM_REC_STRIDE(sizeof(*rec) + a_len + b_len);
+	if (need > ring.size)
+		return;
+
+	/* records do not wrap, pad out the end of the ring */
+	off = ring.head & (ring.size - 1);
+	room = ring.size - off;
+	if (room < need) {
+		reserve(ring.head + room);
+		rec = (struct shm_ring_rec *) &ring.data[off];
+		rec->len = room;
+		rec->type = SHM_REC_PAD;
+		rec->seq = 0;
+		ring.head += room;
+		off = 0;
+	}
+
+	reserve(ring.head + need);
+	rec = (struct shm_ring_rec *) &ring.data[off];
+	rec->len = sizeof(*rec) + a_len + b_len;
+	rec->type = type;
+	rec->seq = ring.hdr->seq++;
+	memcpy(&ring.data[off + sizeof(*rec)], a, a_len);
+	if (b_len)
+		memcpy(&ring.data[off + sizeof(*rec) + a_len], b, b_len);
+
+	ring.head += need;
+	__atomic_store_n(&ring.hdr->head, ring.head, __ATOMIC_RELEASE);
+}
+
+void shm_ring_put_msg(const struct radio_message *m, const uint8_t *gsmtap, unsigned len)
+{
+	struct shm_ring_msg rm;
+
+	if (!ring.hdr)
+		return;
+
+	rm.ts_ns = (uint64_t) m->timestamp.tv_sec * 1000000000 + m->ts_nsec;
+	rm.id = m->id;
+	rm.fn = m->bb.fn[0];
+	rm.arfcn = m->bb.arfcn[0];
+	rm.len = len;
+	rm.rat = m->rat;
+	rm.domain = m->domain;
+	rm.flags = m->flags;
+	rm.chan_nr = m->chan_nr;
+
+	put_rec(SHM_REC_MSG, &rm, sizeof(rm), gsmtap, len);
+}
+
+void shm_ring_destroy()
+{
+	if (!ring.hdr)
+		return;
+
+	__atomic_store_n(&ring.hdr->closed, 1, __ATOMIC_RELEASE);
+	munmap(ring.hdr, ring.map_len);
+	close(ring.fd);
+	/* attached readers keep their mapping */
+	shm_unlink(ring.name);
+	ring.hdr = NULL;
+	ring.data = NULL;
+	ring.fd = -1;
+}
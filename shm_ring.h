@@ -0,0 +1,84 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Shared memory ring of variable length records, written by one
+ * producer and read by any number of consumers without system calls.
+ * The producer never waits for readers: when the ring is full the
+ * oldest records are overwritten and readers that fall behind skip
+ * ahead and count the lost records.
+ *
+ * Layout of the shared object: struct shm_ring_hdr, then size bytes of
+ * data. Every record starts on a 16 byte boundary with a
+ * struct shm_ring_rec and is padded to a multiple of 16 bytes; records
+ * never wrap, the space left at the end of the ring is filled with a
+ * SHM_REC_PAD record instead.
+ */
+
+#define SHM_RING_MAGIC		0x474e5244	/* "DRNG" */
+#define SHM_RING_VERSION	1
+#define SHM_RING_SIZE		(16 << 20)	/* default data size */
+
+#define SHM_REC_PAD		0
+#define SHM_REC_MSG		1	/* struct shm_ring_msg + GSMTAP packet */
+
+#define SHM_REC_ALIGN		16
+#define SHM_REC_STRIDE(len)	(((len) + SHM_REC_ALIGN - 1) & ~(uint64_t) (SHM_REC_ALIGN - 1))
+
+struct shm_ring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		/* data bytes, a power of two */
+	uint64_t head;		/* bytes written in total, end of the newest record */
+	uint64_t tail;		/* start of the oldest record still intact */
+	uint64_t seq;		/* sequence number of the next record */
+	uint32_t closed;	/* set when the producer is done */
+	uint32_t pad[7];
+} __attribute__((packed, aligned(64)));
+
+struct shm_ring_rec {
+	uint32_t len;		/* record length including this header */
+	uint32_t type;		/* SHM_REC_* */
+	uint64_t seq;		/* gaps mean dropped records, 0 for padding */
+} __attribute__((packed));
+
+/* Metadata in front of each GSMTAP packet */
+struct shm_ring_msg {
+	uint64_t ts_ns;		/* nanoseconds since the UNIX epoch */
+	uint32_t id;
+	uint32_t fn;
+	uint16_t arfcn;
+	uint16_t len;		/* GSMTAP header and payload bytes that follow */
+	uint8_t rat;
+	uint8_t domain;
+	uint8_t flags;
+	uint8_t chan_nr;
+} __attribute__((packed));
+
+struct radio_message;
+struct shm_ring_reader;
+
+/* Name of the shared memory object, with the leading slash shm_open() wants */
+static inline void shm_ring_path(char *buf, size_t len, const char *name)
+{
+	snprintf(buf, len, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/* Producer, in shm_ring.c */
+int shm_ring_create(const char *name, uint64_t size);
+void shm_ring_put_msg(const struct radio_message *m, const uint8_t *gsmtap, unsigned len);
+int shm_ring_active();
+void shm_ring_destroy();
+
+/* Consumer, in shm_ring_reader.c which needs only libc and this header */
+struct shm_ring_reader *shm_ring_attach(const char *name);
+int shm_ring_read(struct shm_ring_reader *r, void *buf, unsigned len);
+int shm_ring_closed(struct shm_ring_reader *r);
+uint64_t shm_ring_dropped(struct shm_ring_reader *r);
+void shm_ring_detach(struct shm_ring_reader *r);
+
+#endif
@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_ring.h"
+
+/*
+ * Reader side of the shared memory ring. It needs nothing but libc and
+ * shm_ring.h, so consumers compile this file into their own programs.
+ * A reader keeps its cursor to itself; see shm_ring.c for how the
+ * producer publishes head and tail.
+ */
+
+struct shm_ring_reader {
+	int fd;
+	struct shm_ring_hdr *hdr;
+	const uint8_t *data;
+	size_t map_len;
+	uint64_t pos;
+	uint64_t next_seq;
+	uint64_t dropped;
+};
+
+struct shm_ring_reader *shm_ring_attach(const char *name)
+{
+	struct shm_ring_reader *r;
+	struct stat st;
+	char path[256];
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	shm_ring_path(path, sizeof(path), name);
+	r->fd = shm_open(path, O_RDONLY, 0);
+	if (r->fd < 0)
+		goto fail;
+	if (fstat(r->fd, &st) < 0 || (size_t) st.st_size < sizeof(struct shm_ring_hdr))
+		goto fail;
+
+	r->map_len = st.st_size;
+	r->hdr = mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (r->hdr == MAP_FAILED) {
+		r->hdr = NULL;
+		goto fail;
+	}
+	if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+	    r->hdr->version != SHM_RING_VERSION ||
+	    sizeof(struct shm_ring_hdr) + r->hdr->size > r->map_len) {
+		errno = EPROTO;
+		goto fail;
+	}
+	r->data = (const uint8_t *) (r->hdr + 1);
+
+	/* start with the records written from now on */
+	r->pos = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+
+	return r;
+
+fail:
+	shm_ring_detach(r);
+	return NULL;
+}
+
+/*
+ * Copy the next record (struct shm_ring_msg and the GSMTAP packet) into
+ * buf. Returns its length, 0 if there is nothing new yet and -1 if it did
+ * not fit into len bytes, in which case it is skipped.
+ */
+int shm_ring_read(struct shm_ring_reader *r, void *buf, unsigned len)
+{
+	const struct shm_ring_hdr *h = r->hdr;
+	struct shm_ring_rec rec;
+	uint64_t head, tail, off, size = h->size;
+	unsigned n;
+
+	for (;;) {
+		head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+		if (r->pos >= head)
+			return 0;
+
+		/* overtaken by the producer, continue with the oldest record */
+		tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+		if (r->pos < tail)
+			r->pos = tail;
+
+		off = r->pos & (size - 1);
+		memcpy(&rec, &r->data[off], sizeof(rec));
+		n = 0;
+		if (rec.len >= sizeof(rec) && off + rec.len <= size) {
+			n = rec.len - sizeof(rec);
+			if (rec.type == SHM_REC_MSG && n <= len)
+				memcpy(buf, &r->data[off + sizeof(rec)], n);
+		}
+
+		/* the copy is only valid if the record was not reused meanwhile */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+		if (r->pos < tail)
+			continue;
+
+		if (rec.len < sizeof(rec)) {
+			/* not a record, resynchronize on new data */
+			r->pos = head;
+			return 0;
+		}
+
+		r->pos += SHM_REC_STRIDE(rec.len);
+		if (rec.type != SHM_REC_MSG)
+			continue;
+
+		if (r->next_seq && rec.seq > r->next_seq)
+			r->dropped += rec.seq - r->next_seq;
+		r->next_seq = rec.seq + 1;
+
+		if (n > len) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		return n;
+	}
+}
+
+/* The producer has finished and everything written was read */
+int shm_ring_closed(struct shm_ring_reader *r)
+{
+	if (!__atomic_load_n(&r->hdr->closed, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return r->pos >= __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+uint64_t shm_ring_dropped(struct shm_ring_reader *r)
+{
+	return r->dropped;
+}
+
+void shm_ring_detach(struct shm_ring_reader *r)
+{
+	if (!r)
+		return;
+
+	if (r->hdr)
+		munmap(r->hdr, r->map_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+}
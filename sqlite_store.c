@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+#include "sqlite_store.h"
+
+/*
+ * SQLite store for closed sessions and the cells they were seen on.
+ * Rows are inserted through prepared statements inside a transaction
+ * that is committed every batch_rows rows or batch_ms milliseconds, with
+ * the database in WAL mode, so a commit costs one fsync per batch rather
+ * than per session. The batch_ms deadline is kept by a timer thread, so
+ * the last sessions of a capture that went quiet are committed as well.
+ */
+
+#ifdef HAVE_SQLITE3
+
+/* session_info fields stored as integer columns */
+#define SESSION_INT_FIELDS(X) \
+	X(id) X(appid) X(rat) X(domain) X(mcc) X(mnc) X(lac) X(cid) X(psc) \
+	X(arfcn) X(neigh_count) X(started) X(closed) X(cracked) X(decoded) \
+	X(have_key) X(no_key) X(initial_seq) X(cipher_seq) X(cipher_missing) \
+	X(cm_cmd_fn) X(cm_comp_first_fn) X(cm_comp_last_fn) X(cm_comp_count) \
+	X(cipher_delta) X(cipher) X(integrity) X(cipher_nas) X(integrity_nas) \
+	X(first_fn) X(last_fn) X(duration) X(auth_delta) X(auth_req_fn) \
+	X(auth_resp_fn) X(uplink) X(avg_power) X(mo) X(mt) X(unknown) \
+	X(detach) X(locupd) X(lu_type) X(lu_acc) X(lu_reject) X(lu_rej_cause) \
+	X(lu_mcc) X(lu_mnc) X(lu_lac) X(pag_mi) X(serv_req) X(call) X(ssa) \
+	X(abort) X(raupd) X(attach) X(att_acc) X(pdp_activate) \
+	X(tmsi_realloc) X(release) X(rr_cause) X(have_gprs) X(have_ims) \
+	X(auth) X(iden_imsi_bc) X(iden_imei_bc) X(iden_imsi_ac) \
+	X(iden_imei_ac) X(cmc_imeisv) X(ms_cipher_mask) X(ue_cipher_cap) \
+	X(ue_integrity_cap) X(assignment) X(assign_complete) X(handover) \
+	X(forced_ho) X(use_tmsi) X(use_imsi) X(use_jump)
+
+/* struct frame_count fields, stored as fc_<name> */
+#define SESSION_FC_FIELDS(X) \
+	X(unenc) X(unenc_rand) X(enc) X(enc_rand) X(enc_null) \
+	X(enc_null_rand) X(enc_si) X(enc_si_rand) X(predict) \
+	X(power_count) X(power_sum)
+
+#define CELL_KEY	"rat, mcc, mnc, lac, cid, psc, arfcn"
+
+static sqlite3 *db = NULL;
+static sqlite3_stmt *insert_session;
+static sqlite3_stmt *insert_cell;
+static unsigned batch_rows;
+static unsigned batch_ms;
+static unsigned pending;
+static int in_txn;
+static struct timespec txn_start;
+static unsigned long stored;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t store_cond;	/* signalled when a transaction begins */
+static pthread_t timer;
+static int timer_running;
+static int timer_stop;
+
+static int exec(const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "SQLite: %s: %s\n", sql, err ? err : "error");
+		sqlite3_free(err);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void append(char *buf, size_t len, const char *fmt, const char *name)
+{
+	size_t used = strlen(buf);
+
+	snprintf(&buf[used], len - used, fmt, name);
+}
+
+static int create_schema()
+{
+	char sql[8192] = "";
+
+	append(sql, sizeof(sql), "%s", "CREATE TABLE IF NOT EXISTS sessions ("
+		"timestamp REAL, name TEXT, key BLOB, pdp_ip TEXT, r_time REAL");
+#define COLUMN(f)	append(sql, sizeof(sql), ", \"%s\" INTEGER", #f);
+	SESSION_INT_FIELDS(COLUMN)
+#undef COLUMN
+#define COLUMN(f)	append(sql, sizeof(sql), ", \"fc_%s\" INTEGER", #f);
+	SESSION_FC_FIELDS(COLUMN)
+#undef COLUMN
+	append(sql, sizeof(sql), "%s", ")");
+
+	if (exec(sql) < 0)
+		return -1;
+
+	return exec("CREATE TABLE IF NOT EXISTS cells ("
+		"rat INTEGER, mcc INTEGER, mnc INTEGER, lac INTEGER, "
+		"cid INTEGER, psc INTEGER, arfcn INTEGER, "
+		"first_seen REAL, last_seen REAL, sessions INTEGER, "
+		"UNIQUE (" CELL_KEY "))");
+}
+
+static int prepare()
+{
+	char sql[8192] = "INSERT INTO sessions (timestamp, name, key, pdp_ip, r_time";
+	unsigned n = 5;
+	unsigned i;
+
+#define COLUMN(f)	append(sql, sizeof(sql), ", \"%s\"", #f); n++;
+	SESSION_INT_FIELDS(COLUMN)
+#undef COLUMN
+#define COLUMN(f)	append(sql, sizeof(sql), ", \"fc_%s\"", #f); n++;
+	SESSION_FC_FIELDS(COLUMN)
+#undef COLUMN
+	append(sql, sizeof(sql), "%s", ") VALUES (?");
+	for (i = 1; i < n; i++)
+		append(sql, sizeof(sql), "%s", ", ?");
+	append(sql, sizeof(sql), "%s", ")");
+
+	if (sqlite3_prepare_v2(db, sql, -1, &insert_session, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQLite: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	if (sqlite3_prepare_v2(db, "INSERT INTO cells (" CELL_KEY ", first_seen, last_seen, sessions) "
+			"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, 1) "
+			"ON CONFLICT (" CELL_KEY ") DO UPDATE SET "
+			"first_seen = min(first_seen, excluded.first_seen), "
+			"last_seen = max(last_seen, excluded.last_seen), "
+			"sessions = sessions + 1", -1, &insert_cell, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQLite: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	return 0;
+}
+
+static unsigned elapsed_ms(const struct timespec *since)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec - since->tv_sec) * 1000 + (ts.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void commit()
+{
+	if (!in_txn)
+		return;
+
+	exec("COMMIT");
+	in_txn = 0;
+	pending = 0;
+}
+
+/* Commit a transaction batch_ms after it began, with or without new rows */
+static void *timer_thread(void *arg)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&store_lock);
+	while (!timer_stop) {
+		if (!in_txn) {
+			pthread_cond_wait(&store_cond, &store_lock);
+			continue;
+		}
+		if (elapsed_ms(&txn_start) >= batch_ms) {
+			commit();
+			continue;
+		}
+
+		deadline.tv_sec = txn_start.tv_sec + batch_ms / 1000;
+		deadline.tv_nsec = txn_start.tv_nsec + (batch_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&store_cond, &store_lock, &deadline);
+	}
+	pthread_mutex_unlock(&store_lock);
+
+	return NULL;
+}
+
+static int timer_start()
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&store_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	timer_stop = 0;
+	if (pthread_create(&timer, NULL, timer_thread, NULL)) {
+		fprintf(stderr, "Cannot start SQLite commit thread\n");
+		pthread_cond_destroy(&store_cond);
+		return -1;
+	}
+	timer_running = 1;
+
+	return 0;
+}
+
+static void timer_finish()
+{
+	if (!timer_running)
+		return;
+
+	pthread_mutex_lock(&store_lock);
+	timer_stop = 1;
+	pthread_cond_signal(&store_cond);
+	pthread_mutex_unlock(&store_lock);
+
+	pthread_join(timer, NULL);
+	pthread_cond_destroy(&store_cond);
+	timer_running = 0;
+}
+
+int sqlite_store_open(const char *path, unsigned rows, unsigned ms)
+{
+	if (sqlite3_open(path, &db) != SQLITE_OK) {
+		fprintf(stderr, "Cannot open SQLite database %s, %s\n", path, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		db = NULL;
+		return -1;
+	}
+
+	if (exec("PRAGMA journal_mode = WAL") < 0 ||
+	    exec("PRAGMA synchronous = NORMAL") < 0 ||
+	    create_schema() < 0 || prepare() < 0) {
+		sqlite_store_close();
+		return -1;
+	}
+
+	batch_rows = rows ? rows : SQLITE_STORE_ROWS;
+	batch_ms = ms;
+	pending = 0;
+	in_txn = 0;
+	stored = 0;
+
+	if (batch_ms && timer_start() < 0) {
+		sqlite_store_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void sqlite_store_session(const struct session_info *s)
+{
+	double ts;
+	int i = 1;
+
+	if (!db)
+		return;
+
+	pthread_mutex_lock(&store_lock);
+
+	if (!in_txn) {
+		if (exec("BEGIN") < 0) {
+			pthread_mutex_unlock(&store_lock);
+			return;
+		}
+		in_txn = 1;
+		clock_gettime(CLOCK_MONOTONIC, &txn_start);
+		if (timer_running)
+			pthread_cond_signal(&store_cond);
+	}
+
+	ts = s->timestamp.tv_sec + s->timestamp.tv_usec / 1000000.0;
+
+	sqlite3_reset(insert_session);
+	sqlite3_bind_double(insert_session, i++, ts);
+	if (s->name[0])
+		sqlite3_bind_text(insert_session, i++, s->name, strnlen(s->name, sizeof(s->name)), SQLITE_TRANSIENT);
+	else
+		sqlite3_bind_null(insert_session, i++);
+	if (s->have_key)
+		sqlite3_bind_blob(insert_session, i++, s->key, sizeof(s->key), SQLITE_TRANSIENT);
+	else
+		sqlite3_bind_null(insert_session, i++);
+	if (s->pdp_ip[0])
+		sqlite3_bind_text(insert_session, i++, s->pdp_ip, strnlen(s->pdp_ip, sizeof(s->pdp_ip)), SQLITE_TRANSIENT);
+	else
+		sqlite3_bind_null(insert_session, i++);
+	sqlite3_bind_double(insert_session, i++, s->r_time);
+#define BIND(f)	sqlite3_bind_int64(insert_session, i++, s->f);
+	SESSION_INT_FIELDS(BIND)
+#undef BIND
+#define BIND(f)	sqlite3_bind_int64(insert_session, i++, s->fc.f);
+	SESSION_FC_FIELDS(BIND)
+#undef BIND
+
+	if (sqlite3_step(insert_session) != SQLITE_DONE)
+		fprintf(stderr, "SQLite: %s\n", sqlite3_errmsg(db));
+
+	if (s->mcc || s->lac || s->cid) {
+		i = 1;
+		sqlite3_reset(insert_cell);
+		sqlite3_bind_int(insert_cell, i++, s->rat);
+		sqlite3_bind_int(insert_cell, i++, s->mcc);
+		sqlite3_bind_int(insert_cell, i++, s->mnc);
+		sqlite3_bind_int(insert_cell, i++, s->lac);
+		sqlite3_bind_int64(insert_cell, i++, s->cid);
+		sqlite3_bind_int(insert_cell, i++, s->psc);
+		sqlite3_bind_int(insert_cell, i++, s->arfcn);
+		sqlite3_bind_double(insert_cell, i++, ts);
+		sqlite3_bind_double(insert_cell, i++, ts);
+		if (sqlite3_step(insert_cell) != SQLITE_DONE)
+			fprintf(stderr, "SQLite: %s\n", sqlite3_errmsg(db));
+	}
+
+	stored++;
+	pending++;
+	if (pending >= batch_rows)
+		commit();
+
+	pthread_mutex_unlock(&store_lock);
+}
+
+void sqlite_store_close()
+{
+	if (!db)
+		return;
+
+	timer_finish();
+	commit();
+	sqlite3_finalize(insert_session);
+	sqlite3_finalize(insert_cell);
+	insert_session = NULL;
+	insert_cell = NULL;
+	if (msg_verbose)
+		printf("SQLite: %lu sessions stored\n", stored);
+	sqlite3_close(db);
+	db = NULL;
+}
+
+#else
+
+int sqlite_store_open(const char *path, unsigned rows, unsigned ms)
+{
+	fprintf(stderr, "Cannot open %s, SQLite support not built in\n", path);
+	return -1;
+}
+
+void sqlite_store_session(const struct session_info *s)
+{
+}
+
+void sqlite_store_close()
+{
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SQLITE_STORE_H
+#define SQLITE_STORE_H
+
+#include "session.h"
+
+#define SQLITE_STORE_ROWS	1000	/* rows per transaction */
+#define SQLITE_STORE_MS		1000	/* longest time a transaction stays open, 0 = no limit */
+
+int sqlite_store_open(const char *path, unsigned batch_rows, unsigned batch_ms);
+void sqlite_store_session(const struct session_info *s);
+void sqlite_store_close();
+
+#endif
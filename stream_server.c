@@ -0,0 +1,594 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "stream_server.h"
+#include "session.h"
+
+/*
+ * The decoder encodes each message once and copies it into the queue of
+ * every matching client under srv.lock; it never waits for a socket. A
+ * thread of its own accepts clients, reads their subscriptions and
+ * writes the queues out from an epoll loop. The decoder only owns the
+ * tail of a queue and the thread only its head, so the thread sends
+ * without holding the lock. It is woken through an eventfd when a queue
+ * turns non-empty.
+ */
+
+#define MAX_EVENTS	16
+#define FILTER_CODES	16
+#define FILTER_MSGS	8
+#define REC_MAX		1024
+
+struct stream_dropped {
+	struct stream_rec r;
+	uint64_t dropped;
+} __attribute__((packed));
+
+struct stream_filter {
+	uint8_t rats;		/* 1 << RAT_*, 0 matches all */
+	uint8_t chans;		/* MSG_* channel flags, 0 matches all */
+	unsigned n_codes;
+	uint16_t codes[FILTER_CODES];
+	unsigned n_msgs;
+	char msgs[FILTER_MSGS][64];
+};
+
+struct stream_client {
+	int fd;
+	int subscribed;
+	int want_out;
+	char line[256];
+	unsigned line_len;
+	struct stream_filter filter;
+	uint8_t *queue;
+	uint64_t head;		/* next byte to send */
+	uint64_t tail;		/* end of the queued records */
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t reported;	/* dropped count the client was last told */
+	struct stream_client *next;
+};
+
+static struct {
+	int fd;
+	int epfd;
+	int wake_fd;
+	char path[108];
+	unsigned queue_size;
+	volatile int stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct stream_client *clients;
+	uint64_t pending;	/* bytes queued for all clients */
+	uint64_t dropped;	/* records dropped for all clients */
+} srv = {
+	.fd = -1,
+	.epfd = -1,
+	.wake_fd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *rat_names[] = { "gsm", "umts", "lte" };
+
+static const struct {
+	const char *name;
+	uint8_t flag;
+} chan_names[] = {
+	{ "sdcch", MSG_SDCCH },
+	{ "sacch", MSG_SACCH },
+	{ "facch", MSG_FACCH },
+	{ "bcch", MSG_BCCH },
+};
+
+static int parse_line(struct stream_filter *f, char *line)
+{
+	char *rest, *val, *save;
+	unsigned i;
+
+	rest = line + strcspn(line, " \t");
+	if (*rest)
+		*rest++ = 0;
+	rest += strspn(rest, " \t");
+
+	if (!strcmp(line, "msg")) {
+		if (!*rest || f->n_msgs == FILTER_MSGS)
+			return -1;
+		snprintf(f->msgs[f->n_msgs++], sizeof(f->msgs[0]), "%s", rest);
+		return 0;
+	}
+
+	if (strcmp(line, "rat") && strcmp(line, "chan") && strcmp(line, "code"))
+		return -1;
+
+	for (val = strtok_r(rest, " \t,", &save); val; val = strtok_r(NULL, " \t,", &save)) {
+		if (!strcmp(line, "rat")) {
+			for (i = 0; i < 3 && strcasecmp(val, rat_names[i]); i++)
+				;
+			if (i == 3)
+				return -1;
+			f->rats |= 1 << i;
+		} else if (!strcmp(line, "chan")) {
+			for (i = 0; i < 4 && strcasecmp(val, chan_names[i].name); i++)
+				;
+			if (i == 4)
+				return -1;
+			f->chans |= chan_names[i].flag;
+		} else {
+			if (f->n_codes == FILTER_CODES)
+				return -1;
+			f->codes[f->n_codes++] = strtoul(val, NULL, 16);
+		}
+	}
+
+	return 0;
+}
+
+static int filter_match(const struct stream_filter *f, const struct radio_message *m)
+{
+	unsigned i;
+
+	if (f->rats && !(f->rats & (1 << m->rat)))
+		return 0;
+
+	if (f->chans && !(f->chans & m->flags))
+		return 0;
+
+	if (f->n_codes) {
+		for (i = 0; i < f->n_codes && f->codes[i] != m->log_code; i++)
+			;
+		if (i == f->n_codes)
+			return 0;
+	}
+
+	if (f->n_msgs) {
+		for (i = 0; i < f->n_msgs; i++) {
+			if (!strncasecmp(m->info, f->msgs[i], strlen(f->msgs[i])))
+				break;
+		}
+		if (i == f->n_msgs)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void client_accept()
+{
+	struct stream_client *c;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept(srv.fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	c = (struct stream_client *) calloc(1, sizeof(struct stream_client));
+	if (c)
+		c->queue = malloc(srv.queue_size);
+	if (!c || !c->queue) {
+		fprintf(stderr, "Cannot allocate stream client\n");
+		goto fail;
+	}
+	c->fd = fd;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
+		goto fail;
+	}
+
+	pthread_mutex_lock(&srv.lock);
+	c->next = srv.clients;
+	srv.clients = c;
+	pthread_mutex_unlock(&srv.lock);
+
+	if (msg_verbose) {
+		fprintf(stderr, "Stream client %d connected\n", fd);
+	}
+	return;
+
+fail:
+	if (c)
+		free(c->queue);
+	free(c);
+	close(fd);
+}
+
+static void client_close(struct stream_client *c)
+{
+	struct stream_client **p;
+
+	pthread_mutex_lock(&srv.lock);
+	for (p = &srv.clients; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+	__atomic_fetch_sub(&srv.pending, c->tail - c->head, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&srv.lock);
+
+	if (msg_verbose) {
+		fprintf(stderr, "Stream client %d closed, %llu records queued, %llu dropped\n",
+			c->fd, (unsigned long long) c->queued, (unsigned long long) c->dropped);
+	}
+
+	epoll_ctl(srv.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->queue);
+	free(c);
+}
+
+/* Read subscription lines, anything after the empty line is ignored */
+static int client_input(struct stream_client *c)
+{
+	char buf[512];
+	ssize_t n, i;
+
+	n = read(c->fd, buf, sizeof(buf));
+	if (n == 0)
+		return -1;
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	for (i = 0; i < n && !c->subscribed; i++) {
+		if (buf[i] != '\n') {
+			if (c->line_len == sizeof(c->line) - 1)
+				return -1;
+			c->line[c->line_len++] = buf[i];
+			continue;
+		}
+
+		if (c->line_len && c->line[c->line_len - 1] == '\r')
+			c->line_len--;
+		c->line[c->line_len] = 0;
+
+		if (!c->line_len) {
+			pthread_mutex_lock(&srv.lock);
+			c->subscribed = 1;
+			pthread_mutex_unlock(&srv.lock);
+		} else if (parse_line(&c->filter, c->line) < 0) {
+			fprintf(stderr, "Stream client %d: invalid subscription \"%s\"\n", c->fd, c->line);
+			return -1;
+		}
+		c->line_len = 0;
+	}
+
+	return 0;
+}
+
+static int client_want_out(struct stream_client *c, int on)
+{
+	struct epoll_event ev;
+
+	if (c->want_out == on)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	c->want_out = on;
+
+	return epoll_ctl(srv.epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Send as much of the queue as the socket takes */
+static int client_flush(struct stream_client *c)
+{
+	uint64_t head, tail;
+	size_t off, len;
+	ssize_t ret;
+
+	for (;;) {
+		pthread_mutex_lock(&srv.lock);
+		head = c->head;
+		tail = c->tail;
+		pthread_mutex_unlock(&srv.lock);
+
+		if (head == tail)
+			return client_want_out(c, 0);
+
+		off = head & (srv.queue_size - 1);
+		len = tail - head;
+		if (len > srv.queue_size - off)
+			len = srv.queue_size - off;
+
+		ret = send(c->fd, &c->queue[off], len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return client_want_out(c, 1);
+			return -1;
+		}
+
+		pthread_mutex_lock(&srv.lock);
+		c->head = head + ret;
+		pthread_mutex_unlock(&srv.lock);
+		__atomic_fetch_sub(&srv.pending, ret, __ATOMIC_RELAXED);
+	}
+}
+
+static void *server_thread(void *arg)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct stream_client *c, *next;
+	uint64_t val;
+	int i, n;
+
+	while (!srv.stop) {
+		n = epoll_wait(srv.epfd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			c = events[i].data.ptr;
+			if (!c) {
+				client_accept();
+			} else if (c == (void *) &srv.wake_fd) {
+				if (read(srv.wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+					perror("eventfd");
+			} else if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+				   ((events[i].events & EPOLLIN) && client_input(c) < 0)) {
+				client_close(c);
+			}
+		}
+
+		/* only this thread removes clients, no lock needed to walk the list */
+		for (c = srv.clients; c; c = next) {
+			next = c->next;
+			if (client_flush(c) < 0)
+				client_close(c);
+		}
+	}
+
+	return NULL;
+}
+
+static void server_free()
+{
+	if (srv.wake_fd >= 0)
+		close(srv.wake_fd);
+	if (srv.epfd >= 0)
+		close(srv.epfd);
+	if (srv.fd >= 0)
+		close(srv.fd);
+	if (srv.path[0])
+		unlink(srv.path);
+
+	srv.wake_fd = -1;
+	srv.epfd = -1;
+	srv.fd = -1;
+	srv.path[0] = 0;
+}
+
+int stream_server_open(const char *path, unsigned queue_size)
+{
+	struct sockaddr_un sun;
+	struct epoll_event ev;
+	struct stat st;
+	unsigned s;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	/* round up to a power of two */
+	for (s = 4096; s < queue_size; s <<= 1)
+		;
+	srv.queue_size = s;
+
+	/* a socket left behind by an earlier run */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	srv.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (srv.fd < 0 || bind(srv.fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "Cannot bind %s, %s\n", path, strerror(errno));
+		goto fail;
+	}
+	snprintf(srv.path, sizeof(srv.path), "%s", path);
+
+	if (listen(srv.fd, 8) < 0) {
+		fprintf(stderr, "Cannot listen on %s, %s\n", path, strerror(errno));
+		goto fail;
+	}
+
+	srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	srv.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (srv.epfd < 0 || srv.wake_fd < 0) {
+		perror("stream server");
+		goto fail;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.fd, &ev) < 0) {
+		perror("epoll_ctl");
+		goto fail;
+	}
+	ev.data.ptr = &srv.wake_fd;
+	if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.wake_fd, &ev) < 0) {
+		perror("epoll_ctl");
+		goto fail;
+	}
+
+	srv.stop = 0;
+	if (pthread_create(&srv.thread, NULL, server_thread, NULL)) {
+		fprintf(stderr, "Cannot start stream server thread\n");
+		goto fail;
+	}
+
+	if (msg_verbose) {
+		fprintf(stderr, "Streaming on %s\n", path);
+	}
+
+	return 0;
+
+fail:
+	server_free();
+	return -1;
+}
+
+int stream_server_active()
+{
+	return srv.fd >= 0;
+}
+
+/* Called with srv.lock held and enough room in the queue */
+static void queue_put(struct stream_client *c, const void *data, unsigned len)
+{
+	unsigned off = c->tail & (srv.queue_size - 1);
+	unsigned n = srv.queue_size - off;
+
+	if (n > len)
+		n = len;
+	memcpy(&c->queue[off], data, n);
+	memcpy(c->queue, (const uint8_t *) data + n, len - n);
+	c->tail += len;
+	__atomic_fetch_add(&srv.pending, len, __ATOMIC_RELAXED);
+}
+
+static unsigned queue_room(const struct stream_client *c)
+{
+	return srv.queue_size - (c->tail - c->head);
+}
+
+/* Tell the client about records it lost since the last report */
+static void put_dropped(struct stream_client *c)
+{
+	struct stream_dropped d;
+
+	if (c->dropped == c->reported || queue_room(c) < sizeof(d))
+		return;
+
+	d.r.len = sizeof(d);
+	d.r.type = STREAM_REC_DROPPED;
+	d.dropped = c->dropped;
+	queue_put(c, &d, sizeof(d));
+	c->reported = c->dropped;
+}
+
+void stream_server_msg(const struct radio_message *m, const uint8_t *gsmtap, unsigned len)
+{
+	uint8_t rec[REC_MAX];
+	struct stream_rec *r = (struct stream_rec *) rec;
+	struct stream_msg *sm = (struct stream_msg *) (r + 1);
+	struct stream_client *c;
+	unsigned info_len, rec_len, need;
+	int encoded = 0;
+	int wake = 0;
+
+	if (srv.fd < 0)
+		return;
+
+	info_len = strnlen(m->info, sizeof(m->info));
+	rec_len = sizeof(*r) + sizeof(*sm) + len + info_len;
+	if (rec_len > sizeof(rec))
+		return;
+
+	pthread_mutex_lock(&srv.lock);
+
+	for (c = srv.clients; c; c = c->next) {
+		if (!c->subscribed || !filter_match(&c->filter, m))
+			continue;
+
+		if (!encoded) {
+			r->len = rec_len;
+			r->type = STREAM_REC_MSG;
+			sm->ts_ns = (uint64_t) m->timestamp.tv_sec * 1000000000 + m->ts_nsec;
+			sm->id = m->id;
+			sm->fn = m->bb.fn[0];
+			sm->arfcn = m->bb.arfcn[0];
+			sm->log_code = m->log_code;
+			sm->gsmtap_len = len;
+			sm->info_len = info_len;
+			sm->rat = m->rat;
+			sm->domain = m->domain;
+			sm->flags = m->flags;
+			sm->chan_nr = m->chan_nr;
+			memcpy(&rec[sizeof(*r) + sizeof(*sm)], gsmtap, len);
+			memcpy(&rec[sizeof(*r) + sizeof(*sm) + len], m->info, info_len);
+			encoded = 1;
+		}
+
+		need = rec_len;
+		if (c->dropped != c->reported)
+			need += sizeof(struct stream_dropped);
+		if (queue_room(c) < need) {
+			c->dropped++;
+			__atomic_fetch_add(&srv.dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (c->head == c->tail)
+			wake = 1;
+
+		put_dropped(c);
+		queue_put(c, rec, rec_len);
+		c->queued++;
+	}
+
+	pthread_mutex_unlock(&srv.lock);
+
+	if (wake) {
+		uint64_t one = 1;
+
+		if (write(srv.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			perror("eventfd");
+	}
+}
+
+/* Lock-free totals over all clients */
+void stream_server_counts(uint64_t *pending, uint64_t *dropped)
+{
+	*pending = __atomic_load_n(&srv.pending, __ATOMIC_RELAXED);
+	*dropped = __atomic_load_n(&srv.dropped, __ATOMIC_RELAXED);
+}
+
+void stream_server_close()
+{
+	uint64_t one = 1;
+
+	if (srv.fd < 0)
+		return;
+
+	srv.stop = 1;
+	if (write(srv.wake_fd, &one, sizeof(one)) < 0)
+		perror("eventfd");
+	pthread_join(srv.thread, NULL);
+
+	/* last chance for what is still queued, without waiting */
+	while (srv.clients) {
+		put_dropped(srv.clients);
+		client_flush(srv.clients);
+		client_close(srv.clients);
+	}
+
+	server_free();
+}
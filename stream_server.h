@@ -0,0 +1,56 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#include <stdint.h>
+
+/*
+ * Live stream of decoded messages to local clients over a Unix stream
+ * socket. A client subscribes by sending filter lines and an empty line:
+ *
+ *	rat <gsm|umts|lte> ...
+ *	chan <bcch|sdcch|sacch|facch> ...
+ *	code <log code in hex> ...
+ *	msg <message name prefix, e.g. PAGING REQUEST>
+ *
+ * Values of one kind are alternatives, all kinds given must match. An
+ * empty line alone subscribes to everything. The server then sends
+ * records, a struct stream_rec followed by the body of its type.
+ *
+ * Every client has a bounded queue. When it is full, records for that
+ * client are dropped instead of holding up the decoder, and the total
+ * is reported with a STREAM_REC_DROPPED record before the next message.
+ */
+
+#define STREAM_QUEUE_SIZE	(1 << 20)	/* default bytes queued per client */
+
+#define STREAM_REC_MSG		1	/* struct stream_msg, GSMTAP packet, info text */
+#define STREAM_REC_DROPPED	2	/* uint64_t records dropped so far */
+
+struct stream_rec {
+	uint32_t len;		/* record length including this header */
+	uint32_t type;		/* STREAM_REC_* */
+} __attribute__((packed));
+
+struct stream_msg {
+	uint64_t ts_ns;		/* nanoseconds since the UNIX epoch */
+	uint32_t id;
+	uint32_t fn;
+	uint16_t arfcn;
+	uint16_t log_code;	/* DIAG log code the message was decoded from */
+	uint16_t gsmtap_len;	/* GSMTAP header and payload bytes that follow */
+	uint16_t info_len;	/* info text bytes after the packet, no NUL */
+	uint8_t rat;
+	uint8_t domain;
+	uint8_t flags;
+	uint8_t chan_nr;
+} __attribute__((packed));
+
+struct radio_message;
+
+int stream_server_open(const char *path, unsigned queue_size);
+int stream_server_active();
+void stream_server_msg(const struct radio_message *m, const uint8_t *gsmtap, unsigned len);
+void stream_server_counts(uint64_t *pending, uint64_t *dropped);
+void stream_server_close();
+
+#endif
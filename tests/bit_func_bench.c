@@ -0,0 +1,80 @@
+/*
+ * Time the bit_func.c kernels, scalar and vector, on a buffer of the
+ * size of a large DIAG frame and print ns per input byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bit_func.h"
+
+#define LEN		4096
+#define MIN_NSEC	200000000ULL	/* per kernel and mode */
+
+static uint8_t in[LEN], in2[LEN], out[2 * LEN];
+static volatile unsigned sink;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run(int kernel)
+{
+	switch (kernel) {
+	case 0: sink += not_zero(in, LEN); break;
+	case 1: compress_lsb(in, out, LEN); break;
+	case 2: compress_msb(in, out, LEN); break;
+	case 3: expand_lsb(in, out, LEN); break;
+	case 4: expand_msb(in, out, LEN); break;
+	case 5: sink += hex_bin2str(in, (char *) out, LEN); break;
+	case 6: sink += hamming_distance(in, in2, LEN); break;
+	}
+}
+
+/* Input bytes per call: the expand kernels read one bit per output byte */
+static double ns_per_byte(int kernel, int use_simd)
+{
+	uint64_t start, elapsed, n = 0;
+	unsigned bytes = kernel == 3 || kernel == 4 ? LEN / 8 : LEN;
+
+	bit_func_select(use_simd);
+	start = now_ns();
+	do {
+		run(kernel);
+		n++;
+		elapsed = now_ns() - start;
+	} while (elapsed < MIN_NSEC);
+
+	return (double) elapsed / n / bytes;
+}
+
+int main()
+{
+	static const char *names[] = {
+		"not_zero", "compress_lsb", "compress_msb", "expand_lsb",
+		"expand_msb", "hex_bin2str", "hamming_distance",
+	};
+	double scalar, simd;
+	unsigned i;
+
+	/* all zero but the last byte, so not_zero scans everything */
+	memset(in, 0, sizeof(in));
+	in[LEN - 1] = 1;
+	for (i = 0; i < LEN; i++)
+		in2[i] = i % 7 ? 0 : i;
+
+	printf("%-18s %12s %12s %8s\n", "kernel", "scalar ns/B", "vector ns/B", "speedup");
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		scalar = ns_per_byte(i, 0);
+		simd = ns_per_byte(i, 1);
+		printf("%-18s %12.3f %12.3f %7.1fx\n", names[i], scalar, simd, scalar / simd);
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Compare the vector kernels of bit_func.c with the scalar ones on
+ * random input of every length up to a few vectors and at every offset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bit_func.h"
+
+#define MAX_LEN		300
+#define ROUNDS		20000
+
+static unsigned failed = 0;
+
+static void check(const char *name, unsigned len, const void *a, const void *b, size_t size)
+{
+	if (memcmp(a, b, size)) {
+		if (failed++ < 10)
+			fprintf(stderr, "%s differs for length %u\n", name, len);
+	}
+}
+
+/* Run one kernel with the scalar and the vector code on the same input */
+#define COMPARE(name, call) do {				\
+	memset(ref, 0xaa, sizeof(ref));				\
+	memset(out, 0xaa, sizeof(out));				\
+	bit_func_select(0);					\
+	dst = ref;						\
+	call;							\
+	bit_func_select(1);					\
+	dst = out;						\
+	call;							\
+	check(name, len, ref, out, sizeof(out));		\
+} while (0)
+
+int main()
+{
+	uint8_t buf[MAX_LEN + 16], ref[2 * MAX_LEN], out[2 * MAX_LEN];
+	uint8_t *in, *dst;
+	unsigned round, i, len, r0, r1;
+
+	srand(1);
+
+	for (round = 0; round < ROUNDS; round++) {
+		len = rand() % (MAX_LEN - MAX_LEN / 3);
+		in = &buf[rand() % 16];
+
+		/* sparse, so that not_zero and hamming_distance see both outcomes */
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = rand() % 3 ? 0 : rand();
+		if (rand() % 4 == 0)
+			memset(buf, 0, sizeof(buf));
+
+		COMPARE("compress_lsb", compress_lsb(in, dst, len));
+		COMPARE("compress_msb", compress_msb(in, dst, len));
+		COMPARE("expand_lsb", expand_lsb(in, dst, len));
+		COMPARE("expand_msb", expand_msb(in, dst, len));
+		COMPARE("hex_bin2str", hex_bin2str(in, (char *) dst, len));
+
+		bit_func_select(0);
+		r0 = not_zero(in, len);
+		bit_func_select(1);
+		r1 = not_zero(in, len);
+		check("not_zero", len, &r0, &r1, sizeof(r0));
+
+		bit_func_select(0);
+		r0 = hamming_distance(in, in + len / 3, len - len / 3);
+		bit_func_select(1);
+		r1 = hamming_distance(in, in + len / 3, len - len / 3);
+		check("hamming_distance", len, &r0, &r1, sizeof(r0));
+	}
+
+	/* and against known values */
+	memset(buf, 0, sizeof(buf));
+	buf[0] = 0x81;
+	buf[17] = 0x3c;
+	hex_bin2str(buf, (char *) out, 18);
+	check("hex_bin2str", 18, "81000000000000000000000000000000003C", out, 36);
+	expand_msb(buf, out, 8);
+	check("expand_msb", 8, "\1\0\0\0\0\0\0\1", out, 8);
+	compress_lsb(out, ref, 8);
+	check("compress_lsb", 8, "\x81", ref, 1);
+
+	if (failed) {
+		fprintf(stderr, "bit_func: %u mismatches\n", failed);
+		return 1;
+	}
+
+	printf("bit_func: %u rounds ok\n", ROUNDS);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Check that a diag_parser binary carries every USDT probe of probes.h
+# with its number of arguments, so a probe lost to a refactoring or a
+# build without sys/sdt.h is noticed. Run through "make check-probes".
+#
+#	tests/check_probes.sh ./diag_parser
+
+bin=${1:-./diag_parser}
+
+if [ ! -f "$bin" ]; then
+	echo "$bin not found, run make first" >&2
+	exit 1
+fi
+
+# name and argument count of each probe of the provider diag_parser
+probes=$(readelf -n "$bin" | awk '
+	/Provider:/ { provider = $2 }
+	/Name:/ { name = $2 }
+	/Arguments:/ && provider == "diag_parser" {
+		sub(/.*Arguments: */, "")
+		print name, NF
+	}
+')
+
+failed=0
+for probe in "frame 2" "dispatch 2" "message 4" "session_open 4" "session_close 4" "packet 4"; do
+	if ! echo "$probes" | grep -qx "$probe"; then
+		echo "probe missing: diag_parser:${probe% *} with ${probe#* } arguments" >&2
+		failed=1
+	fi
+done
+
+[ $failed -eq 0 ] && echo "probes: all 6 present in $bin"
+exit $failed
@@ -0,0 +1,250 @@
+/*
+ * dlog test: lines formatted by the logger must match printf, levels and
+ * modules must filter as configured, lines logged from several threads
+ * must come out complete and in call order per thread, stdout lines must
+ * wait for ring space instead of being dropped, and an idle logger must
+ * wake up for a new line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dlog.h"
+
+#define THREADS		4
+#define LINES		100000
+
+static int failed;
+static int real_fd[3];		/* stdout and stderr while not captured */
+
+/* Send stdout or stderr to a temporary file, returns the file */
+static FILE *capture(FILE *stream)
+{
+	FILE *f = tmpfile();
+
+	fflush(stream);
+	if (!f || dup2(fileno(f), fileno(stream)) < 0) {
+		perror("capture");
+		exit(1);
+	}
+
+	return f;
+}
+
+/* Restore the stream and return what was written to it */
+static char *captured(FILE *f, FILE *stream)
+{
+	static char buf[1 << 24];
+	size_t len;
+
+	fflush(stream);
+	dup2(real_fd[fileno(stream)], fileno(stream));
+	rewind(f);
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = 0;
+	fclose(f);
+
+	return buf;
+}
+
+static void expect(const char *what, const char *got, const char *want)
+{
+	if (strcmp(got, want)) {
+		fprintf(stderr, "%s: got\n%s\nwant\n%s\n", what, got, want);
+		failed = 1;
+	}
+}
+
+static void test_format()
+{
+	uint8_t b[4] = { 0xde, 0xad, 0xbe, 0xef };
+	unsigned u = 0xffffffff;
+	int neg = -5;
+	uint8_t c8 = 200;
+	short sh = -3;
+	const char *nul = NULL;
+	char info[16] = "hello";
+	char want[1024];
+	int len = 0;
+	FILE *f;
+
+	len += snprintf(want + len, sizeof(want) - len, "a %d %u %x %5.2f %-6s| %s %c %%\n",
+			neg, u, neg, 3.14159, "ab", "deadbeef", 'Z');
+	len += snprintf(want + len, sizeof(want) - len, "%*d %hhu %hd %lu %p\n",
+			4, 7, (unsigned char) 300, sh, (unsigned long) 1 << 40, (void *) b);
+	len += snprintf(want + len, sizeof(want) - len, "no args\n");
+	len += snprintf(want + len, sizeof(want) - len, "%s %s %u %d\n", "(null)", info, c8, u);
+
+	dlog_init(DLOG_INFO);
+	f = capture(stdout);
+	DLOG(DLOG_L3, DLOG_INFO, "a %d %u %x %5.2f %-6s| %s %c %%\n",
+		neg, u, neg, 3.14159, "ab", DLOG_HEX(b, 4), 'Z');
+	DLOG(DLOG_L3, DLOG_INFO, "%*d %hhu %hd %lu %p\n", 4, 7, 300, sh, (unsigned long) 1 << 40, b);
+	DLOG(DLOG_L3, DLOG_INFO, "no args\n");
+	DLOG(DLOG_L3, DLOG_INFO, "%s %s %u %d\n", nul, info, c8, u);
+	expect("format", captured(f, stdout), want);
+}
+
+static void test_levels()
+{
+	FILE *out, *err;
+
+	dlog_init(DLOG_TRACE);
+	if (dlog_set_levels("l3=0,diag=2") < 0)
+		failed = 1;
+
+	out = capture(stdout);
+	err = capture(stderr);
+	if (dlog_set_levels("foo=1") == 0)
+		failed = 1;
+	DLOG(DLOG_L3, DLOG_INFO, "hidden\n");
+	DLOG(DLOG_L3, DLOG_NOTICE, "notice\n");
+	DLOG(DLOG_DIAG, DLOG_TRACE, "hidden\n");
+	DLOG(DLOG_DIAG, DLOG_DEBUG, "debug\n");
+	DLOG(DLOG_SESSION, DLOG_TRACE, "trace\n");
+	expect("levels stdout", captured(out, stdout), "notice\n");
+	expect("levels stderr", captured(err, stderr), "Unknown log module foo\ndebug\ntrace\n");
+}
+
+static void *worker(void *arg)
+{
+	long id = (long) arg;
+	struct timespec pause = { 0, 1000000 };
+	int i;
+
+	for (i = 0; i < LINES; i++) {
+		DLOG(DLOG_DIAG, DLOG_DEBUG, "t%ld %d\n", id, i);
+		/* let the logger catch up now and then, so few lines are dropped */
+		if (i % 2000 == 0)
+			nanosleep(&pause, NULL);
+	}
+
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t threads[THREADS];
+	int last[THREADS], lines = 0, t, n;
+	char *p;
+	FILE *err;
+	long i;
+
+	dlog_init(DLOG_DEBUG);
+	err = capture(stderr);
+	if (dlog_start() < 0)
+		exit(1);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *) i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	dlog_stop();
+
+	for (i = 0; i < THREADS; i++)
+		last[i] = -1;
+	for (p = captured(err, stderr); *p; p = strchr(p, '\n') + 1) {
+		if (!strncmp(p, "Log buffer full", 15))
+			continue;
+		if (sscanf(p, "t%d %d\n", &t, &n) != 2 || t < 0 || t >= THREADS || n <= last[t]) {
+			fprintf(stderr, "threads: bad or out of order line %.20s\n", p);
+			failed = 1;
+			break;
+		}
+		last[t] = n;
+		lines++;
+	}
+
+	printf("threads: %d lines written, %lu dropped\n", lines, dlog_dropped());
+	if (lines + dlog_dropped() != THREADS * LINES) {
+		fprintf(stderr, "threads: %lu lines missing\n", THREADS * LINES - lines - dlog_dropped());
+		failed = 1;
+	}
+}
+
+static void *info_worker(void *arg)
+{
+	long id = (long) arg;
+	int i;
+
+	for (i = 0; i < LINES; i++)
+		DLOG(DLOG_L3, DLOG_INFO, "t%ld %d %s\n", id, i, "PAGING REQUEST TYPE 1");
+
+	return NULL;
+}
+
+static void test_backpressure()
+{
+	pthread_t threads[THREADS];
+	int last[THREADS], lines = 0, t, n;
+	unsigned long dropped = dlog_dropped();
+	char *p, *end;
+	FILE *out;
+	long i;
+
+	dlog_init(DLOG_INFO);
+	out = capture(stdout);
+	if (dlog_start() < 0)
+		exit(1);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, info_worker, (void *) i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	dlog_stop();
+
+	for (i = 0; i < THREADS; i++)
+		last[i] = -1;
+	/* sscanf takes the length of its input, so look at one line at a time */
+	for (p = captured(out, stdout); *p; p = end + 1) {
+		end = strchr(p, '\n');
+		*end = 0;
+		if (sscanf(p, "t%d %d ", &t, &n) != 2 || t < 0 || t >= THREADS || n != last[t] + 1) {
+			fprintf(stderr, "backpressure: bad or missing line before %.20s\n", p);
+			failed = 1;
+			break;
+		}
+		last[t] = n;
+		lines++;
+	}
+
+	if (lines != THREADS * LINES || dlog_dropped() != dropped) {
+		fprintf(stderr, "backpressure: %d of %d lines, %lu dropped\n", lines, THREADS * LINES,
+			dlog_dropped() - dropped);
+		failed = 1;
+	}
+}
+
+static void test_wake()
+{
+	struct timespec idle = { 0, 50000000 };
+	FILE *out;
+
+	dlog_init(DLOG_INFO);
+	out = capture(stdout);
+	if (dlog_start() < 0)
+		exit(1);
+
+	/* the logger has gone to sleep by now */
+	nanosleep(&idle, NULL);
+	DLOG(DLOG_DIAG, DLOG_INFO, "wake\n");
+	nanosleep(&idle, NULL);
+	expect("wake", captured(out, stdout), "wake\n");
+	dlog_stop();
+}
+
+int main()
+{
+	real_fd[fileno(stdout)] = dup(fileno(stdout));
+	real_fd[fileno(stderr)] = dup(fileno(stderr));
+
+	test_format();
+	test_levels();
+	test_wake();
+	test_threads();
+	test_backpressure();
+
+	return failed;
+}
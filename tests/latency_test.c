@@ -0,0 +1,97 @@
+/*
+ * Latency histogram test: percentiles of a known distribution must be
+ * within the bucket width, a requested dump must be printed exactly once,
+ * and the cost of a start/stop pair is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "latency.h"
+
+#define SAMPLES		100000
+
+static int failed;
+
+/* p50, p90, p99, p99.9 and max of a stage in a dump, 0 if not found */
+static int parse_stage(FILE *f, const char *stage, double v[5])
+{
+	char line[256], name[16];
+	unsigned long long count;
+	double rate, mbs;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%15s %llu %lf %lf %lf %lf %lf %lf %lf", name, &count, &rate, &mbs,
+			   &v[0], &v[1], &v[2], &v[3], &v[4]) == 9 && !strcmp(name, stage))
+			return count;
+	}
+
+	return 0;
+}
+
+static void check_ratio(const char *what, double got, double want)
+{
+	/* buckets are 1/32 wide, their middle is reported */
+	if (got < want * 0.96 || got > want * 1.04) {
+		fprintf(stderr, "%s: %.4f of max, want %.4f\n", what, got, want);
+		failed = 1;
+	}
+}
+
+int main()
+{
+	static const char *names[] = { "p50", "p90", "p99", "p99.9" };
+	static const double want[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t t, t0, t1;
+	double v[5];
+	struct stat st;
+	FILE *f;
+	off_t size;
+	int i, err;
+
+	latency_enable();
+	for (i = 1; i <= SAMPLES; i++)
+		latency_record(LATENCY_DIAG, i, 100);
+
+	f = tmpfile();
+	latency_dump(f);
+	if (parse_stage(f, "diag", v) != SAMPLES) {
+		fprintf(stderr, "diag stage missing or miscounted\n");
+		return 1;
+	}
+	for (i = 0; i < 4; i++)
+		check_ratio(names[i], v[i] / v[4], want[i]);
+	fclose(f);
+
+	/* a pending dump is printed to stderr once, by whichever comes first */
+	f = tmpfile();
+	err = dup(STDERR_FILENO);
+	dup2(fileno(f), STDERR_FILENO);
+	latency_request_dump();
+	latency_poll();
+	fstat(fileno(f), &st);
+	size = st.st_size;
+	latency_poll();
+	latency_record(LATENCY_DIAG, 1, 1);
+	fstat(fileno(f), &st);
+	dup2(err, STDERR_FILENO);
+	if (!size || st.st_size != size) {
+		fprintf(stderr, "requested dump printed %s\n", size ? "twice" : "never");
+		failed = 1;
+	}
+	fclose(f);
+
+	t0 = latency_ticks();
+	for (i = 0; i < 1000000; i++) {
+		t = latency_start();
+		latency_stop(LATENCY_DECODE, t, 10);
+	}
+	t1 = latency_ticks();
+	printf("latency: %.1f ticks per start/stop pair\n", (double) (t1 - t0) / 1000000);
+
+	return failed;
+}
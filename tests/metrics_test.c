@@ -0,0 +1,136 @@
+/*
+ * Metrics exporter test: counts frames, CRC errors and log codes of
+ * known frames, then scrapes the exporter over a Unix socket and checks
+ * the exposition, including the values taken from other modules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "diag_input.h"
+#include "output.h"
+#include "stream_server.h"
+
+#define FRAMES		1000
+
+uint8_t msg_verbose = 0;
+
+static int failed;
+
+/* CRC-16/X-25 bit by bit, independent of the parser's table */
+uint16_t diag_crc16(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xffff;
+	int i;
+
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0x8408 : 0);
+	}
+
+	return ~crc;
+}
+
+unsigned net_queue_depth()
+{
+	return 2;
+}
+
+void stream_server_counts(uint64_t *pending, uint64_t *dropped)
+{
+	*pending = 1234;
+	*dropped = 5;
+}
+
+static char *scrape(const char *path, const char *request)
+{
+	static char buf[1 << 16];
+	struct sockaddr_un sun;
+	size_t len = 0;
+	ssize_t rc;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	if (write(fd, request, strlen(request)) < 0)
+		perror("write");
+	while ((rc = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += rc;
+	close(fd);
+	buf[len] = 0;
+
+	return buf;
+}
+
+static void expect(const char *body, const char *line)
+{
+	if (!strstr(body, line)) {
+		fprintf(stderr, "missing: %s", line);
+		failed = 1;
+	}
+}
+
+int main()
+{
+	uint8_t f[32] = { 0x10, 0x00, 20, 0, 20, 0, 0xc0, 0xb0 };
+	char path[64], addr[80];
+	uint16_t crc;
+	char *body;
+	int i;
+
+	if (diag_crc16((const uint8_t *) "123456789", 9) != 0x906e) {
+		fprintf(stderr, "CRC reference is wrong\n");
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "/tmp/metrics_test.%d", (int) getpid());
+	snprintf(addr, sizeof(addr), "unix:%s", path);
+	if (metrics_open(addr) < 0)
+		return 1;
+
+	for (i = 0; i < FRAMES; i++) {
+		f[8] = i;
+		crc = diag_crc16(f, 20);
+		f[20] = crc & 0xff;
+		f[21] = crc >> 8;
+		/* every hundredth frame is damaged */
+		if (i % 100 == 0)
+			f[21] ^= 1;
+		metrics_frame(f, 20);
+		metrics_hdlc_frame(f, 22);
+	}
+	metric_add(&metrics.messages[2], 7);
+
+	body = scrape(path, "GET /metrics HTTP/1.0\r\n\r\n");
+	expect(body, "HTTP/1.0 200 OK\r\n");
+	expect(body, "diag_parser_frames_total 1000\n");
+	expect(body, "diag_parser_bytes_total 20000\n");
+	expect(body, "diag_parser_crc_errors_total 10\n");
+	expect(body, "diag_parser_log_packets_total{code=\"0xb0c0\"} 1000\n");
+	expect(body, "diag_parser_messages_total{rat=\"lte\"} 7\n");
+	expect(body, "diag_parser_dropped_total{queue=\"stream\"} 5\n");
+	expect(body, "diag_parser_queue_depth{queue=\"pcap\"} 2\n");
+	expect(body, "diag_parser_queue_depth{queue=\"stream\"} 1234\n");
+
+	body = scrape(path, "GET /other HTTP/1.0\r\n\r\n");
+	expect(body, "HTTP/1.0 404 Not Found\r\n");
+
+	metrics_close();
+
+	if (!failed)
+		printf("metrics: exposition ok\n");
+	return failed;
+}
@@ -0,0 +1,149 @@
+/*
+ * Multi-reader test of the shared memory ring: forked readers attach
+ * before the producer starts and check that every record they get is
+ * intact, that ids only increase, and that the records read plus the
+ * ones reported dropped account for everything written after the first
+ * one they saw. Prints producer and reader throughput.
+ *
+ *	tests/shm_ring_test [readers] [records] [ring size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "process.h"
+#include "shm_ring.h"
+
+#define RING_NAME	"shm_ring_test"
+
+static double now_s()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned pkt_len(uint32_t id)
+{
+	return 16 + id % 200;
+}
+
+static int reader(int n, long records, int ready)
+{
+	struct shm_ring_reader *r;
+	struct shm_ring_msg *rm;
+	uint8_t buf[512];
+	long got = 0, bad = 0, first = -1, last = -1;
+	double t0;
+	unsigned i;
+	int len;
+
+	r = shm_ring_attach(RING_NAME);
+	if (!r) {
+		perror("shm_ring_attach");
+		return 1;
+	}
+	if (write(ready, "", 1) != 1)
+		return 1;
+
+	t0 = now_s();
+	for (;;) {
+		len = shm_ring_read(r, buf, sizeof(buf));
+		if (len < 0) {
+			bad++;
+			continue;
+		}
+		if (len == 0) {
+			if (shm_ring_closed(r))
+				break;
+			continue;
+		}
+
+		rm = (struct shm_ring_msg *) buf;
+		if (rm->len != pkt_len(rm->id) || len != (int) (sizeof(*rm) + rm->len) ||
+		    (long) rm->id <= last) {
+			bad++;
+		} else {
+			for (i = 0; i < rm->len; i++) {
+				if (buf[sizeof(*rm) + i] != (uint8_t) (rm->id + i)) {
+					bad++;
+					break;
+				}
+			}
+		}
+		if (first < 0)
+			first = rm->id;
+		last = rm->id;
+		got++;
+	}
+
+	printf("reader %d: %ld records, %llu dropped, %.1f Mrec/s\n", n, got,
+		(unsigned long long) shm_ring_dropped(r), got / (now_s() - t0) / 1e6);
+
+	if (bad) {
+		fprintf(stderr, "reader %d: %ld corrupt records\n", n, bad);
+		return 1;
+	}
+	if (first < 0 || got + (long) shm_ring_dropped(r) != records - first) {
+		fprintf(stderr, "reader %d: %ld read and %llu dropped of %ld\n", n, got,
+			(unsigned long long) shm_ring_dropped(r), records - first);
+		return 1;
+	}
+
+	shm_ring_detach(r);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int readers = argc > 1 ? atoi(argv[1]) : 4;
+	long records = argc > 2 ? atol(argv[2]) : 2000000;
+	uint64_t size = argc > 3 ? strtoull(argv[3], NULL, 0) : 1 << 20;
+	struct radio_message m;
+	uint8_t pkt[256];
+	int ready[2], status, failed = 0, i;
+	unsigned j, len;
+	double t0, t;
+	char c;
+	long k;
+
+	if (shm_ring_create(RING_NAME, size) < 0 || pipe(ready) < 0)
+		return 1;
+
+	for (i = 0; i < readers; i++) {
+		if (fork() == 0) {
+			close(ready[0]);
+			exit(reader(i, records, ready[1]));
+		}
+	}
+	close(ready[1]);
+	for (i = 0; i < readers; i++) {
+		if (read(ready[0], &c, 1) != 1) {
+			shm_ring_destroy();
+			return 1;
+		}
+	}
+
+	memset(&m, 0, sizeof(m));
+	t0 = now_s();
+	for (k = 0; k < records; k++) {
+		m.id = k;
+		len = pkt_len(k);
+		for (j = 0; j < len; j++)
+			pkt[j] = k + j;
+		shm_ring_put_msg(&m, pkt, len);
+	}
+	t = now_s() - t0;
+	printf("writer: %ld records, %.1f Mrec/s\n", records, records / t / 1e6);
+	shm_ring_destroy();
+
+	while (wait(&status) > 0)
+		failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+
+	return failed;
+}
@@ -0,0 +1,202 @@
+/*
+ * Stream server test: clients with different filters, one of them slow,
+ * subscribe over the socket while the decoder side sends messages. Every
+ * client must get intact records in id order, and the records it got
+ * plus the ones reported dropped must equal what its filter matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stream_server.h"
+#include "session.h"
+
+#define MESSAGES	200000
+
+uint8_t msg_verbose = 0;
+
+struct client {
+	const char *subscribe;
+	int slow;
+	long expected;
+	long msgs;
+	long dropped;
+	long bad;
+	uint32_t last_id;
+	int ready;		/* saw a warm up message, the filter is active */
+};
+
+static char sock_path[108];
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t rc;
+
+	while (got < len) {
+		rc = read(fd, (uint8_t *) buf + got, len - got);
+		if (rc <= 0)
+			return -1;
+		got += rc;
+	}
+
+	return 0;
+}
+
+static void client_rec(struct client *c, const uint8_t *buf, const struct stream_rec *rec)
+{
+	const struct stream_msg *m = (const struct stream_msg *) buf;
+	unsigned i;
+
+	if (rec->type == STREAM_REC_DROPPED) {
+		memcpy(&c->dropped, buf, sizeof(uint64_t));
+		return;
+	}
+	if (m->id == 0) {
+		__atomic_store_n(&c->ready, 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (rec->len != sizeof(*rec) + sizeof(*m) + m->gsmtap_len + m->info_len ||
+	    (c->msgs && m->id <= c->last_id))
+		c->bad++;
+	for (i = 0; i < m->gsmtap_len; i++) {
+		if (buf[sizeof(*m) + i] != (uint8_t) (m->id + i)) {
+			c->bad++;
+			break;
+		}
+	}
+	c->last_id = m->id;
+	c->msgs++;
+	if (c->slow && c->msgs % 100 == 0)
+		usleep(1000);
+}
+
+static void *client_thread(void *arg)
+{
+	struct client *c = arg;
+	struct sockaddr_un sun;
+	struct stream_rec rec;
+	uint8_t buf[2048];
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", sock_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		perror("connect");
+		c->bad++;
+		__atomic_store_n(&c->ready, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	if (write(fd, c->subscribe, strlen(c->subscribe)) < 0)
+		c->bad++;
+
+	for (;;) {
+		if (read_all(fd, &rec, sizeof(rec)) < 0)
+			break;
+		if (rec.len < sizeof(rec) || rec.len - sizeof(rec) > sizeof(buf)) {
+			c->bad++;
+			break;
+		}
+		if (read_all(fd, buf, rec.len - sizeof(rec)) < 0)
+			break;
+		client_rec(c, buf, &rec);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void send_msg(struct radio_message *m, uint32_t id, unsigned rat, uint16_t code,
+		     uint8_t chan, const char *info)
+{
+	uint8_t pkt[128];
+	unsigned len = 16 + id % 100, i;
+
+	m->id = id;
+	m->rat = rat;
+	m->log_code = code;
+	m->flags = MSG_DECODED | chan;
+	snprintf(m->info, sizeof(m->info), "%s", info);
+	for (i = 0; i < len; i++)
+		pkt[i] = id + i;
+
+	stream_server_msg(m, pkt, len);
+}
+
+int main()
+{
+	static const char *infos[] = { "PAGING REQUEST 1", "CALL SETUP", "SYSTEM INFO 3" };
+	struct client clients[] = {
+		{ "rat lte\n\n" },
+		{ "\n", 1 },
+		{ "code 512f\nmsg paging\n\n" },
+		{ "chan bcch sdcch\r\nrat gsm,umts\n\n" },
+	};
+	const unsigned n = sizeof(clients) / sizeof(clients[0]);
+	pthread_t threads[n];
+	struct radio_message m;
+	unsigned i, ready;
+	uint16_t code;
+	uint8_t chan;
+	int failed = 0;
+	long k;
+
+	snprintf(sock_path, sizeof(sock_path), "/tmp/stream_server_test.%d", (int) getpid());
+	if (stream_server_open(sock_path, 65536) < 0)
+		return 1;
+	for (i = 0; i < n; i++)
+		pthread_create(&threads[i], NULL, client_thread, &clients[i]);
+
+	/* id 0 matches every filter in one of two variants, wait for all */
+	memset(&m, 0, sizeof(m));
+	do {
+		send_msg(&m, 0, RAT_LTE, 0x512f, MSG_BCCH, "PAGING REQUEST 1");
+		send_msg(&m, 0, RAT_GSM, 0x512f, MSG_BCCH, "PAGING REQUEST 1");
+		usleep(1000);
+		for (i = 0, ready = 0; i < n; i++)
+			ready += __atomic_load_n(&clients[i].ready, __ATOMIC_ACQUIRE);
+	} while (ready < n);
+
+	for (k = 1; k <= MESSAGES; k++) {
+		code = (k % 2) ? 0x512f : 0xb0c0;
+		chan = (k % 4 == 0) ? MSG_BCCH : (k % 4 == 1) ? MSG_SDCCH : MSG_SACCH;
+
+		if (k % 3 == RAT_LTE)
+			clients[0].expected++;
+		clients[1].expected++;
+		if (code == 0x512f && k % 3 == 0)
+			clients[2].expected++;
+		if (k % 3 != RAT_LTE && chan != MSG_SACCH)
+			clients[3].expected++;
+
+		send_msg(&m, k, k % 3, code, chan, infos[k % 3]);
+		if (k % 1000 == 0)
+			usleep(100);
+	}
+
+	/* let the clients drain their queues, closing drops the rest */
+	usleep(300000);
+	stream_server_close();
+
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		printf("client %u: %ld messages, %ld dropped, %ld expected\n", i,
+			clients[i].msgs, clients[i].dropped, clients[i].expected);
+		if (clients[i].bad || clients[i].msgs + clients[i].dropped != clients[i].expected) {
+			fprintf(stderr, "client %u: %ld bad records, %ld missing\n", i, clients[i].bad,
+				clients[i].expected - clients[i].msgs - clients[i].dropped);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,145 @@
+/*
+ * Trace export test: sampled frames from two threads, and a run that
+ * wraps the per thread ring, must give a trace file in which every
+ * thread's begin and end events nest properly, frames are whole and
+ * the number of frames matches the sampling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define MAX_TID		8
+#define MAX_DEPTH	8
+
+struct run {
+	long frames;
+};
+
+static int failed;
+
+static void frame(long i)
+{
+	trace_begin(TRACE_FRAME, 0);
+	trace_begin(TRACE_DEFRAME, 0);
+	trace_end(TRACE_DEFRAME, 100);
+	trace_begin(TRACE_DIAG, 0xb0c0);
+	trace_begin(TRACE_DTAP, 23);
+	trace_begin(TRACE_OUTPUT, i % 3);
+	trace_end(TRACE_OUTPUT, 0);
+	trace_end(TRACE_DTAP, 0);
+	trace_end(TRACE_DIAG, 0);
+	trace_end(TRACE_FRAME, 100);
+}
+
+static void *worker(void *arg)
+{
+	const struct run *r = arg;
+	long i;
+
+	for (i = 0; i < r->frames; i++)
+		frame(i);
+
+	return NULL;
+}
+
+/* Check nesting per thread, returns the frames of each thread */
+static void check_file(const char *path, long frames[MAX_TID])
+{
+	char stack[MAX_TID][MAX_DEPTH][16], line[512], name[16], ph;
+	unsigned depth[MAX_TID] = { 0 }, tid;
+	const char *p;
+	FILE *f;
+
+	memset(frames, 0, MAX_TID * sizeof(frames[0]));
+
+	f = fopen(path, "r");
+	if (!f || !fgets(line, sizeof(line), f) || strncmp(line, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 38)) {
+		fprintf(stderr, "%s: not a trace file\n", path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strcmp(line, "]}\n"))
+			break;
+		if (strstr(line, "\"ph\":\"M\""))
+			continue;
+		if (sscanf(line, "{\"name\":\"%15[^\"]\",\"cat\":\"diag\",\"ph\":\"%c\"", name, &ph) != 2 ||
+		    !(p = strstr(line, "\"tid\":")) || sscanf(p, "\"tid\":%u", &tid) != 1 || tid >= MAX_TID) {
+			fprintf(stderr, "%s: bad event %s", path, line);
+			failed = 1;
+			break;
+		}
+
+		if (ph == 'B') {
+			if (depth[tid] == 0 && strcmp(name, "frame")) {
+				fprintf(stderr, "%s: %s outside a frame\n", path, name);
+				failed = 1;
+			}
+			if (depth[tid] == 0)
+				frames[tid]++;
+			if (depth[tid] < MAX_DEPTH)
+				strcpy(stack[tid][depth[tid]], name);
+			depth[tid]++;
+		} else if (!depth[tid] || strcmp(stack[tid][--depth[tid]], name)) {
+			fprintf(stderr, "%s: unmatched end of %s\n", path, name);
+			failed = 1;
+		}
+	}
+	fclose(f);
+
+	for (tid = 0; tid < MAX_TID; tid++) {
+		if (depth[tid]) {
+			fprintf(stderr, "%s: thread %u ends inside a frame\n", path, tid);
+			failed = 1;
+		}
+	}
+}
+
+int main()
+{
+	struct run sampled = { 1000 }, wrapped = { 100000 };
+	pthread_t thread;
+	unsigned i;
+	long frames[MAX_TID], total;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/tmp/trace_test.%d.json", (int) getpid());
+
+	/* one in four frames of two threads */
+	if (trace_open(path, 4) < 0)
+		return 1;
+	pthread_create(&thread, NULL, worker, &sampled);
+	worker(&sampled);
+	pthread_join(thread, NULL);
+	trace_close();
+
+	check_file(path, frames);
+	if (frames[1] != 250 || frames[2] != 250) {
+		fprintf(stderr, "sampled: %ld and %ld frames, want 250 each\n", frames[1], frames[2]);
+		failed = 1;
+	}
+
+	/* ten events per frame overflow the ring, whole frames are kept */
+	if (trace_open(path, 1) < 0)
+		return 1;
+	worker(&wrapped);
+	trace_close();
+
+	check_file(path, frames);
+	for (i = 1, total = 0; i < MAX_TID; i++)
+		total += frames[i];
+	if (total != TRACE_RING_EVENTS / 10) {
+		fprintf(stderr, "wrapped: %ld frames, want %d\n", total, TRACE_RING_EVENTS / 10);
+		failed = 1;
+	}
+
+	unlink(path);
+	if (!failed)
+		printf("trace: sampled and wrapped traces ok\n");
+	return failed;
+}
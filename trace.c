@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct trace_ev {
+	uint64_t ts;		/* CLOCK_MONOTONIC nanoseconds */
+	uint32_t arg;
+	uint8_t name;
+	char phase;		/* 'B' or 'E' */
+	uint8_t depth;		/* 0 for the frame itself */
+	uint8_t reserved;
+};
+
+struct trace_thread {
+	struct trace_ev *ev;
+	uint64_t n;		/* events recorded, ev holds the last of them */
+	unsigned depth;
+	int active;		/* the current frame is sampled */
+	uint64_t frames;
+	unsigned id;
+	struct trace_thread *next;
+};
+
+static const struct {
+	const char *name;
+	const char *arg;	/* name of the argument */
+	char arg_phase;		/* event that carries it */
+} names[TRACE_NAMES] = {
+	[TRACE_FRAME] = { "frame", "len", 'E' },
+	[TRACE_DEFRAME] = { "deframe", "bytes", 'E' },
+	[TRACE_DIAG] = { "handle_diag", "log_code", 'B' },
+	[TRACE_DTAP] = { "handle_dtap", "len", 'B' },
+	[TRACE_OUTPUT] = { "net_send_msg", "rat", 'B' },
+};
+
+int trace_enabled = 0;
+
+static struct {
+	char *path;
+	unsigned sample;
+	uint64_t start;
+	pthread_mutex_t lock;	/* protects the thread list */
+	struct trace_thread *threads;
+	unsigned n_threads;
+} tr = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct trace_thread *own_thread;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct trace_thread *thread_new()
+{
+	struct trace_thread *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t || !(t->ev = malloc(TRACE_RING_EVENTS * sizeof(*t->ev)))) {
+		free(t);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tr.lock);
+	t->id = ++tr.n_threads;
+	t->next = tr.threads;
+	tr.threads = t;
+	pthread_mutex_unlock(&tr.lock);
+
+	return t;
+}
+
+void trace_event(unsigned name, char phase, uint32_t arg)
+{
+	struct trace_thread *t = own_thread;
+	struct trace_ev *ev;
+
+	if (!t && !(t = own_thread = thread_new()))
+		return;
+
+	if (phase == 'B') {
+		if (t->depth++ == 0)
+			t->active = t->frames++ % tr.sample == 0;
+	} else {
+		if (!t->depth)
+			return;
+		t->depth--;
+	}
+	if (!t->active)
+		return;
+
+	ev = &t->ev[t->n++ & (TRACE_RING_EVENTS - 1)];
+	ev->ts = now_ns();
+	ev->arg = arg;
+	ev->name = name;
+	ev->phase = phase;
+	ev->depth = phase == 'B' ? t->depth - 1 : t->depth;
+}
+
+int trace_open(const char *path, unsigned sample)
+{
+	FILE *f;
+
+	/* fail now rather than after the whole capture */
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Cannot open trace file %s, %s\n", path, strerror(errno));
+		return -1;
+	}
+	fclose(f);
+
+	tr.path = strdup(path);
+	tr.sample = sample ? sample : 1;
+	tr.start = now_ns();
+	trace_enabled = 1;
+
+	return 0;
+}
+
+static void write_thread(FILE *f, const struct trace_thread *t, int pid, int *first)
+{
+	const struct trace_ev *ev;
+	uint64_t i, n = t->n;
+	int started = 0;
+
+	fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+		*first ? "" : ",", pid, t->id, t->id);
+	*first = 0;
+
+	for (i = n > TRACE_RING_EVENTS ? n - TRACE_RING_EVENTS : 0; i < n; i++) {
+		ev = &t->ev[i & (TRACE_RING_EVENTS - 1)];
+
+		/* the ring wrapped, start with the first whole frame */
+		if (!started && (ev->phase != 'B' || ev->depth))
+			continue;
+		started = 1;
+
+		fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"diag\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u",
+			names[ev->name].name, ev->phase,
+			(ev->ts - tr.start) / 1000.0, pid, t->id);
+		if (ev->phase == names[ev->name].arg_phase)
+			fprintf(f, ",\"args\":{\"%s\":%u}", names[ev->name].arg, ev->arg);
+		fputc('}', f);
+	}
+}
+
+/* Call when the threads that trace are done */
+void trace_close()
+{
+	struct trace_thread *t;
+	int first = 1;
+	FILE *f;
+
+	if (!trace_enabled)
+		return;
+	trace_enabled = 0;
+
+	f = fopen(tr.path, "w");
+	if (!f) {
+		fprintf(stderr, "Cannot open trace file %s, %s\n", tr.path, strerror(errno));
+	} else {
+		fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+		for (t = tr.threads; t; t = t->next)
+			write_thread(f, t, getpid(), &first);
+		fprintf(f, "\n]}\n");
+		if (fclose(f) != 0)
+			fprintf(stderr, "Cannot write trace file %s, %s\n", tr.path, strerror(errno));
+	}
+
+	while ((t = tr.threads)) {
+		tr.threads = t->next;
+		free(t->ev);
+		free(t);
+	}
+	own_thread = NULL;
+	free(tr.path);
+	tr.path = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Begin and end events of the pipeline stages of sampled frames, written
+ * in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+ * at exit. Events go into a ring of the calling thread; when it is full
+ * the oldest events are overwritten.
+ *
+ * A begin at nesting depth 0 starts a frame and decides whether it is
+ * sampled, so every stage of a sampled frame is recorded and nothing of
+ * the other frames. When tracing is off a stage costs one branch.
+ */
+
+enum trace_name {
+	TRACE_FRAME,		/* one frame through the pipeline, arg length */
+	TRACE_DEFRAME,		/* HDLC deframing, arg bytes in */
+	TRACE_DIAG,		/* handle_diag(), arg log code */
+	TRACE_DTAP,		/* handle_dtap(), arg length */
+	TRACE_OUTPUT,		/* net_send_msg(), arg RAT */
+	TRACE_NAMES
+};
+
+#define TRACE_RING_EVENTS	(1 << 18)	/* per thread, a power of two */
+
+extern int trace_enabled;
+
+void trace_event(unsigned name, char phase, uint32_t arg);
+
+static inline void trace_begin(unsigned name, uint32_t arg)
+{
+	if (__builtin_expect(trace_enabled, 0))
+		trace_event(name, 'B', arg);
+}
+
+static inline void trace_end(unsigned name, uint32_t arg)
+{
+	if (__builtin_expect(trace_enabled, 0))
+		trace_event(name, 'E', arg);
+}
+
+/* Trace one in sample frames into path, written by trace_close() */
+int trace_open(const char *path, unsigned sample);
+void trace_close();
+
+#endif